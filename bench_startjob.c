@@ -0,0 +1,466 @@
+/*
+ * Benchmark: start of a Dubna job.
+ *
+ * Boot the bemsh/startjob scenario natively through ElSvsSimulate
+ * and measure the time and number of instructions it takes
+ * to reach the job start point: transfer of control to the static
+ * loader on address 53401.  The monitor is stepped apart from the job,
+ * so the time in supervisor mode is reported apart from user mode.
+ *
+ * The job runs in user mode, with pages 0-37 mapped onto physical
+ * pages 40-77. A tiny monitor in supervisor memory sets up the user
+ * mode and provides the extracodes:
+ *  э70 - exchange with drum, done on the host side as a copy of one
+ *        page (1024 words), and timed separately from the job;
+ *  э63 - user-mode "стоп", used as the job start marker;
+ *  other extracodes and interrupts stop the benchmark as failed.
+ *
+ * The job and the monitor are loaded once into a base image of memory.
+ * Every iteration starts a new processor on an overlay of the base,
+ * so the load does not depend on the size of the job: only pages
+ * written by the run are copied.  With -b the base is saved into
+ * a file, or mapped from it when the file exists.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "el_master_api.h"
+#include "el_master_ram.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+static const char default_image[] = "bemsh/startjob/startjob.oct";
+
+#define USER_BASE       0100000         // physical address of user page 0
+#define LOADER_ENTRY    053401          // entry of the static loader
+#define DRUM_BUFFER     004000          // source of э70 exchange
+#define DRUM_PAGE       006000          // destination of э70 exchange
+#define MONITOR         001000          // monitor code
+#define START_CELL      001177          // start address of the job, in the base
+#define MONITOR_SETUP   22              // instructions from MONITOR+0100 to выпр
+
+//
+// Physical memory: while the base is built, plain RAM,
+// then an overlay over the base for every iteration.
+//
+static struct ElMasterRam *ram;
+
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return elMasterRamRead(ram, address, pTag, pWord);
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return elMasterRamWrite(ram, address, tag, word);
+}
+
+ElMasterStatus elMasterRamBlockWrite(
+    ElMasterRamAddress address,
+    unsigned count,
+    const ElMasterTag *pTags,
+    const ElMasterWord *pWords)
+{
+    return elMasterRamWriteBlock(ram, address, count, pTags, pWords);
+}
+
+static void store_data(unsigned addr, uint64_t val)
+{
+    elMasterRamWordWrite(addr, TAG_NUMBER48, val << 16);
+}
+
+static void store_insn(unsigned addr, uint64_t val)
+{
+    elMasterRamWordWrite(addr, TAG_INSN48, val << 16);
+}
+
+//
+// Time spent in exchanges with drum.
+//
+static double exchange_time;
+
+static double elapsed(const struct timespec *t0, const struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+//
+// Э70: exchange with drum - copy one page from the drum buffer.
+// Registers of the job are preserved.
+//
+static ElSvsStatus drum_exchange(struct ElSvsProcessor *cpu, unsigned addr)
+{
+    struct timespec t0, t1;
+    ElMasterWord word;
+    ElMasterTag tag;
+    unsigned i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < 1024; i++) {
+        elMasterRamWordRead(DRUM_BUFFER + i, &tag, &word);
+        elMasterRamWordWrite(DRUM_PAGE + i, tag, word);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    exchange_time += elapsed(&t0, &t1);
+    return ESS_OK;
+}
+
+//
+// Pack four physical page numbers into a value for "рег 20...27",
+// as expected by mmu_set_rp().
+//
+static uint64_t pack_rp(unsigned p0, unsigned p1, unsigned p2, unsigned p3)
+{
+    unsigned page[4] = { p0, p1, p2, p3 };
+    uint64_t val = 0;
+    int i, b;
+
+    for (i = 0; i < 4; i++) {
+        val |= (uint64_t) (page[i] & 037) << (5 * i);
+        for (b = 5; b < 10; b++)
+            val |= (uint64_t) ((page[i] >> b) & 1) << (28 + 4 * (b - 5) + i);
+    }
+    return val;
+}
+
+//
+// Install the monitor: extracode vectors, handlers and user mode setup.
+//
+static void install_monitor()
+{
+    unsigned addr;
+    int i;
+
+    // Interrupts and unknown extracodes: fail.
+    for (addr = 0500; addr < 0600; addr++)
+        store_insn(addr, ElSvsAsm("стоп 76543(2), мода"));
+
+    // Э63: stop in user mode, reached on the job start point.
+    store_insn(0563, ElSvsAsm("стоп 12345(6), мода"));
+
+    // Э70: data on the drum, exchange is done by drum_exchange().
+    for (addr = 0; addr < 1024; addr++)
+        store_data(DRUM_BUFFER + addr, 04000000000000000ul | addr);
+
+    // Setup user mode: map pages and return to the job.
+    for (i = 0; i < 8; i++) {
+        unsigned page = (USER_BASE >> 10) + i * 4;
+
+        store_data(MONITOR + 0200 + i, pack_rp(page, page + 1, page + 2, page + 3));
+    }
+    store_insn(MONITOR + 0100, ElSvsAsm("сч 1200, рег 20"));
+    store_insn(MONITOR + 0101, ElSvsAsm("сч 1201, рег 21"));
+    store_insn(MONITOR + 0102, ElSvsAsm("сч 1202, рег 22"));
+    store_insn(MONITOR + 0103, ElSvsAsm("сч 1203, рег 23"));
+    store_insn(MONITOR + 0104, ElSvsAsm("сч 1204, рег 24"));
+    store_insn(MONITOR + 0105, ElSvsAsm("сч 1205, рег 25"));
+    store_insn(MONITOR + 0106, ElSvsAsm("сч 1206, рег 26"));
+    store_insn(MONITOR + 0107, ElSvsAsm("сч 1207, рег 27"));
+    store_insn(MONITOR + 0110, ElSvsAsm("уии 32(1), уиа 2000(1)")); // M1 holds start address
+    store_insn(MONITOR + 0111, ElSvsAsm("уии 27(1), уиа (1)"));
+    store_insn(MONITOR + 0112, ElSvsAsm("сч, выпр (2)"));
+
+    // Monitor variables, read by the job: ТРП and drum track.
+    store_data(USER_BASE + 0363, 0);
+    store_data(USER_BASE + 0377, 0);
+
+    // Static loader: a stop in user mode, which turns into э63.
+    store_insn(USER_BASE + LOADER_ENTRY, ElSvsAsm("стоп, мода"));
+}
+
+//
+// Load the job image, relocated into user pages.
+// Must be called before the monitor is installed.
+// Returns start address.
+//
+static unsigned load_job(struct ElSvsProcessor *cpu, FILE *input, const char *image, bool binary)
+{
+    unsigned addr;
+
+    rewind(input);
+    if (binary ? ! svs_load_image(cpu, image) : ! svs_load(cpu, input)) {
+        fprintf(stderr, "Cannot load image\n");
+        exit(1);
+    }
+    for (addr = 010; addr < USER_BASE; addr++) {
+        ElMasterWord word;
+        ElMasterTag tag;
+
+        elMasterRamWordRead(addr, &tag, &word);
+        if (tag == 0)
+            continue;
+        elMasterRamWordWrite(USER_BASE + addr, tag, word);
+        elMasterRamWordWrite(addr, 0, 0);
+    }
+    return cpu->core.PC;
+}
+
+//
+// Get the base image of memory: the job with the monitor.
+// With a file name, the base is mapped from the file when it exists,
+// or else saved into it.
+//
+static struct ElMasterRamBase *make_base(const char *image, const char *filename,
+                                         const char **how)
+{
+    struct ElMasterRamBase *base;
+
+    if (filename && access(filename, R_OK) == 0) {
+        base = elMasterRamBaseMap(filename);
+        if (! base) {
+            fprintf(stderr, "Cannot map base image %s\n", filename);
+            exit(1);
+        }
+        *how = "mapped";
+        return base;
+    }
+
+    FILE *input = fopen(image, "r");
+    if (! input) {
+        perror(image);
+        exit(1);
+    }
+
+    // Binary image made by svsimage, or text.
+    char magic[8];
+    bool binary = fread(magic, sizeof(magic), 1, input) == 1 &&
+                  memcmp(magic, SVS_IMAGE_MAGIC, sizeof(magic)) == 0;
+
+    ram = elMasterRamAllocate();
+    struct ElSvsProcessor *cpu = ElSvsAllocate(0);
+    if (! ram || ! cpu) {
+        perror("bench_startjob");
+        exit(1);
+    }
+    unsigned start = load_job(cpu, input, image, binary);
+    free(cpu);
+    fclose(input);
+    install_monitor();
+    store_data(START_CELL, start);
+
+    base = elMasterRamBaseCreate(ram);
+    elMasterRamFree(ram);
+    ram = NULL;
+    if (! base) {
+        perror("bench_startjob");
+        exit(1);
+    }
+    *how = "built";
+    if (filename) {
+        if (! elMasterRamBaseSave(base, filename)) {
+            perror(filename);
+            exit(1);
+        }
+        *how = "built and saved";
+    }
+    return base;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: bench_startjob [-n iterations] [-t trace-mode] [-s engine [-p period] [-l length]]\n");
+    fprintf(stderr, "                      [-a] [-b base] [-c] [image.oct | image.img]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -b base     map memory from the base file, or save it there\n");
+    fprintf(stderr, "  -a          run the monitor from code translated ahead of time\n");
+    fprintf(stderr, "  -c          count pairs of instructions in a word\n");
+    fprintf(stderr, "  -s engine   run by the engine, in shadow of the reference interpreter\n");
+    fprintf(stderr, "  -p period   instructions between shadow checks, default 10000\n");
+    fprintf(stderr, "  -l length   instructions in a shadow check, default 1000\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *image = default_image;
+    const char *trace_mode = NULL;
+    const char *engine = NULL;
+    uint64_t period = 10000, length = 1000;
+    int iterations = 1000;
+    bool translate = false, count_pairs = false;
+    const char *base_file = NULL;
+    struct ElSvsProcessor *translated = NULL;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:t:s:p:l:ab:c")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atoi(optarg); break;
+        case 't': trace_mode = optarg; break;
+        case 's': engine = optarg; break;
+        case 'p': period = strtoull(optarg, NULL, 0); break;
+        case 'l': length = strtoull(optarg, NULL, 0); break;
+        case 'a': translate = true; break;
+        case 'b': base_file = optarg; break;
+        case 'c': count_pairs = true; break;
+        default:  usage();
+        }
+    }
+    if (optind < argc)
+        image = argv[optind++];
+    if (optind != argc || iterations <= 0)
+        usage();
+
+    // Phase 0: the base image, once for all iterations.
+    struct timespec b0, b1;
+    const char *how;
+
+    clock_gettime(CLOCK_MONOTONIC, &b0);
+    struct ElMasterRamBase *base = make_base(image, base_file, &how);
+    clock_gettime(CLOCK_MONOTONIC, &b1);
+
+    uint64_t insn_count[2] = { 0, 0 };
+    uint64_t extracode_count[64] = { 0 };
+    uint64_t loads = 0, stores = 0, pages = 0;
+    ElSvsShadowStats shadow_total = { 0 };
+    static ElSvsPairStats pairs;
+    double load_time = 0, mode_time[2] = { 0, 0 };
+
+    for (i = 0; i < iterations; i++) {
+        struct timespec t0, t1, t2, t3;
+
+        // Phase 1: new processor and memory over the base.
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ram = elMasterRamAllocateOverlay(base);
+        struct ElSvsProcessor *cpu = ElSvsAllocate(0);
+        if (! ram || ! cpu) {
+            perror("bench_startjob");
+            return 1;
+        }
+        if (trace_mode)
+            ElSvsSetTrace(cpu, trace_mode, "bench.output");
+        ElMasterWord start;
+        ElMasterTag tag;
+        elMasterRamWordRead(START_CELL, &tag, &start);
+        ElSvsSetExtracode(cpu, 070, drum_exchange);
+        if (count_pairs)
+            ElSvsSetPairStats(cpu, &pairs);
+        ElSvsSetM(cpu, 1, start >> 16);
+        ElSvsSetPC(cpu, MONITOR + 0100);
+        if (translate) {
+            // Монитор транслируется один раз, из памяти, в отдельный
+            // процессор, и код делится со всеми процессорами.
+            if (! translated) {
+                unsigned entry = MONITOR + 0100;
+                struct timespec a0, a1;
+
+                clock_gettime(CLOCK_MONOTONIC, &a0);
+                translated = ElSvsAllocate(0);
+                if (! translated ||
+                    ! svs_aot_build(translated, "monitor", &entry, 1, false))
+                    return 1;
+
+                // Сборка не входит во время загрузки.
+                clock_gettime(CLOCK_MONOTONIC, &a1);
+                load_time -= elapsed(&a0, &a1);
+            }
+            ElSvsAotShare(cpu, translated);
+        }
+        if (engine && ! ElSvsShadowStart(cpu, engine, period, length, "bench")) {
+            fprintf(stderr, "Cannot run engine %s with period %llu and length %llu\n",
+                engine, (unsigned long long) period, (unsigned long long) length);
+            return 1;
+        }
+
+        // Phase 2: the monitor sets up user mode.
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ElSvsStatus status = engine ? ElSvsShadowStep(cpu, MONITOR_SETUP) :
+                                      ElSvsStep(cpu, MONITOR_SETUP);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        if (status != ESS_OK || IS_SUPERVISOR(cpu->core.RUU)) {
+            fprintf(stderr, "User mode not reached: status %d, PC %05o\n",
+                status, ElSvsGetPC(cpu));
+            return 1;
+        }
+
+        // Phase 3: the job runs until the job start point.
+        status = engine ? ElSvsShadowStep(cpu, UINT32_MAX) : ElSvsSimulate(cpu);
+        clock_gettime(CLOCK_MONOTONIC, &t3);
+
+        if (status != ESS_HALT || ElSvsGetPC(cpu) != 0563 ||
+            ElSvsGetM(cpu, ERET) != LOADER_ENTRY + 1) {
+            fprintf(stderr, "Job start point not reached: status %d, PC %05o, M32 %05o\n",
+                status, ElSvsGetPC(cpu), ElSvsGetM(cpu, ERET));
+            return 1;
+        }
+        load_time += elapsed(&t0, &t1);
+        mode_time[1] += elapsed(&t1, &t2);
+        mode_time[0] += elapsed(&t2, &t3);
+        ElSvsStats stats;
+        ElSvsGetStats(cpu, &stats);
+        insn_count[0] += stats.instructions[0][0] + stats.instructions[0][1];
+        insn_count[1] += stats.instructions[1][0] + stats.instructions[1][1];
+        for (int n = 0; n < 64; n++)
+            extracode_count[n] += stats.extracodes[n];
+        loads += stats.loads;
+        stores += stats.stores;
+
+        if (engine) {
+            ElSvsShadowStats shadow;
+            ElSvsShadowGetStats(cpu, &shadow);
+            shadow_total.segments += shadow.segments;
+            shadow_total.instructions += shadow.instructions;
+            shadow_total.divergences += shadow.divergences;
+            ElSvsShadowStop(cpu);
+        }
+        if (trace_mode)
+            ElSvsSetTrace(cpu, "", "");
+        ElSvsAotUnload(cpu);
+        free(cpu);
+        pages += elMasterRamResidentPages(ram);
+        elMasterRamFree(ram);
+        ram = NULL;
+    }
+    if (translated) {
+        ElSvsAotUnload(translated);
+        free(translated);
+    }
+    unsigned base_pages = elMasterRamBasePages(base);
+    elMasterRamBaseFree(base);
+
+    // Report.
+    uint64_t total = insn_count[0] + insn_count[1];
+    double run_time = mode_time[0] + mode_time[1];
+
+    printf("Image:               %s\n", image);
+    printf("Base image:          %u pages, %s in %.2f usec\n",
+        base_pages, how, elapsed(&b0, &b1) * 1e6);
+    printf("Iterations:          %d\n", iterations);
+    printf("Instructions:        %.0f per job start\n", (double) total / iterations);
+    printf("  job (user):        %.0f\n", (double) insn_count[0] / iterations);
+    printf("  monitor:           %.0f\n", (double) insn_count[1] / iterations);
+    printf("Extracodes:          ");
+    for (int n = 0; n < 64; n++) {
+        if (extracode_count[n])
+            printf(" э%o x %.0f", n, (double) extracode_count[n] / iterations);
+    }
+    printf("\n");
+    printf("Memory:              %.0f loads, %.0f stores\n",
+        (double) loads / iterations, (double) stores / iterations);
+    printf("Pages copied:        %.0f of %u\n", (double) pages / iterations, base_pages);
+    printf("Job start latency:   %.2f usec\n", (load_time + run_time) / iterations * 1e6);
+    printf("  load:              %.2f usec\n", load_time / iterations * 1e6);
+    printf("  run:               %.2f usec\n", run_time / iterations * 1e6);
+    printf("    monitor:         %.2f usec\n", mode_time[1] / iterations * 1e6);
+    printf("    job (user):      %.2f usec\n", (mode_time[0] - exchange_time) / iterations * 1e6);
+    printf("    drum exchange:   %.2f usec (host э70)\n", exchange_time / iterations * 1e6);
+    if (count_pairs) {
+        printf("Pairs of instructions in a word, per job start:\n");
+        svs_fprint_pairs(stdout, &pairs, 10, iterations);
+    }
+    if (engine) {
+        printf("Shadow of %s:%*s%.0f segments, %.1f%% of instructions checked, %llu divergences\n",
+            engine, (int) (10 - strlen(engine)), "", (double) shadow_total.segments,
+            100.0 * shadow_total.instructions / total,
+            (unsigned long long) shadow_total.divergences);
+    }
+    return 0;
+}
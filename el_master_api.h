@@ -71,6 +71,30 @@ elMasterRamWordWrite
     ElMasterWord        word
 );
 
+/*!
+ * Write a block of words with tags to RAM, in increasing addresses.
+ * Used for loading memory images.  The simulator library provides
+ * a weak default, which calls elMasterRamWordWrite() for every word;
+ * a host with block storage may override it.
+ *
+ * @param[in]   address     RAM address of the first word
+ * @param[in]   count       number of words
+ * @param[in]   pTags       word tags
+ * @param[in]   pWords      word values
+ *
+ * @return      EMS_OK
+ *              EMS_ERROR_INVALID_ADDRESS       block goes beyond 2**20
+ *              EMS_ERROR_RAM_MODULE_NOT_FOUND  RAM module not configured
+ */
+ElMasterStatus
+elMasterRamBlockWrite
+(
+    ElMasterRamAddress  address,
+    unsigned            count,
+    const ElMasterTag   *pTags,
+    const ElMasterWord  *pWords
+);
+
 /*!
  * Read a word with tag from RAM, atomically imposing the Lock Bit in the RAM.
  * Return the original value.
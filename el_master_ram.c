@@ -0,0 +1,396 @@
+/*
+ * Sparse RAM backend for the master interface.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _DEFAULT_SOURCE
+#include "el_master_ram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NPAGES  (EL_MASTER_RAM_SIZE / EL_MASTER_RAM_PAGE)
+
+//
+// Страница памяти: слова и теги.
+//
+struct ram_page {
+    ElMasterWord word[EL_MASTER_RAM_PAGE];
+    ElMasterTag tag[EL_MASTER_RAM_PAGE];
+};
+
+//
+// Базовый образ: страницы только для чтения, общие для всех копий.
+// Страницы выделены в памяти, или отображены из файла.
+//
+struct ElMasterRamBase {
+    const struct ram_page *page[NPAGES];
+    unsigned npages;                    // число страниц
+    void *map;                          // отображённый файл, или NULL
+    size_t map_size;
+};
+
+//
+// Память: таблица страниц для чтения, куда входят страницы базового
+// образа, и таблица собственных страниц, выделяемых при первой записи.
+// Номера собственных страниц перечислены в списке, чтобы очистка
+// занимала время по числу записанных страниц, а не всей памяти.
+//
+struct ElMasterRam {
+    const struct ElMasterRamBase *base; // базовый образ, или NULL
+    unsigned resident;                  // число собственных страниц
+    const struct ram_page *rpage[NPAGES];
+    struct ram_page *wpage[NPAGES];
+    uint16_t own[NPAGES];               // номера собственных страниц
+};
+
+//
+// Файл базового образа: заголовок, номера страниц в файле
+// (0 - нет страницы), затем сами страницы.
+//
+#define BASE_MAGIC      "SVSRBASE"
+#define BASE_VERSION    1
+#define BASE_ALIGN      4096
+
+struct base_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t npages;                    // число страниц в файле
+    uint32_t slot[NPAGES];              // номер страницы в файле, с 1
+};
+
+#define BASE_DATA       ((sizeof(struct base_header) + BASE_ALIGN - 1) & ~(BASE_ALIGN - 1))
+
+struct ElMasterRam *elMasterRamAllocate()
+{
+    return calloc(1, sizeof(struct ElMasterRam));
+}
+
+struct ElMasterRam *elMasterRamAllocateOverlay(const struct ElMasterRamBase *pBase)
+{
+    struct ElMasterRam *pRam = malloc(sizeof(struct ElMasterRam));
+
+    if (! pRam)
+        return NULL;
+    pRam->base = pBase;
+    pRam->resident = 0;
+    memcpy(pRam->rpage, pBase->page, sizeof(pRam->rpage));
+    memset(pRam->wpage, 0, sizeof(pRam->wpage));
+    return pRam;
+}
+
+void elMasterRamFree(struct ElMasterRam *pRam)
+{
+    if (! pRam)
+        return;
+    elMasterRamClear(pRam);
+    free(pRam);
+}
+
+ElMasterStatus elMasterRamRead(
+    struct ElMasterRam *pRam,
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    if (address >= EL_MASTER_RAM_SIZE)
+        return EMS_ERROR_INVALID_ADDRESS;
+
+    const struct ram_page *p = pRam->rpage[address / EL_MASTER_RAM_PAGE];
+    if (! p) {
+        // Страница не выделена: читается как нуль.
+        *pWord = 0;
+        *pTag = 0;
+        return EMS_OK;
+    }
+    *pWord = p->word[address % EL_MASTER_RAM_PAGE];
+    *pTag = p->tag[address % EL_MASTER_RAM_PAGE];
+    return EMS_OK;
+}
+
+//
+// Собственная страница для записи: копия страницы базового образа,
+// или новая страница.
+//
+static struct ram_page *ram_page_commit(struct ElMasterRam *pRam, unsigned n)
+{
+    const struct ram_page *shared = pRam->rpage[n];
+    struct ram_page *p;
+
+    if (shared) {
+        p = malloc(sizeof(struct ram_page));
+        if (p)
+            memcpy(p, shared, sizeof(struct ram_page));
+    } else {
+        p = calloc(1, sizeof(struct ram_page));
+    }
+    if (! p)
+        return NULL;
+    pRam->wpage[n] = p;
+    pRam->rpage[n] = p;
+    pRam->own[pRam->resident++] = n;
+    return p;
+}
+
+ElMasterStatus elMasterRamWrite(
+    struct ElMasterRam *pRam,
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    if (address >= EL_MASTER_RAM_SIZE)
+        return EMS_ERROR_INVALID_ADDRESS;
+
+    unsigned n = address / EL_MASTER_RAM_PAGE;
+    struct ram_page *p = pRam->wpage[n];
+    if (! p) {
+        // Запись нуля в пустую страницу не требует её выделения.
+        if (! pRam->rpage[n] && ! (word | tag))
+            return EMS_OK;
+        p = ram_page_commit(pRam, n);
+        if (! p)
+            return EMS_ERROR_RAM_MODULE_NOT_FOUND;
+    }
+    p->word[address % EL_MASTER_RAM_PAGE] = word;
+    p->tag[address % EL_MASTER_RAM_PAGE] = tag;
+    return EMS_OK;
+}
+
+ElMasterStatus elMasterRamWriteBlock(
+    struct ElMasterRam *pRam,
+    ElMasterRamAddress address,
+    unsigned count,
+    const ElMasterTag *pTags,
+    const ElMasterWord *pWords)
+{
+    if (address > EL_MASTER_RAM_SIZE || count > EL_MASTER_RAM_SIZE - address)
+        return EMS_ERROR_INVALID_ADDRESS;
+
+    // Копируем постранично.
+    while (count > 0) {
+        unsigned n = address / EL_MASTER_RAM_PAGE;
+        unsigned offset = address % EL_MASTER_RAM_PAGE;
+        unsigned len = EL_MASTER_RAM_PAGE - offset;
+        struct ram_page *p = pRam->wpage[n];
+
+        if (len > count)
+            len = count;
+        if (! p) {
+            p = ram_page_commit(pRam, n);
+            if (! p)
+                return EMS_ERROR_RAM_MODULE_NOT_FOUND;
+        }
+        memcpy(&p->word[offset], pWords, len * sizeof(pWords[0]));
+        memcpy(&p->tag[offset], pTags, len * sizeof(pTags[0]));
+        address += len;
+        pWords += len;
+        pTags += len;
+        count -= len;
+    }
+    return EMS_OK;
+}
+
+void elMasterRamClear(struct ElMasterRam *pRam)
+{
+    unsigned i;
+
+    for (i = 0; i < pRam->resident; i++) {
+        unsigned n = pRam->own[i];
+
+        free(pRam->wpage[n]);
+        pRam->wpage[n] = NULL;
+        pRam->rpage[n] = pRam->base ? pRam->base->page[n] : NULL;
+    }
+    pRam->resident = 0;
+}
+
+unsigned elMasterRamResidentPages(struct ElMasterRam *pRam)
+{
+    return pRam->resident;
+}
+
+bool elMasterRamCompare(struct ElMasterRam *pRamA, struct ElMasterRam *pRamB,
+    ElMasterRamAddress *pAddress)
+{
+    static const struct ram_page zero;
+    unsigned i, k;
+
+    for (i = 0; i < NPAGES; i++) {
+        const struct ram_page *a = pRamA->rpage[i];
+        const struct ram_page *b = pRamB->rpage[i];
+
+        // Общая страница, или обе пустые.
+        if (a == b)
+            continue;
+        if (! a)
+            a = &zero;
+        if (! b)
+            b = &zero;
+        if (memcmp(a, b, sizeof(struct ram_page)) == 0)
+            continue;
+        for (k = 0; k < EL_MASTER_RAM_PAGE; k++) {
+            if (a->word[k] != b->word[k] || a->tag[k] != b->tag[k])
+                break;
+        }
+        *pAddress = i * EL_MASTER_RAM_PAGE + k;
+        return false;
+    }
+    return true;
+}
+
+struct ElMasterRamBase *elMasterRamBaseCreate(struct ElMasterRam *pRam)
+{
+    unsigned i;
+
+    if (pRam->base)
+        return NULL;
+
+    struct ElMasterRamBase *pBase = calloc(1, sizeof(struct ElMasterRamBase));
+    if (! pBase)
+        return NULL;
+
+    // Страницы переходят к образу.
+    for (i = 0; i < NPAGES; i++) {
+        pBase->page[i] = pRam->wpage[i];
+        pRam->wpage[i] = NULL;
+        pRam->rpage[i] = NULL;
+    }
+    pBase->npages = pRam->resident;
+    pRam->resident = 0;
+    return pBase;
+}
+
+bool elMasterRamBaseSave(const struct ElMasterRamBase *pBase, const char *filename)
+{
+    struct base_header *header = calloc(1, BASE_DATA);
+    unsigned i, npages = 0;
+
+    if (! header) {
+        perror(filename);
+        return false;
+    }
+    memcpy(header->magic, BASE_MAGIC, sizeof(header->magic));
+    header->version = BASE_VERSION;
+    for (i = 0; i < NPAGES; i++) {
+        if (pBase->page[i])
+            header->slot[i] = ++npages;
+    }
+    header->npages = npages;
+
+    FILE *output = fopen(filename, "w");
+    if (! output) {
+        perror(filename);
+        free(header);
+        return false;
+    }
+    bool ok = (fwrite(header, BASE_DATA, 1, output) == 1);
+    for (i = 0; ok && i < NPAGES; i++) {
+        if (pBase->page[i])
+            ok = (fwrite(pBase->page[i], sizeof(struct ram_page), 1, output) == 1);
+    }
+    if (fclose(output) != 0)
+        ok = false;
+    if (! ok)
+        perror(filename);
+    free(header);
+    return ok;
+}
+
+struct ElMasterRamBase *elMasterRamBaseMap(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < BASE_DATA) {
+        fprintf(stderr, "%s: Bad RAM image\n", filename);
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+
+    const struct base_header *header = map;
+    struct ElMasterRamBase *pBase = NULL;
+    unsigned i;
+
+    if (memcmp(header->magic, BASE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != BASE_VERSION ||
+        header->npages > (size - BASE_DATA) / sizeof(struct ram_page))
+        goto bad;
+
+    pBase = calloc(1, sizeof(struct ElMasterRamBase));
+    if (! pBase) {
+        perror(filename);
+        munmap(map, size);
+        return NULL;
+    }
+    for (i = 0; i < NPAGES; i++) {
+        unsigned slot = header->slot[i];
+
+        if (slot == 0)
+            continue;
+        if (slot > header->npages)
+            goto bad;
+        pBase->page[i] = (const struct ram_page*) ((const char*) map + BASE_DATA +
+                         (slot - 1) * sizeof(struct ram_page));
+    }
+    pBase->npages = header->npages;
+    pBase->map = map;
+    pBase->map_size = size;
+    return pBase;
+bad:
+    fprintf(stderr, "%s: Bad RAM image\n", filename);
+    free(pBase);
+    munmap(map, size);
+    return NULL;
+}
+
+void elMasterRamBaseFree(struct ElMasterRamBase *pBase)
+{
+    unsigned i;
+
+    if (! pBase)
+        return;
+    if (pBase->map) {
+        munmap(pBase->map, pBase->map_size);
+    } else {
+        for (i = 0; i < NPAGES; i++)
+            free((void*) pBase->page[i]);
+    }
+    free(pBase);
+}
+
+unsigned elMasterRamBasePages(const struct ElMasterRamBase *pBase)
+{
+    return pBase->npages;
+}
@@ -0,0 +1,233 @@
+/*
+ * Sparse RAM backend for the master interface.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __EL_MASTER_RAM_H
+#define __EL_MASTER_RAM_H
+#include <stdbool.h>
+#include "el_master_api.h"
+
+/*!
+ *  RAM of 2**20 words with tags, committed in pages of 1024 words
+ *  on first write of a non-zero word.  Pages never written read as zero.
+ *  A host implements elMasterRamWordRead() and elMasterRamWordWrite()
+ *  by calling elMasterRamRead() and elMasterRamWrite() on its instance.
+ *
+ *  RAM can also be an overlay over a read-only base image, shared
+ *  by many instances: a page of the base is copied into the instance
+ *  on first write to it.
+ */
+#define EL_MASTER_RAM_SIZE      (1024 * 1024)   // words
+#define EL_MASTER_RAM_PAGE      1024            // words per page
+
+struct ElMasterRam;
+struct ElMasterRamBase;
+
+/*!
+ * Create empty RAM: no pages are committed.
+ * @return      pointer to RAM, or NULL when out of memory
+ */
+struct ElMasterRam *
+elMasterRamAllocate
+(
+    void
+);
+
+/*!
+ * Create RAM as an overlay over the base image: no pages are copied.
+ * The base must not be released while the overlay exists.
+ * @param[in]   pBase       base image
+ * @return      pointer to RAM, or NULL when out of memory
+ */
+struct ElMasterRam *
+elMasterRamAllocateOverlay
+(
+    const struct ElMasterRamBase *pBase
+);
+
+/*!
+ * Release RAM with all its pages.
+ * @param[in]   pRam        RAM instance
+ */
+void
+elMasterRamFree
+(
+    struct ElMasterRam  *pRam
+);
+
+/*!
+ * Read a word with tag.
+ * @param[in]   pRam        RAM instance
+ * @param[in]   address     RAM address
+ * @param[out]  pTag        word tag
+ * @param[out]  pWord       word value
+ * @return      EMS_OK
+ *              EMS_ERROR_INVALID_ADDRESS       address >= 2**20
+ */
+ElMasterStatus
+elMasterRamRead
+(
+    struct ElMasterRam  *pRam,
+    ElMasterRamAddress  address,
+    ElMasterTag         *pTag,
+    ElMasterWord        *pWord
+);
+
+/*!
+ * Write a word with tag.  The page is committed on first write
+ * of a non-zero word or tag.
+ * @param[in]   pRam        RAM instance
+ * @param[in]   address     RAM address
+ * @param[in]   tag         word tag
+ * @param[in]   word        word value
+ * @return      EMS_OK
+ *              EMS_ERROR_INVALID_ADDRESS       address >= 2**20
+ *              EMS_ERROR_RAM_MODULE_NOT_FOUND  out of memory for the page
+ */
+ElMasterStatus
+elMasterRamWrite
+(
+    struct ElMasterRam  *pRam,
+    ElMasterRamAddress  address,
+    ElMasterTag         tag,
+    ElMasterWord        word
+);
+
+/*!
+ * Write a block of words with tags, page by page.
+ * Pages are committed even for zero words.
+ * @param[in]   pRam        RAM instance
+ * @param[in]   address     RAM address of the first word
+ * @param[in]   count       number of words
+ * @param[in]   pTags       word tags
+ * @param[in]   pWords      word values
+ * @return      EMS_OK
+ *              EMS_ERROR_INVALID_ADDRESS       block goes beyond 2**20
+ *              EMS_ERROR_RAM_MODULE_NOT_FOUND  out of memory for a page
+ */
+ElMasterStatus
+elMasterRamWriteBlock
+(
+    struct ElMasterRam  *pRam,
+    ElMasterRamAddress  address,
+    unsigned            count,
+    const ElMasterTag   *pTags,
+    const ElMasterWord  *pWords
+);
+
+/*!
+ * Release all pages: RAM reads as zero.
+ * @param[in]   pRam        RAM instance
+ */
+void
+elMasterRamClear
+(
+    struct ElMasterRam  *pRam
+);
+
+/*!
+ * Query the number of committed pages, not counting pages
+ * of the base image which were not written.
+ * @param[in]   pRam        RAM instance
+ * @return      number of pages, each EL_MASTER_RAM_PAGE words
+ */
+unsigned
+elMasterRamResidentPages
+(
+    struct ElMasterRam  *pRam
+);
+
+/*!
+ * Compare contents of two RAM instances.
+ * @param[in]   pRamA       first RAM instance
+ * @param[in]   pRamB       second RAM instance
+ * @param[out]  pAddress    first address where words or tags differ
+ * @return      true when contents are equal
+ */
+bool
+elMasterRamCompare
+(
+    struct ElMasterRam  *pRamA,
+    struct ElMasterRam  *pRamB,
+    ElMasterRamAddress  *pAddress
+);
+
+/*!
+ * Turn contents of RAM into a base image.  Pages are moved into the
+ * image, and the RAM becomes empty.
+ * @param[in]   pRam        RAM instance, not an overlay
+ * @return      pointer to base image, or NULL when pRam is an overlay
+ *              or out of memory
+ */
+struct ElMasterRamBase *
+elMasterRamBaseCreate
+(
+    struct ElMasterRam  *pRam
+);
+
+/*!
+ * Write base image to file, for mapping by elMasterRamBaseMap().
+ * @param[in]   pBase       base image
+ * @param[in]   filename    file name
+ * @return      true on success
+ */
+bool
+elMasterRamBaseSave
+(
+    const struct ElMasterRamBase *pBase,
+    const char          *filename
+);
+
+/*!
+ * Map base image from file, read-only.  Pages are not loaded:
+ * processes mapping the same file share them in the page cache.
+ * @param[in]   filename    file name
+ * @return      pointer to base image, or NULL on error
+ */
+struct ElMasterRamBase *
+elMasterRamBaseMap
+(
+    const char          *filename
+);
+
+/*!
+ * Release base image, after all its overlays are released.
+ * @param[in]   pBase       base image
+ */
+void
+elMasterRamBaseFree
+(
+    struct ElMasterRamBase *pBase
+);
+
+/*!
+ * Query the number of pages in base image.
+ * @param[in]   pBase       base image
+ * @return      number of pages, each EL_MASTER_RAM_PAGE words
+ */
+unsigned
+elMasterRamBasePages
+(
+    const struct ElMasterRamBase *pBase
+);
+
+#endif // __EL_MASTER_RAM_H
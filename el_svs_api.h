@@ -24,6 +24,8 @@
 #ifndef __EL_SVS_API_H
 #define __EL_SVS_API_H
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 
 /*!
  *  Status codes
@@ -52,11 +54,107 @@ typedef enum {
     ESS_UNIMPLEMENTED,                 // Не реализовано
 } ElSvsStatus;
 
+/*!
+ *  Performance counters
+ */
+typedef struct {
+    uint64_t instructions[2][2];       // executed instructions: [user, supervisor][left, right]
+    uint64_t extracodes[64];           // extracodes by number: [050] is э50, [020] is э20
+    uint64_t internal_interrupts[ESS_UNIMPLEMENTED + 1]; // internal interrupts by cause
+    uint64_t external_interrupts[32];  // external interrupts by bit of ГРВП
+    uint64_t loads;                    // operand reads from memory
+    uint64_t stores;                   // operand writes to memory
+    uint64_t fetches;                  // instruction fetches
+    uint64_t tlb_reloads;              // writes to page registers
+    uint64_t modifiers;                // instructions мода and мод
+} ElSvsStats;
+
+/*!
+ *  Words with left and right instruction executed in a row:
+ *  [left][right], by opcode 000-077, and long opcode 0200-0370 at 0100-0117
+ */
+typedef struct {
+    uint64_t pairs[0120][0120];
+} ElSvsPairStats;
+
+/*!
+ *  Trace filter: only instructions matching all conditions are traced.
+ */
+#define ELSVS_TRACE_MAXRANGES   8
+#define ELSVS_TRACE_USER        1      // trace user mode
+#define ELSVS_TRACE_SUPERVISOR  2      // trace supervisor mode
+
+typedef struct {
+    unsigned nranges;                  // number of PC ranges, 0 - any address
+    struct {
+        unsigned lo, hi;               // PC range, inclusive
+        int physical;                  // physical address range
+    } range[ELSVS_TRACE_MAXRANGES];
+    unsigned modes;                    // ELSVS_TRACE_USER/SUPERVISOR, 0 - any
+    uint64_t opcodes[2];               // set of opcodes, empty - any
+    unsigned cpus;                     // bit mask of processor indices, 0 - any
+} ElSvsTraceFilter;
+
+/*!
+ *  Trace trigger: tracing is off until one of the enabled events happens,
+ *  then stays on for the given number of instructions.
+ */
+typedef struct {
+    int on_pc;                         // start when PC reaches address pc
+    unsigned pc;
+    uint64_t after;                    // start after this many instructions, 0 - off
+    int on_exception;                  // start on exception of given type
+    ElSvsStatus exception;
+    int on_write;                      // start on write to virtual address write_addr
+    unsigned write_addr;
+    uint64_t duration;                 // stop after this many instructions, 0 - never
+    int repeat;                        // arm again after stop
+} ElSvsTraceTrigger;
+
+/*!
+ *  Kinds of breakpoints, by virtual address.
+ */
+typedef enum {
+    ELSVS_BREAK_EXEC,                  // stop before instruction word is executed: ESS_IBKPT
+    ELSVS_BREAK_READ,                  // stop on operand read: ESS_RWATCH
+    ELSVS_BREAK_WRITE,                 // stop on operand write: ESS_WWATCH
+    ELSVS_BREAK_KINDS,
+} ElSvsBreakKind;
+
+/*!
+ *  Result of lockstep comparison with a reference trace.
+ */
+typedef struct {
+    uint64_t instructions;             // instructions compared
+    uint64_t line;                     // line of the trace where they diverged, 0 - none
+    char message[256];                 // description of the divergence
+} ElSvsLockstepResult;
+
+/*!
+ *  Counters of shadow execution.
+ */
+typedef struct {
+    uint64_t segments;                 // segments checked against the reference
+    uint64_t instructions;             // instructions in checked segments
+    uint64_t divergences;              // segments that diverged
+} ElSvsShadowStats;
+
 /*!
  *  Interface functions
  */
 struct ElSvsProcessor;
 
+/*!
+ *  Host implementation of an extracode.
+ *  Called with the executive address of the extracode, which is also
+ *  placed into M[14]; M[ERET] and M[SPSW] are set as on extracode entry.
+ *  Return ESS_OK when done: execution continues from M[ERET],
+ *  as after "выпр".  Return ESS_UNIMPLEMENTED to pass the extracode
+ *  to the guest routine at 0500+opcode.  Any other status stops
+ *  the simulation.
+ */
+typedef ElSvsStatus (*ElSvsExtracode)(struct ElSvsProcessor *cpu, unsigned addr);
+
 /*
  * Instantiate a processor.
  */
@@ -64,6 +162,10 @@ struct ElSvsProcessor *ElSvsAllocate(int cpu_index);
 
 /*
  * Run simulation.
+ * Returns ESS_OK when the instruction count set by ElSvsStep() is reached.
+ * On abnormal stop (ESS_BADCMD, ESS_INSN_CHECK, ESS_RUNOUT, ESS_DOUBLE_INTR
+ * and the like) the last executed instructions are written to the trace
+ * output, even when tracing is disabled.
  */
 ElSvsStatus ElSvsSimulate(struct ElSvsProcessor *cpu);
 
@@ -76,9 +178,38 @@ ElSvsStatus ElSvsSimulate(struct ElSvsProcessor *cpu);
  * m - trace data load and store from/to memory
  * x - trace exceptions
  * r - trace hw registers
+ * b - write trace in compact binary form, to be decoded by tracedump;
+ *     records are buffered and written out when ElSvsSimulate() returns
+ * a - format and write trace in a background thread; processors
+ *     tracing into the same file get their output merged in order
+ * d - with 'a': drop trace records when the queue is full,
+ *     instead of waiting for the background thread
  */
 void ElSvsSetTrace(struct ElSvsProcessor *cpu, const char *trace_mode, const char *filename);
 
+/*
+ * Restrict tracing by filter, or remove the filter when NULL.
+ * The filter is checked before anything is traced for the instruction.
+ * Fetch trace is only filtered by processor, mode and virtual PC,
+ * as the opcode and physical address are not known yet.
+ * Registers changed by skipped instructions appear at the next
+ * traced instruction.
+ */
+void ElSvsSetTraceFilter(struct ElSvsProcessor *cpu, const ElSvsTraceFilter *filter);
+
+/*
+ * Arm the trace trigger, or remove it when NULL.
+ * Trace mode and filter are set as usual, and apply while
+ * the trace window is open.
+ */
+void ElSvsSetTraceTrigger(struct ElSvsProcessor *cpu, const ElSvsTraceTrigger *trigger);
+
+/*
+ * Add opcode to the filter: 000...077 for short format,
+ * 0200...0370 for long format, as in field КОП.
+ */
+void ElSvsTraceFilterOpcode(ElSvsTraceFilter *filter, unsigned opcode);
+
 /*
  * Set register value.
  */
@@ -97,6 +228,178 @@ uint64_t ElSvsGetAcc(struct ElSvsProcessor *cpu);
 uint64_t ElSvsGetRMR(struct ElSvsProcessor *cpu);
 unsigned ElSvsGetRAU(struct ElSvsProcessor *cpu);
 
+/*
+ * Get or clear performance counters.
+ */
+void ElSvsGetStats(struct ElSvsProcessor *cpu, ElSvsStats *stats);
+void ElSvsResetStats(struct ElSvsProcessor *cpu);
+
+/*
+ * Count pairs of instructions executed in one word into the table,
+ * owned by the caller: counts are added to its contents.  NULL stops
+ * counting, which is off by default.  The table is not saved with the
+ * state, and must not be shared by processors in different threads.
+ */
+void ElSvsSetPairStats(struct ElSvsProcessor *cpu, ElSvsPairStats *pairs);
+
+/*
+ * Install host implementation of extracode: opcode 050...077 for э50...э77,
+ * 020 or 021 for э20 and э21.  Null handler restores the guest routine.
+ */
+void ElSvsSetExtracode(struct ElSvsProcessor *cpu, unsigned opcode, ElSvsExtracode handler);
+
+/*
+ * Install built-in host extracodes, compatible with Dispak:
+ * elementary functions of э50.
+ */
+void ElSvsSetHostExtracodes(struct ElSvsProcessor *cpu);
+
+/*
+ * Built-in host extracodes.
+ * ElSvsExtracodeMath - elementary functions of э50: sqrt, sin, cos, arctg,
+ *      arcsin, ln, exp and entier for addresses 070...077.
+ *      Other addresses of э50 are left to the guest routine.
+ */
+ElSvsStatus ElSvsExtracodeMath(struct ElSvsProcessor *cpu, unsigned addr);
+
+/*
+ * Set or clear a breakpoint or watchpoint on virtual address,
+ * while the processor is stopped.  After a stop on breakpoint,
+ * the instruction is executed without stop when simulation resumes.
+ */
+void ElSvsSetBreakpoint(struct ElSvsProcessor *cpu, ElSvsBreakKind kind, unsigned addr);
+void ElSvsClearBreakpoint(struct ElSvsProcessor *cpu, ElSvsBreakKind kind, unsigned addr);
+void ElSvsClearAllBreakpoints(struct ElSvsProcessor *cpu);
+
+/*
+ * Save or restore processor state: registers, pult, page tables and
+ * trace settings, as a binary image for the same build of simulator.
+ * Trace output is not saved: it stays as set by ElSvsSetTrace().
+ * Return false on error.
+ */
+bool ElSvsSaveState(struct ElSvsProcessor *cpu, const char *filename);
+bool ElSvsRestoreState(struct ElSvsProcessor *cpu, const char *filename);
+
+/*
+ * Copy processor state from another processor, in memory: registers,
+ * pult, page tables, instruction count and performance counters.
+ * Much faster than ElSvsAllocate(), for reset to a pristine state
+ * between fuzzing iterations.  Trace settings, breakpoints and host
+ * extracodes of dst are not changed; recording of dst is stopped.
+ */
+void ElSvsCopyState(struct ElSvsProcessor *dst, const struct ElSvsProcessor *src);
+
+/*
+ * Save or restore contents of RAM through the master interface.
+ * Return false on error.
+ */
+bool ElSvsSaveMemory(const char *filename);
+bool ElSvsRestoreMemory(const char *filename);
+
+/*
+ * Fork a child simulation from the current state, as a copy of the
+ * whole process: memory pages are shared copy-on-write until modified.
+ * Returns 0 in the child, process id of the child in the parent,
+ * or -1 on error.  Background trace ('a' mode) of this processor is
+ * disabled before fork; other processors must not use it at the time.
+ * The child should set its own trace file.
+ */
+int ElSvsFork(struct ElSvsProcessor *cpu);
+
+/*
+ * External events from host: timer interrupt (250 Hz)
+ * and request from control panel.
+ */
+void ElSvsTimerInterrupt(struct ElSvsProcessor *cpu);
+void ElSvsPanelRequest(struct ElSvsProcessor *cpu);
+
+/*
+ * Record the run of a single processor, for replay and reverse execution.
+ * A snapshot of processor state and RAM is taken every interval
+ * instructions; only the last nsnapshots are kept.  External inputs
+ * (ElSvsTimerInterrupt, ElSvsPanelRequest, ElSvsSetPult) are written
+ * to the log.  RAM must be changed only by this processor.
+ * Return false on error.
+ */
+bool ElSvsRecordStart(struct ElSvsProcessor *cpu, uint64_t interval, unsigned nsnapshots);
+void ElSvsRecordStop(struct ElSvsProcessor *cpu);
+
+/*
+ * Number of instructions started by the processor.
+ */
+uint64_t ElSvsGetInstructionCount(struct ElSvsProcessor *cpu);
+
+/*
+ * Run the given number of instructions.
+ * Return ESS_OK when done, or the status of an earlier stop.
+ */
+ElSvsStatus ElSvsStep(struct ElSvsProcessor *cpu, uint64_t n);
+
+/*
+ * Step backwards by the given number of instructions, while recording:
+ * the nearest earlier snapshot is restored and the run is replayed
+ * up to that point.  Trace settings and breakpoints are not changed.
+ * Further simulation replays inputs from the log, and calls to
+ * ElSvsTimerInterrupt, ElSvsPanelRequest and ElSvsSetPult are ignored,
+ * until the recorded end of the run is reached.
+ * Return ESS_OK when done, or the status of a stop in replay.
+ */
+ElSvsStatus ElSvsReverseStep(struct ElSvsProcessor *cpu, uint64_t n);
+
+/*
+ * Run the processor in lockstep with a reference trace, in the text
+ * format of the instruction and register trace ("ir") of the simulator.
+ * It is meant for output-full.trace of the RTL testbench, but has been
+ * checked only against traces written by the simulator itself.
+ * The trace is read as a stream: for every instruction record one
+ * instruction is executed and its address and code are compared,
+ * then register and memory writes are compared with the state
+ * of the simulator.  Other records are skipped.
+ * Stop at the first divergence and return false, with details in result.
+ */
+bool ElSvsLockstep(struct ElSvsProcessor *cpu, FILE *trace, ElSvsLockstepResult *result);
+
+/*
+ * Shadow execution, for validation of an execution engine under real load.
+ * ElSvsShadowStep() runs the named engine, and every period instructions
+ * a segment of length instructions is checked: it is executed again
+ * by the reference interpreter from the saved state, with memory
+ * rolled back, and registers, stop status and words written to memory
+ * are compared.  A divergence is reported to the trace output, and when
+ * snapshot is not empty, state and memory at the start of the segment
+ * are saved to files snapshot-N.state and snapshot-N.mem, where N is the
+ * instruction count, for ElSvsRestoreState() and ElSvsRestoreMemory().
+ * After a divergence the run continues from the reference result.
+ * Host extracodes in checked segments are called twice.
+ * Not available while recording.  Return false on error.
+ */
+bool ElSvsShadowStart(struct ElSvsProcessor *cpu, const char *engine,
+                      uint64_t period, uint64_t length, const char *snapshot);
+void ElSvsShadowStop(struct ElSvsProcessor *cpu);
+ElSvsStatus ElSvsShadowStep(struct ElSvsProcessor *cpu, uint64_t n);
+void ElSvsShadowGetStats(struct ElSvsProcessor *cpu, ElSvsShadowStats *stats);
+
+/*
+ * Code translated ahead of time by svsaot from a memory image,
+ * as a shared object built for the same version of simulator.
+ * After ElSvsAotLoad(), ElSvsSimulate() and ElSvsStep() run translated
+ * blocks where the program reaches their start addresses, and interpret
+ * the rest.  Every word is compared with its translated contents
+ * on fetch, so code modified by the program is interpreted.
+ * Translated code is not used with breakpoints of execution
+ * or a trace filter.  Return false on error.
+ */
+bool ElSvsAotLoad(struct ElSvsProcessor *cpu, const char *filename);
+void ElSvsAotUnload(struct ElSvsProcessor *cpu);
+
+/*
+ * Share translated code of src with dst, replacing code of dst.
+ * The code is unloaded by ElSvsAotUnload() of the last processor
+ * which uses it.  Processors sharing the code must be used
+ * from one thread.
+ */
+void ElSvsAotShare(struct ElSvsProcessor *dst, const struct ElSvsProcessor *src);
+
 /*
  * Convert assembly source code into binary word.
  */
@@ -28,12 +28,14 @@
 #include <setjmp.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include "el_svs_api.h"
 
 //
 // Memory.
 //
 #define SVS_NREGS       30              // number of registers-modifiers
 #define SVS_MEMSIZE     (1024 * 1024)   // memory size, words
+#define SVS_CACHE_LINE  64              // host cache line, bytes
 
 //
 // Разряды машинного слова, справа налево, начиная с 1.
@@ -65,9 +67,19 @@
 struct ElSvsCoreState {
     uint32_t PC;            // счётчик команд СчАС
     uint32_t RAU, RUU;      // режим АУ, режим УУ
+    uint32_t RZ;            // РЗ, регистр защиты
     uint64_t ACC, RMR;      // аккумулятор, РМР
-    uint32_t M[SVS_NREGS];  // регистры-модификаторы
+    uint64_t RPR;           // РПР: регистр внутренних прерываний
+    uint32_t GRVP;          // ГРВП: главный регистр внешних прерываний
+    uint32_t GRM;           // ГРМ: главный регистр маски
+    uint8_t TagR;           // регистр тега
+    uint32_t M[040];        // регистры-модификаторы, из них SVS_NREGS настоящих:
+                            // уи, уим, счи и уии в супервизоре адресуют
+                            // и 036, 037, но не соседние поля
 
+    //
+    // Регистры выше нужны каждой команде, ниже - только при
+    // смене приписки, прерываниях и трассировке.
     //
     // 64-битные регистры RP0-RP7 - для отображения регистров приписки,
     // группами по 4 ради компактности, 12 бит на страницу.
@@ -76,12 +88,6 @@ struct ElSvsCoreState {
     //
     uint64_t RP[8];         // РП, регистры приписки страниц пользователя
     uint64_t RPS[8];        // РПС, регистры приписки страниц супервизора
-    uint32_t RZ;            // РЗ, регистр защиты
-
-    uint8_t TagR;           // регистр тега
-    uint64_t RPR;           // РПР: регистр внутренних прерываний
-    uint32_t GRVP;          // ГРВП: главный регистр внешних прерываний
-    uint32_t GRM;           // ГРМ: главный регистр маски
 
     uint64_t PP, OPP;       // ПП, ОПП
     uint64_t POP, OPOP;     // ПОП, ОПОП
@@ -91,22 +97,112 @@ struct ElSvsCoreState {
 };
 
 //
-// Состояние одного процессора.
+// Признаки изменения регистров, для трассировки.
+// Часто меняющиеся регистры (сумматор, РМР, модификаторы, режимы АУ
+// и УУ, тег, адрес прерывания, ГРВП) сравниваются с прежним значением
+// всегда, остальные - только при установленном признаке.
 //
-struct ElSvsProcessor {
-    // Текущее состояние.
-    struct ElSvsCoreState core;
+#define DIRTY_RP        (1ULL << 32)            // РП, РПС, РЗ
+#define DIRTY_CTRL      (1ULL << 33)            // РПР, ГРМ, ПП, ОПП, ПОП, ОПОП, РКП
+#define DIRTY_ALL       (~0ULL)
 
-    // Предыдущее состояние, для трассировки.
-    struct ElSvsCoreState prev;
+//
+// Запись трассы фиксированного размера.
+// В текстовом режиме запись сразу печатается, в двоичном -
+// накапливается в буфере и сбрасывается в файл.
+//
+enum {
+    TRACE_HEADER,           // заголовок файла двоичной трассы
+    TRACE_INSN,             // выполнение команды
+    TRACE_FETCH,            // выборка команды из памяти
+    TRACE_READ,             // чтение 48-битного слова
+    TRACE_READ64,           // чтение 64-битного слова
+    TRACE_WRITE,            // запись 48-битного слова
+    TRACE_WRITE64,          // запись 64-битного слова
+    TRACE_REG,              // изменение регистра
+    TRACE_TEXT,             // сообщение, текст в следующих записях
+};
 
-    int index;                  // номер процессора 0...3
-    uint64_t pult[8];           // тумблерные регистры
+struct ElSvsTraceRecord {
+    uint8_t type;           // тип записи
+    uint8_t cpu;            // номер процессора
+    uint16_t vaddr;         // виртуальный адрес, номер регистра или длина текста
+    unsigned paddr : 24;    // физический адрес
+    unsigned tag : 8;       // тег слова, или признак правой команды
+    uint64_t value;         // значение слова, команды или регистра
+};
+
+//
+// Режимы трассировки, заданные в ElSvsSetTrace().
+//
+#define TRACE_FLAG_INSTRUCTIONS 001
+#define TRACE_FLAG_EXTRACODES   002
+#define TRACE_FLAG_FETCH        004
+#define TRACE_FLAG_MEMORY       010
+#define TRACE_FLAG_EXCEPTIONS   020
+#define TRACE_FLAG_REGISTERS    040
+
+#define SVS_TRACE_BUFSZ 65536   // размер буфера двоичной трассы, записей
+#define TRACE_MAGIC     0x4543415254535653ULL   // "SVSTRACE", заголовок двоичной трассы
+#define TRACE_VERSION   1
+
+//
+// Бортовой самописец: последние выполненные команды.
+// Выдаётся в трассу при аварийном останове.
+//
+#define SVS_FLIGHT_SIZE 64      // число команд, степень двойки
+
+struct ElSvsFlight {
+    uint16_t PC;            // адрес команды
+    uint8_t right;          // правая команда
+    uint32_t paddr;         // физический адрес
+    uint32_t RK;            // код команды
+    uint32_t Aex;           // исполнительный адрес предыдущей команды
+    uint64_t ACC;           // сумматор до выполнения
+};
+
+struct ElSvsTraceQueue;
+struct ElSvsReplay;
+struct ElSvsShadow;
+
+//
+// Процедуры доступа к памяти для одного сочетания режимов УУ:
+// приписка, защита, супервизор, ЗПСЧ.
+//
+struct svs_mmu_access {
+    uint64_t (*load)(struct ElSvsProcessor *cpu, int addr);
+    uint64_t (*load64)(struct ElSvsProcessor *cpu, int addr, int tag_check);
+    void (*store)(struct ElSvsProcessor *cpu, int addr, uint64_t word);
+    void (*store64)(struct ElSvsProcessor *cpu, int addr, uint64_t word);
+    uint64_t (*fetch)(struct ElSvsProcessor *cpu, int addr, int *paddrp);
+};
+
+//
+// Состояние одного процессора.
+//
+struct ElSvsProcessor {
+    //
+    // Состояние, к которому обращается каждая команда, собрано
+    // в начале и выровнено на строку кэша: процессоры в соседних
+    // потоках не делят строк, а выполнение задевает их немного.
+    //
+    _Alignas(SVS_CACHE_LINE)
+    const struct svs_mmu_access *mmu; // доступ к памяти в текущих режимах
+    struct ElSvsAot *aot;       // оттранслированный код, или NULL
+    uint64_t icount;            // счётчик начатых команд
+    uint64_t point_at;          // ближайшая точка: снимок, событие, останов
+    uint64_t dirty;             // изменённые регистры, DIRTY_xxx
     uint32_t RK, Aex;           // регистр команд, исполнительный адрес
-    uint32_t UTLB[32];          // регистры приписки постранично, пользователя
-    uint32_t STLB[32];          // регистры приписки постранично, супервизора
-    jmp_buf exception;          // прерывание
     int corr_stack;             // коррекция стека при прерывании
+    unsigned flight_count;      // число записанных команд
+    ElSvsPairStats *pairs;      // счётчики пар команд, или NULL
+    unsigned pair_pc;           // слово, левая команда которого выполнена, или ~0
+    uint32_t brk_pages[ELSVS_BREAK_KINDS]; // страницы с точками останова
+    bool brk_skip;              // пропустить останов на текущей команде
+    bool fuse;                  // пары команд слова выполняются вместе
+    bool shadow_log;            // запись в память заносится в журнал проверки
+    bool refetch;               // запись в память или смена приписки и режимов:
+                                // слово команды выбирается снова
 
     // Режимы трассировки.
     bool trace_instructions;    // трассировка выполняемых машинных команд
@@ -115,7 +211,49 @@ struct ElSvsProcessor {
     bool trace_memory;          // трассировка чтения и записи памяти
     bool trace_exceptions;      // трассировка исключительных ситуаций
     bool trace_registers;       // трассировка регистров
+    bool trace_filter_on;       // включён фильтр трассировки
+    bool trace_trigger_on;      // включён запуск трассировки по событию
+    bool trace_armed;           // трассировка ждёт события
+
+    // Текущее состояние.
+    struct ElSvsCoreState core;
+
+    uint32_t UTLB[32];          // регистры приписки постранично, пользователя
+    uint32_t STLB[32];          // регистры приписки постранично, супервизора
+
+    ElSvsStats stats;           // счётчики производительности
+    struct ElSvsFlight flight[SVS_FLIGHT_SIZE]; // бортовой самописец
+
+    //
+    // Редко используемое состояние: отладка, трассировка, настройка.
+    //
+    _Alignas(SVS_CACHE_LINE)
+    struct ElSvsCoreState prev; // предыдущее состояние, для трассировки
+
+    int index;                  // номер процессора 0...3
+    uint64_t pult[8];           // тумблерные регистры
+    jmp_buf exception;          // прерывание
+
+    unsigned trace_flags;       // заданные режимы трассировки, TRACE_FLAG_xxx
+    ElSvsTraceFilter trace_filter; // фильтр трассировки
+    ElSvsTraceTrigger trace_trigger; // события запуска трассировки
+    uint64_t trace_countdown;   // команд до запуска
+    uint64_t trace_remaining;   // команд до остановки
     FILE *log_output;           // файл для вывода трассировки, или stdout
+    struct ElSvsTraceRecord *trace_buf; // буфер двоичной трассы
+    unsigned trace_count;       // число записей в буфере
+    struct ElSvsTraceQueue *trace_queue; // очередь фонового вывода трассы
+
+    // Точки останова: битовая карта адресов для каждого вида.
+    uint64_t brk_map[ELSVS_BREAK_KINDS][32768 / 64];
+
+    // Запись и воспроизведение.
+    uint64_t stop_at;           // останов по счётчику команд
+    int iintr;                  // останов по счётчику сразу после прерывания
+    struct ElSvsReplay *replay; // журнал записи, или NULL
+    struct ElSvsShadow *shadow; // теневое выполнение, или NULL
+
+    ElSvsExtracode extracode[64]; // экстракоды, выполняемые на стороне хоста
 
 #if 0
     int mpd_data;           // данные для передачи в МПД
@@ -270,30 +408,266 @@ struct ElSvsProcessor {
 #define CYRILLIC_SMALL_LETTER_YA                0x044f
 
 //
-// Процедуры работы с памятью
+// Процедуры работы с памятью.
+// Обращения идут через вариант доступа для текущих режимов УУ,
+// выбранный mmu_select().
 //
-void mmu_store(struct ElSvsProcessor *cpu, int addr, uint64_t word);
-void mmu_store64(struct ElSvsProcessor *cpu, int addr, uint64_t word);
-uint64_t mmu_load(struct ElSvsProcessor *cpu, int addr);
-uint64_t mmu_load64(struct ElSvsProcessor *cpu, int addr, int tag_check);
-uint64_t mmu_fetch(struct ElSvsProcessor *cpu, int addr, int *paddrp);
+static inline void mmu_store(struct ElSvsProcessor *cpu, int addr, uint64_t word)
+{
+    cpu->mmu->store(cpu, addr, word);
+}
+
+static inline void mmu_store64(struct ElSvsProcessor *cpu, int addr, uint64_t word)
+{
+    cpu->mmu->store64(cpu, addr, word);
+}
+
+static inline uint64_t mmu_load(struct ElSvsProcessor *cpu, int addr)
+{
+    return cpu->mmu->load(cpu, addr);
+}
+
+static inline uint64_t mmu_load64(struct ElSvsProcessor *cpu, int addr, int tag_check)
+{
+    return cpu->mmu->load64(cpu, addr, tag_check);
+}
+
+static inline uint64_t mmu_fetch(struct ElSvsProcessor *cpu, int addr, int *paddrp)
+{
+    return cpu->mmu->fetch(cpu, addr, paddrp);
+}
+
+void mmu_select(struct ElSvsProcessor *cpu);
 void mmu_set_rp(struct ElSvsProcessor *cpu, int idx, uint64_t word, int supervisor);
 void mmu_setup(struct ElSvsProcessor *cpu);
 void mmu_set_protection(struct ElSvsProcessor *cpu, int idx, uint64_t word);
 
+//
+// Индекс кода операции в таблице пар команд ElSvsPairStats:
+// короткие коды 000-077 как есть, длинные 0200-0370 в 0100-0117.
+//
+#define SVS_PAIR_INDEX(op)  (((op) & 0200) ? 0100 | (((op) >> 3) & 017) : (op))
+
 //
 // Отладочная выдача.
 //
 void svs_fprint_cmd(FILE *of, uint32_t cmd);
 void svs_fprint_insn(FILE *of, uint32_t insn);
+void svs_fprint_pairs(FILE *of, const ElSvsPairStats *stats, unsigned count, double scale);
 void svs_trace_opcode(struct ElSvsProcessor *cpu, int paddr);
 void svs_trace_registers(struct ElSvsProcessor *cpu);
+void svs_trace_memory(struct ElSvsProcessor *cpu, int type, int vaddr, int paddr,
+    int tag, uint64_t value);
+void svs_trace_text(struct ElSvsProcessor *cpu, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void svs_trace_emit(struct ElSvsProcessor *cpu, const struct ElSvsTraceRecord *rec);
+void svs_trace_print(FILE *of, const struct ElSvsTraceRecord *rec, const char *text);
+void svs_trace_binary(struct ElSvsProcessor *cpu, bool on);
+void svs_trace_flush(struct ElSvsProcessor *cpu);
+bool svs_trace_decode(FILE *input, FILE *output);
+bool svs_trace_match(struct ElSvsProcessor *cpu, int paddr, int opcode);
+void svs_trace_enable(struct ElSvsProcessor *cpu, bool on);
+void svs_trace_select(struct ElSvsProcessor *cpu);
+void svs_trace_fire(struct ElSvsProcessor *cpu);
+void svs_trace_flight(struct ElSvsProcessor *cpu);
+void svs_trace_push(struct ElSvsProcessor *cpu, const struct ElSvsTraceRecord *rec, unsigned n);
+void svs_trace_async_start(struct ElSvsProcessor *cpu, const char *filename, bool binary, bool drop);
+void svs_trace_async_stop(struct ElSvsProcessor *cpu);
+void svs_trace_async_forked(void);
 void svs_fprint_48bits(FILE *of, uint64_t value);
 
+//
+// Точки останова.
+// Проверка идёт только на страницах, где они есть.
+//
+bool svs_brk_match(struct ElSvsProcessor *cpu, ElSvsBreakKind kind, unsigned addr);
+
+#define BRK_TEST(cpu, kind, addr) \
+    (((cpu)->brk_pages[kind] >> ((addr) >> 10) & 1) && svs_brk_match(cpu, kind, addr))
+
+//
+// Загрузка и выгрузка памяти.
+//
+bool svs_load(struct ElSvsProcessor *cpu, FILE *input);
+void svs_dump(struct ElSvsProcessor *cpu, FILE *of, const char *fnam);
+bool svs_load_image(struct ElSvsProcessor *cpu, const char *filename);
+bool svs_dump_image(struct ElSvsProcessor *cpu, const char *filename);
+
+#define SVS_IMAGE_MAGIC "SVSIMAGE"      // начало двоичного образа памяти
+#define SVS_MEMORY_MAGIC "SVSMMORY"     // начало снимка памяти
+
+//
+// Заголовок двоичного образа и снимка памяти.  За ним (в образе -
+// после адреса пуска и тумблерных регистров) следуют участки
+// ненулевых слов: адрес и число слов, затем слова и теги, дополненные
+// до 8 байтов.  Последний участок имеет нулевую длину.
+//
+struct svs_memory_header {
+    char magic[8];                      // SVS_IMAGE_MAGIC или SVS_MEMORY_MAGIC
+    uint32_t version;
+    uint32_t size;                      // размер памяти, слов
+};
+
+bool svs_memory_write_runs(FILE *output, unsigned first);
+bool svs_memory_read_runs(FILE *input, unsigned first, bool clear);
+bool svs_memory_load_runs(const void *data, size_t size, unsigned first);
+
+//
+// Сохранение и восстановление состояния, запись и воспроизведение.
+//
+bool svs_state_write(struct ElSvsProcessor *cpu, FILE *output);
+bool svs_state_read(struct ElSvsProcessor *cpu, FILE *input, bool trace);
+bool svs_memory_write(FILE *output);
+bool svs_memory_read(FILE *input);
+bool svs_replay_point(struct ElSvsProcessor *cpu);
+bool svs_replay_input(struct ElSvsProcessor *cpu, unsigned kind, unsigned index, uint64_t value);
+void svs_replay_schedule(struct ElSvsProcessor *cpu);
+void cpu_req(struct ElSvsProcessor *cpu);
+void cpu_activate_timer(struct ElSvsProcessor *cpu);
+
+//
+// Механизм выполнения команд.  Все механизмы должны давать
+// одинаковое состояние процессора и памяти; svsfuzz сравнивает
+// их с эталонным на случайных программах.
+//
+struct ElSvsEngine {
+    const char *name;
+    const char *description;
+    ElSvsStatus (*run)(struct ElSvsProcessor *cpu, uint64_t n); // выполнить n команд
+};
+
+extern const struct ElSvsEngine svs_engines[];
+const struct ElSvsEngine *svs_engine_find(const char *name);
+bool svs_engine_compare(const struct ElSvsProcessor *a, const struct ElSvsProcessor *b,
+                        char *what, size_t size);
+void svs_shadow_write(struct ElSvsProcessor *cpu, unsigned paddr, uint8_t tag, uint64_t word);
+
+//
+// Код, оттранслированный заранее программой svsaot из образа памяти.
+// Разделяемый объект собирается с этим же файлом и экспортирует
+// svs_aot_image.  Блок команд начинается с левой команды слова
+// и выполняется так же, как цикл simulate(), вызывая интерпретатор
+// по таблице кодов операций.  Каждое слово при выборке
+// сравнивается с оттранслированным: изменённое слово выполняется
+// интерпретатором, и блок завершается.
+//
+#define SVS_AOT_VERSION 4
+
+struct svs_aot_runtime {
+    void (*insn[0400])(struct ElSvsProcessor *cpu, uint64_t word, int paddr);
+    void (*execute)(struct ElSvsProcessor *cpu, uint64_t word, int paddr);
+    uint64_t (*fetch)(struct ElSvsProcessor *cpu, int addr, int *paddrp);
+};
+
+typedef void svs_aot_block_t(struct ElSvsProcessor *cpu, const struct svs_aot_runtime *rt);
+
+struct svs_aot_block {
+    unsigned addr;              // адрес слова начала блока
+    svs_aot_block_t *run;
+};
+
+struct svs_aot_image {
+    unsigned version;           // SVS_AOT_VERSION
+    unsigned cpu_size;          // sizeof(struct ElSvsProcessor)
+    unsigned nblocks;           // число блоков
+    const struct svs_aot_block *blocks;
+};
+
+struct ElSvsAot {
+    void *handle;               // загруженный объект
+    unsigned refs;              // число процессоров с этим кодом
+    svs_aot_block_t *block[32768]; // блоки по адресу слова
+};
+
+extern const struct svs_aot_runtime svs_aot_runtime;
+unsigned svs_aot_translate(FILE *out, const char *name, const unsigned *entry,
+                           unsigned nentries, bool all);
+bool svs_aot_compile(const char *source, const char *object);
+bool svs_aot_build(struct ElSvsProcessor *cpu, const char *name, const unsigned *entry,
+                   unsigned nentries, bool all);
+
+//
+// Части блока.  Слово начинается, как в цикле simulate(), с проверки
+// точки останова по счётчику и прерываний, правая команда - с проверки
+// точки.  Если левая команда не писала в память и не меняла приписку
+// и режимы (признак refetch), правая выполняется из того же слова,
+// иначе слово выбирается снова.
+// Переход в начало блока продолжает блок.  На следующем блоке блок
+// завершается, и следующий блок вызывает цикл simulate(), так что
+// цепочка блоков не растит стек и без хвостовых вызовов.
+//
+#define SVS_AOT_BEGIN \
+    uint64_t aot_word; \
+    int aot_paddr
+
+#define SVS_AOT_STOP() \
+    (cpu->icount >= cpu->point_at || \
+     (! (cpu->core.M[PSW] & PSW_INTR_DISABLE) && \
+      (cpu->core.RPR || (cpu->core.GRVP & cpu->core.GRM))))
+
+#define SVS_AOT_FETCH(pc, value) \
+    cpu->corr_stack = 0; \
+    aot_word = rt->fetch(cpu, pc, &aot_paddr); \
+    cpu->refetch = false; \
+    if (aot_word != (value)) { \
+        rt->execute(cpu, aot_word, aot_paddr); \
+        return; \
+    }
+
+#define SVS_AOT_FIRST(pc, value) do { \
+        SVS_AOT_FETCH(pc, value) \
+    } while (0)
+
+#define SVS_AOT_WORD(pc, value) do { \
+        cpu->brk_skip = false; \
+        if (SVS_AOT_STOP()) \
+            return; \
+        cpu->icount++; \
+        SVS_AOT_FETCH(pc, value) \
+    } while (0)
+
+#define SVS_AOT_LEFT(op) \
+    rt->insn[op](cpu, aot_word, aot_paddr)
+
+#define SVS_AOT_RIGHT(pc, value, op) do { \
+        cpu->brk_skip = false; \
+        if (cpu->icount >= cpu->point_at) \
+            return; \
+        cpu->icount++; \
+        if (! cpu->refetch) { \
+            cpu->corr_stack = 0; \
+            cpu->stats.fetches++; \
+        } else { \
+            SVS_AOT_FETCH(pc, value) \
+        } \
+        rt->insn[op](cpu, aot_word, aot_paddr); \
+    } while (0)
+
+#define SVS_AOT_AGAIN(pc) do { \
+        if (cpu->core.PC != (pc) || (cpu->core.RUU & RUU_RIGHT_INSTR)) \
+            return; \
+        cpu->brk_skip = false; \
+        if (SVS_AOT_STOP()) \
+            return; \
+        cpu->icount++; \
+        goto again; \
+    } while (0)
+
+#define SVS_AOT_NEXT(pc) \
+    return
+
+//
+// Виды внешних событий в журнале записи.
+//
+#define REPLAY_TIMER    0       // прерывание от таймера
+#define REPLAY_REQUEST  1       // запрос с пульта
+#define REPLAY_PULT     2       // запись в тумблерный регистр
+
 //
 // Арифметика.
 //
 double svs_to_ieee(uint64_t word);
+uint64_t ieee_to_svs(double d);
 void svs_add(struct ElSvsProcessor *cpu, uint64_t val, int negate_acc, int negate_val);
 void svs_divide(struct ElSvsProcessor *cpu, uint64_t val);
 void svs_multiply(struct ElSvsProcessor *cpu, uint64_t val);
@@ -0,0 +1,267 @@
+/*
+ * In-process fuzzing of the SVS processor simulator.
+ *
+ * Each input sets up odd processor state (PSW, mode, page tables)
+ * and memory words with arbitrary tags, then runs a limited number
+ * of instructions.  Between inputs the processor and the pages
+ * of RAM written by the previous input are reset from a pristine
+ * snapshot, so an iteration costs about as much as the instructions
+ * it runs.
+ *
+ * Input layout, missing bytes are zero:
+ *   0-1    bits to flip in PSW (М27)
+ *   2-3    bits to flip in RUU
+ *   4      RAU
+ *   5-7    reserved
+ *   8-71   RP0-RP7, page tables of user
+ *   72-    memory words from address 010: tag and 6 bytes of word
+ *
+ * With libFuzzer, build with -DLIBFUZZER and -fsanitize=fuzzer:
+ *   clang -std=c11 -g -O1 -fsanitize=fuzzer,address -DLIBFUZZER \
+ *       fuzz_target.c svs_*.c el_master_ram.c -lm -pthread -ldl -o fuzz_target
+ * Otherwise the built-in driver runs random inputs, or input files
+ * given on the command line, and reports iterations per second.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "el_master_api.h"
+#include "el_master_ram.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+#define HEADER_SIZE     72              // bytes before memory words
+#define WORD_SIZE       7               // tag and 48-bit word
+#define CODE_BASE       010             // address of the first word
+#define MAX_WORDS       (01000 - CODE_BASE)
+#define MAX_INSTR       10000           // instructions per input
+
+static struct ElMasterRam *ram;         // overlay over pristine memory
+static struct ElSvsProcessor *cpu;      // processor under test
+static struct ElSvsProcessor *pristine; // state after reset
+static FILE *devnull;                   // output of stopped processor
+
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return elMasterRamRead(ram, address, pTag, pWord);
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return elMasterRamWrite(ram, address, tag, word);
+}
+
+//
+// Pristine memory: entries of interrupts and extracodes stop
+// the processor, so that a run does not wander in zero memory.
+//
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    struct ElMasterRam *image = elMasterRamAllocate();
+    uint64_t stop = ElSvsAsm("стоп 12345(6), мода") << 16;
+    unsigned addr;
+
+    if (! image) {
+        perror("fuzz_target");
+        exit(1);
+    }
+    for (addr = 0500; addr < 0600; addr++)
+        elMasterRamWrite(image, addr, 035, stop);
+
+    struct ElMasterRamBase *base = elMasterRamBaseCreate(image);
+    if (! base) {
+        perror("fuzz_target");
+        exit(1);
+    }
+    ram = elMasterRamAllocateOverlay(base);
+    if (! ram) {
+        perror("fuzz_target");
+        exit(1);
+    }
+    elMasterRamFree(image);
+
+    devnull = fopen("/dev/null", "w");
+    if (! devnull) {
+        perror("/dev/null");
+        exit(1);
+    }
+    cpu = ElSvsAllocate(0);
+    cpu->log_output = devnull;
+    pristine = ElSvsAllocate(0);
+    ElSvsSetPC(pristine, CODE_BASE);
+    return 0;
+}
+
+//
+// Field of input, little-endian; missing bytes are zero.
+//
+static uint64_t input_field(const uint8_t *data, size_t size, size_t offset, unsigned nbytes)
+{
+    uint64_t value = 0;
+    unsigned i;
+
+    for (i = 0; i < nbytes && offset + i < size; i++)
+        value |= (uint64_t) data[offset + i] << (8 * i);
+    return value;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    unsigned i;
+
+    // Сброс процессора и записанных страниц памяти.
+    ElSvsCopyState(cpu, pristine);
+    elMasterRamClear(ram);
+
+    cpu->core.M[PSW] ^= input_field(data, size, 0, 2) & BITS(15);
+    cpu->core.RUU ^= input_field(data, size, 2, 2) & 0777;
+    cpu->core.RAU = input_field(data, size, 4, 1) & 077;
+    for (i = 0; i < 8; i++)
+        cpu->core.RP[i] = input_field(data, size, 8 + 8 * i, 8);
+
+    size_t nwords = (size > HEADER_SIZE) ? (size - HEADER_SIZE) / WORD_SIZE : 0;
+    if (nwords > MAX_WORDS)
+        nwords = MAX_WORDS;
+    for (i = 0; i < nwords; i++) {
+        size_t offset = HEADER_SIZE + i * WORD_SIZE;
+
+        elMasterRamWrite(ram, CODE_BASE + i, data[offset],
+            input_field(data, size, offset + 1, 6) << 16);
+    }
+
+    ElSvsStep(cpu, MAX_INSTR);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+//
+// Генератор случайных чисел splitmix64.
+//
+static uint64_t rnd(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+//
+// Случайный вход: теги чаще правильные, команды чаще с исполнимым кодом.
+//
+static size_t random_input(uint64_t *r, uint8_t *data, size_t max)
+{
+    size_t size = HEADER_SIZE + WORD_SIZE * (rnd(r) % (MAX_WORDS + 1));
+    size_t i;
+
+    if (size > max)
+        size = max;
+    for (i = 0; i < size; i++)
+        data[i] = rnd(r);
+
+    // Редко меняем режимы, чтобы команды успевали выполняться.
+    if (rnd(r) & 3)
+        data[0] = data[1] = data[2] = data[3] = 0;
+    for (i = HEADER_SIZE; i + WORD_SIZE <= size; i += WORD_SIZE) {
+        uint64_t x = rnd(r);
+
+        if (x & 7)
+            data[i] = (x & 8) ? 035 : 036;
+    }
+    return size;
+}
+
+static double elapsed(const struct timespec *t0)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t0->tv_sec) + (now.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: fuzz_target [-t seconds] [-n iterations] [-s seed] [file...]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -t seconds      time limit, default 10\n");
+    fprintf(stderr, "  -n iterations   number of random inputs, default no limit\n");
+    fprintf(stderr, "  -s seed         random seed, default from time\n");
+    fprintf(stderr, "  -c              cold reset: new processor and full RAM, to compare\n");
+    fprintf(stderr, "Files are run as inputs, for reproduction of crashes.\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t data[HEADER_SIZE + WORD_SIZE * MAX_WORDS];
+    uint64_t seed = time(NULL), max_iter = 0, iter, instructions = 0;
+    double duration = 10;
+    bool cold = false;
+    struct timespec t0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:s:c")) != -1) {
+        switch (opt) {
+        case 't': duration = atof(optarg); break;
+        case 'n': max_iter = strtoull(optarg, NULL, 0); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        case 'c': cold = true; break;
+        default:  usage();
+        }
+    }
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    if (optind < argc) {
+        // Входы из файлов.
+        for (; optind < argc; optind++) {
+            FILE *input = fopen(argv[optind], "r");
+            if (! input) {
+                perror(argv[optind]);
+                return 1;
+            }
+            size_t size = fread(data, 1, sizeof(data), input);
+            fclose(input);
+            LLVMFuzzerTestOneInput(data, size);
+            printf("%s: %llu instructions\n", argv[optind],
+                (unsigned long long) ElSvsGetInstructionCount(cpu));
+        }
+        return 0;
+    }
+
+    printf("Seed %llu%s\n", (unsigned long long) seed, cold ? ", cold reset" : "");
+    fflush(stdout);
+    uint64_t r = seed;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (iter = 0; max_iter == 0 || iter < max_iter; iter++) {
+        if ((iter & 255) == 0 && elapsed(&t0) >= duration)
+            break;
+        size_t size = random_input(&r, data, sizeof(data));
+        if (cold) {
+            // Как без быстрого сброса: новый процессор и вся память.
+            unsigned addr;
+
+            free(cpu);
+            cpu = ElSvsAllocate(0);
+            cpu->log_output = devnull;
+            for (addr = 0; addr < SVS_MEMSIZE; addr++)
+                elMasterRamWordWrite(addr, 0, 0);
+        }
+        LLVMFuzzerTestOneInput(data, size);
+        instructions += ElSvsGetInstructionCount(cpu);
+    }
+    double t = elapsed(&t0);
+
+    printf("%llu iterations in %.3f sec: %.0f iterations/sec, %.2f usec each, %.1f instructions average\n",
+        (unsigned long long) iter, t, iter / t, t * 1e6 / (iter ? iter : 1),
+        iter ? (double) instructions / iter : 0.0);
+    return 0;
+}
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Check the SVS processor in lockstep against a reference trace.
+ *
+ * The program is loaded from a memory image (.oct or binary), and the
+ * trace, in the format of the simulator's own trace, is read
+ * as a stream, so traces of any size are checked in constant memory.
+ * Use "-" to read the trace from stdin, for example from zcat.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "el_master_api.h"
+#include "el_master_ram.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+//
+// Physical memory: only pages in use are allocated.
+//
+static struct ElMasterRam *ram;
+
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return elMasterRamRead(ram, address, pTag, pWord);
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return elMasterRamWrite(ram, address, tag, word);
+}
+
+int main(int argc, char *argv[])
+{
+    char magic[8];
+    ElSvsLockstepResult result;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: lockstep program.oct program.trace\n");
+        fprintf(stderr, "       lockstep program.img -\n");
+        return 1;
+    }
+    FILE *input = fopen(argv[1], "r");
+    if (! input) {
+        perror(argv[1]);
+        return 1;
+    }
+    bool binary = fread(magic, sizeof(magic), 1, input) == 1 &&
+                  memcmp(magic, SVS_IMAGE_MAGIC, sizeof(magic)) == 0;
+    rewind(input);
+
+    ram = elMasterRamAllocate();
+    if (! ram) {
+        perror("lockstep");
+        return 1;
+    }
+    struct ElSvsProcessor *cpu = ElSvsAllocate(0);
+    if (binary) {
+        fclose(input);
+        if (! svs_load_image(cpu, argv[1]))
+            return 1;
+    } else {
+        if (! svs_load(cpu, input)) {
+            fprintf(stderr, "%s: Bad input\n", argv[1]);
+            return 1;
+        }
+        fclose(input);
+    }
+
+    FILE *trace = stdin;
+    if (strcmp(argv[2], "-") != 0) {
+        trace = fopen(argv[2], "r");
+        if (! trace) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+    if (! ElSvsLockstep(cpu, trace, &result)) {
+        printf("%s:%llu: Divergence after %llu instructions: %s\n",
+            argv[2], (unsigned long long) result.line,
+            (unsigned long long) result.instructions, result.message);
+        return 1;
+    }
+    printf("%s: %llu instructions match\n",
+        argv[2], (unsigned long long) result.instructions);
+    return 0;
+}
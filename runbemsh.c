@@ -0,0 +1,423 @@
+/*
+ * Run the bemsh conformance corpus on the SVS processor.
+ *
+ * Every .oct file under the given directories is loaded into a separate
+ * simulator instance and run until it stops.  A program passes when it
+ * stops on "стоп 12345(6)", and fails on "стоп 76543(2)".
+ * Directories of scenarios that are not standalone programs are skipped.
+ * Programs run in child processes, as many at once as there are cores.
+ * With -a every program is first translated by svs_aot_build()
+ * in a private temporary directory and run from the translated code.
+ * With -p the pairs of instructions executed in one word are summed
+ * over all programs and the most frequent are printed.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "el_master_api.h"
+#include "el_master_ram.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+//
+// Physical memory of the instance, allocated in the child process.
+//
+static struct ElMasterRam *ram;
+
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return elMasterRamRead(ram, address, pTag, pWord);
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return elMasterRamWrite(ram, address, tag, word);
+}
+
+//
+// Outcome of a program.
+//
+enum {
+    RESULT_PASS,                        // стоп 12345(6)
+    RESULT_FAIL,                        // стоп 76543(2)
+    RESULT_STOP,                        // other stop
+    RESULT_LIMIT,                       // instruction limit reached
+    RESULT_ERROR,                       // cannot load or run
+};
+
+static const char *result_name[] = { "PASS", "FAIL", "STOP", "LIMIT", "ERROR" };
+
+struct result {
+    int outcome;                        // RESULT_xxx
+    int status;                         // ElSvsStatus of the stop
+    unsigned pc;                        // PC at the stop
+    uint64_t instructions;              // executed instructions
+};
+
+struct job {
+    char *path;                         // .oct file
+    pid_t pid;                          // child process, or 0
+    int fd;                             // pipe for the result
+    char *reply;                        // data read from the pipe
+    size_t got;                         // bytes read
+    struct result result;
+};
+
+static struct job *job;
+static unsigned njobs, max_jobs;
+static uint64_t limit = 10000000;
+static bool verbose;
+static bool translate;
+static bool show_pairs;
+static ElSvsPairStats pairs;            // pairs of the child, or sum in parent
+
+//
+// Scenarios that need a monitor and run only under bench_startjob.
+//
+static const char *const not_standalone[] = {
+    "startjob",
+    NULL
+};
+
+static bool is_standalone(const char *name)
+{
+    const char *const *p;
+
+    for (p = not_standalone; *p; p++)
+        if (strcmp(name, *p) == 0)
+            return false;
+    return true;
+}
+
+//
+// Find .oct files in the directory tree.
+//
+static void scan(const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    struct dirent *e;
+
+    if (! dir) {
+        perror(dirname);
+        exit(1);
+    }
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] == '.')
+            continue;
+
+        size_t len = strlen(dirname) + strlen(e->d_name) + 2;
+        char *path = malloc(len);
+        if (! path) {
+            perror("runbemsh");
+            exit(1);
+        }
+        snprintf(path, len, "%s/%s", dirname, e->d_name);
+
+        // Некоторые файловые системы не сообщают тип файла.
+        bool is_dir = (e->d_type == DT_DIR);
+        if (e->d_type == DT_UNKNOWN) {
+            struct stat st;
+
+            is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir && ! is_standalone(e->d_name)) {
+            free(path);
+            continue;
+        }
+        if (is_dir) {
+            scan(path);
+            free(path);
+            continue;
+        }
+        size_t n = strlen(e->d_name);
+        if (n < 5 || strcmp(e->d_name + n - 4, ".oct") != 0) {
+            free(path);
+            continue;
+        }
+        if (njobs == max_jobs) {
+            max_jobs = max_jobs ? max_jobs * 2 : 64;
+            job = realloc(job, max_jobs * sizeof(job[0]));
+            if (! job) {
+                perror("runbemsh");
+                exit(1);
+            }
+        }
+        memset(&job[njobs], 0, sizeof(job[0]));
+        job[njobs++].path = path;
+    }
+    closedir(dir);
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    return strcmp(((const struct job*) a)->path, ((const struct job*) b)->path);
+}
+
+//
+// Run one program, in the child process.
+//
+static struct result run_program(const char *path)
+{
+    struct result r = { RESULT_ERROR, 0, 0, 0 };
+    uint32_t pass = ElSvsAsm("стоп 12345(6), мода") >> 24;
+    uint32_t fail = ElSvsAsm("стоп 76543(2), мода") >> 24;
+
+    ram = elMasterRamAllocate();
+    FILE *input = fopen(path, "r");
+    if (! ram || ! input)
+        return r;
+
+    struct ElSvsProcessor *cpu = ElSvsAllocate(0);
+    if (! svs_load(cpu, input))
+        return r;
+    fclose(input);
+
+    if (translate) {
+        // Трансляция всех слов команд.
+        unsigned entry = cpu->core.PC;
+
+        if (! svs_aot_build(cpu, path, &entry, 1, true))
+            return r;
+    }
+
+    if (show_pairs) {
+        // Таблица потомка - копия суммы родителя.
+        memset(&pairs, 0, sizeof(pairs));
+        ElSvsSetPairStats(cpu, &pairs);
+    }
+    r.status = ElSvsStep(cpu, limit);
+    r.pc = ElSvsGetPC(cpu);
+    r.instructions = ElSvsGetInstructionCount(cpu);
+    if (r.status == ESS_OK)
+        r.outcome = RESULT_LIMIT;
+    else if (r.status == ESS_HALT && cpu->RK == pass)
+        r.outcome = RESULT_PASS;
+    else if (r.status == ESS_HALT && cpu->RK == fail)
+        r.outcome = RESULT_FAIL;
+    else
+        r.outcome = RESULT_STOP;
+    return r;
+}
+
+//
+// Size of data sent by a child: the result, then the table of pairs.
+//
+static size_t reply_size()
+{
+    return sizeof(struct result) + (show_pairs ? sizeof(pairs) : 0);
+}
+
+//
+// Start a child process for the job.
+//
+static void start_job(struct job *j)
+{
+    int fd[2];
+
+    if (pipe(fd) < 0) {
+        perror("runbemsh");
+        exit(1);
+    }
+    fflush(stdout);
+    j->pid = fork();
+    if (j->pid < 0) {
+        perror("runbemsh");
+        exit(1);
+    }
+    if (j->pid == 0) {
+        // Child: run the program and send the result.
+        close(fd[0]);
+        if (! verbose && ! freopen("/dev/null", "w", stdout))
+            _exit(1);
+        struct result r = run_program(j->path);
+        if (write(fd[1], &r, sizeof(r)) != sizeof(r))
+            _exit(1);
+
+        if (show_pairs &&
+            write(fd[1], &pairs, sizeof(pairs)) != sizeof(pairs))
+            _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    j->fd = fd[0];
+    j->got = 0;
+    j->reply = malloc(reply_size());
+    if (! j->reply) {
+        perror("runbemsh");
+        exit(1);
+    }
+}
+
+//
+// Read from running children until one of them closes its pipe,
+// then reap that child.  The pipes are read before wait(), so a child
+// never blocks on a full pipe, whatever the size of the pipe buffer.
+//
+static void finish_job()
+{
+    static struct pollfd *fds;
+    static unsigned *index;
+    unsigned i, n = 0;
+
+    if (! fds) {
+        fds = malloc(njobs * sizeof(fds[0]));
+        index = malloc(njobs * sizeof(index[0]));
+        if (! fds || ! index) {
+            perror("runbemsh");
+            exit(1);
+        }
+    }
+    for (i = 0; i < njobs; i++) {
+        if (job[i].pid == 0)
+            continue;
+        fds[n].fd = job[i].fd;
+        fds[n].events = POLLIN;
+        index[n++] = i;
+    }
+    for (;;) {
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("runbemsh");
+            exit(1);
+        }
+        for (i = 0; i < n; i++) {
+            struct job *j = &job[index[i]];
+            char scratch[256];
+            ssize_t len;
+
+            if (! fds[i].revents)
+                continue;
+
+            // Лишние данные читаются в пустоту.
+            if (j->got < reply_size())
+                len = read(j->fd, j->reply + j->got, reply_size() - j->got);
+            else
+                len = read(j->fd, scratch, sizeof(scratch));
+            if (len > 0) {
+                if (j->got < reply_size())
+                    j->got += len;
+                continue;
+            }
+            if (len < 0 && errno == EINTR)
+                continue;
+
+            // Конец данных: процесс завершается.
+            int status;
+            close(j->fd);
+            if (waitpid(j->pid, &status, 0) < 0) {
+                perror("runbemsh");
+                exit(1);
+            }
+            j->pid = 0;
+            if (j->got != reply_size()) {
+                // Crashed or killed.
+                j->result.outcome = RESULT_ERROR;
+                j->result.status = status;
+            } else {
+                memcpy(&j->result, j->reply, sizeof(j->result));
+                if (show_pairs) {
+                    const uint64_t *child = (const uint64_t*) (j->reply + sizeof(j->result));
+                    uint64_t *sum = &pairs.pairs[0][0];
+                    unsigned k;
+
+                    for (k = 0; k < 0120 * 0120; k++)
+                        sum[k] += child[k];
+                }
+            }
+            free(j->reply);
+            j->reply = NULL;
+            return;
+        }
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: runbemsh [-j jobs] [-l limit] [-a] [-p] [-v] [directory...]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -j jobs     number of programs to run at once, default number of cores\n");
+    fprintf(stderr, "  -l limit    maximum instructions per program, default %llu\n",
+        (unsigned long long) limit);
+    fprintf(stderr, "  -a          run from code translated ahead of time\n");
+    fprintf(stderr, "  -p          show most frequent pairs of instructions in a word\n");
+    fprintf(stderr, "  -v          show output of programs\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned parallel = (ncores > 0) ? ncores : 1;
+    unsigned i, next, running, count[RESULT_ERROR + 1] = { 0 };
+    struct timespec t0, t1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:l:apv")) != -1) {
+        switch (opt) {
+        case 'j': parallel = atoi(optarg); break;
+        case 'l': limit = strtoull(optarg, NULL, 0); break;
+        case 'a': translate = true; break;
+        case 'p': show_pairs = true; break;
+        case 'v': verbose = true; break;
+        default:  usage();
+        }
+    }
+    if (parallel == 0 || limit == 0)
+        usage();
+    if (optind == argc)
+        scan("bemsh");
+    for (; optind < argc; optind++)
+        scan(argv[optind]);
+    if (njobs == 0) {
+        fprintf(stderr, "No .oct files found\n");
+        return 1;
+    }
+    qsort(job, njobs, sizeof(job[0]), compare_jobs);
+
+    // Keep all cores busy.
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (next = 0, running = 0; next < njobs || running > 0; ) {
+        if (next < njobs && running < parallel) {
+            start_job(&job[next++]);
+            running++;
+            continue;
+        }
+        finish_job();
+        running--;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // Report in order of file names.
+    for (i = 0; i < njobs; i++) {
+        struct result *r = &job[i].result;
+
+        printf("%-5s %s", result_name[r->outcome], job[i].path);
+        if (r->outcome != RESULT_PASS && r->outcome != RESULT_ERROR)
+            printf(": status %d, PC %05o", r->status, r->pc);
+        printf(", %llu instructions\n", (unsigned long long) r->instructions);
+        count[r->outcome]++;
+    }
+    printf("%u programs: %u passed, %u failed, %u stopped, %u over limit, %u errors, %.3f sec\n",
+        njobs, count[RESULT_PASS], count[RESULT_FAIL], count[RESULT_STOP],
+        count[RESULT_LIMIT], count[RESULT_ERROR],
+        (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+    if (show_pairs) {
+        printf("Pairs of instructions in a word, over all programs:\n");
+        svs_fprint_pairs(stdout, &pairs, 20, 1);
+    }
+    return (count[RESULT_PASS] == njobs) ? 0 : 1;
+}
@@ -0,0 +1,444 @@
+/*
+ * Loading of code translated ahead of time by svsaot.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _DEFAULT_SOURCE
+#include "el_master_api.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define AOT_LEADER      1       // начало блока
+#define AOT_SCANNED     2       // слово просмотрено при поиске блоков
+#define AOT_MAX_WORDS   256     // слов в блоке, не больше
+#define AOT_MAX_ARGS    48      // слов в командной строке компилятора
+
+//
+// Заголовки симулятора вставляются в текст трансляции целиком:
+// для сборки нужен только компилятор Си.
+//
+static const char aot_headers[] =
+#include "svs_aot_headers.h"
+;
+
+bool ElSvsAotLoad(struct ElSvsProcessor *cpu, const char *filename)
+{
+    void *handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+
+    if (! handle) {
+        fprintf(stderr, "%s\n", dlerror());
+        return false;
+    }
+
+    // Объект должен быть собран для этой же версии симулятора.
+    const struct svs_aot_image *image = dlsym(handle, "svs_aot_image");
+    if (! image || image->version != SVS_AOT_VERSION ||
+        image->cpu_size != sizeof(struct ElSvsProcessor)) {
+        fprintf(stderr, "%s: Incompatible translated code\n", filename);
+        dlclose(handle);
+        return false;
+    }
+
+    struct ElSvsAot *aot = calloc(1, sizeof(*aot));
+    if (! aot) {
+        dlclose(handle);
+        return false;
+    }
+    aot->handle = handle;
+    aot->refs = 1;
+
+    unsigned i;
+    for (i = 0; i < image->nblocks; i++) {
+        if (image->blocks[i].addr <= BITS(15))
+            aot->block[image->blocks[i].addr] = image->blocks[i].run;
+    }
+
+    ElSvsAotUnload(cpu);
+    cpu->aot = aot;
+    return true;
+}
+
+void ElSvsAotUnload(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsAot *aot = cpu->aot;
+
+    if (! aot)
+        return;
+    cpu->aot = NULL;
+    if (--aot->refs > 0)
+        return;
+    dlclose(aot->handle);
+    free(aot);
+}
+
+void ElSvsAotShare(struct ElSvsProcessor *dst, const struct ElSvsProcessor *src)
+{
+    struct ElSvsAot *aot = src->aot;
+
+    if (aot == dst->aot)
+        return;
+    if (aot)
+        aot->refs++;
+    ElSvsAotUnload(dst);
+    dst->aot = aot;
+}
+
+//
+// Слово команд по адресу образа, или false для данных.
+// Адреса 0-7 - тумблерные регистры, их не транслируем.
+//
+static bool aot_code(unsigned addr, uint64_t *word)
+{
+    ElMasterTag tag;
+    ElMasterWord w;
+
+    if (addr < 010 || addr > BITS(15) ||
+        elMasterRamWordRead(addr, &tag, &w) != EMS_OK || ! IS_INSN48(tag))
+        return false;
+    *word = (w >> 16) & BITS48;
+    return true;
+}
+
+//
+// Код операции, номер регистра и адрес команды из 24 разрядов.
+//
+static int aot_decode(uint32_t insn, int *reg, int *addr)
+{
+    *reg = insn >> 20 & 017;
+    if (insn & BBIT(20)) {
+        *addr = insn & BITS(15);
+        return (insn >> 12) & 0370;
+    }
+    *addr = insn & BITS(12);
+    if (insn & BBIT(19))
+        *addr |= 070000;
+    return (insn >> 12) & 077;
+}
+
+//
+// Команды, которые могут передать управление или сменить режим:
+// экстракоды, переходы, выпр и стоп.  На них блок кончается.
+//
+static bool aot_is_jump(int opcode)
+{
+    return (opcode >= 050 && opcode <= 077) || opcode == 0200 ||
+           opcode == 0210 || opcode >= 0260;
+}
+
+//
+// Добавить начало блока в очередь.
+//
+static void aot_add(uint8_t *map, unsigned *queue, unsigned *n, int addr)
+{
+    if (addr < 010 || addr > BITS(15) || (map[addr] & AOT_LEADER))
+        return;
+    map[addr] |= AOT_LEADER;
+    queue[(*n)++] = addr;
+}
+
+//
+// Известный адрес перехода команды, или -1.
+//
+static int aot_target(int opcode, int reg, int addr, bool mod)
+{
+    switch (opcode) {
+    case 0260: case 0270: case 0300:                // по, пе, пб
+        return (reg || mod) ? -1 : addr;
+    case 0310: case 0340: case 0350:                // пв, пио, пино
+    case 0360: case 0370:                           // э36, цикл
+        return mod ? -1 : addr;
+    }
+    return -1;
+}
+
+//
+// Переход по команде: известные адреса назначения становятся
+// началами блоков, как и следующее слово, если возможно продолжение
+// или возврат (экстракод, пв).  Адрес, модифицированный регистром
+// или командой мода, неизвестен: там работает интерпретатор.
+//
+static void aot_follow(uint8_t *map, unsigned *queue, unsigned *n,
+                       unsigned word_addr, int opcode, int reg, int addr, bool mod)
+{
+    int target = aot_target(opcode, reg, addr, mod);
+
+    if (target >= 0)
+        aot_add(map, queue, n, target);
+    if (opcode != 0300 && opcode != 0320)           // кроме пб и выпр
+        aot_add(map, queue, n, word_addr + 1);
+}
+
+//
+// Переход, которым кончается блок, ведёт в его же начало?
+// Тогда цикл выполняется внутри блока.
+//
+static bool aot_loops(const uint8_t *map, unsigned addr)
+{
+    unsigned w;
+    uint64_t word;
+    bool mod = false;
+
+    for (w = addr; w <= BITS(15) && w - addr < AOT_MAX_WORDS && aot_code(w, &word); w++) {
+        int half, reg, a;
+
+        if (w != addr && (map[w] & AOT_LEADER))
+            break;
+        for (half = 0; half < 2; half++) {
+            int opcode = aot_decode((half ? word : word >> 24) & BITS(24), &reg, &a);
+
+            if (aot_is_jump(opcode))
+                return aot_target(opcode, reg, a, mod) == (int) addr;
+            mod = (opcode == 0220 || opcode == 0230);
+        }
+    }
+    return false;
+}
+
+static void aot_comment(FILE *out, uint32_t insn)
+{
+    fprintf(out, "  // ");
+    svs_fprint_cmd(out, insn);
+    fprintf(out, "\n");
+}
+
+//
+// Трансляция программы из памяти в текст на Си для svs_aot_compile().
+// Блоки находятся обходом переходов от заданных адресов,
+// а при all - начинаются с каждого слова команд.
+// Возвращает число блоков.
+//
+unsigned svs_aot_translate(FILE *out, const char *name, const unsigned *entry,
+                           unsigned nentries, bool all)
+{
+    static _Thread_local uint8_t map[32768];
+    static _Thread_local unsigned queue[32768];
+    unsigned n = 0, i, addr, w, nblocks = 0;
+    uint64_t word;
+
+    memset(map, 0, sizeof(map));
+    for (i = 0; i < nentries; i++)
+        aot_add(map, queue, &n, entry[i]);
+    if (all) {
+        for (addr = 010; addr <= BITS(15); addr++) {
+            if (aot_code(addr, &word))
+                aot_add(map, queue, &n, addr);
+        }
+    }
+
+    // Поиск начал блоков.
+    for (i = 0; i < n; i++) {
+        bool mod = false;
+
+        for (w = queue[i]; aot_code(w, &word); w++) {
+            int half, reg, a;
+
+            if (w != queue[i] && (map[w] & AOT_SCANNED))
+                break;
+            map[w] |= AOT_SCANNED;
+            for (half = 0; half < 2; half++) {
+                int opcode = aot_decode((half ? word : word >> 24) & BITS(24), &reg, &a);
+
+                if (aot_is_jump(opcode)) {
+                    aot_follow(map, queue, &n, w, opcode, reg, a, mod);
+                    break;
+                }
+                mod = (opcode == 0220 || opcode == 0230);
+            }
+            if (half == 0) {
+                // Правая команда после перехода выполняется интерпретатором,
+                // но её переходы тоже дают начала блоков.
+                int opcode = aot_decode(word & BITS(24), &reg, &a);
+
+                if (aot_is_jump(opcode))
+                    aot_follow(map, queue, &n, w, opcode, reg, a, false);
+            }
+            if (half < 2)
+                break;
+        }
+    }
+
+    fprintf(out, "/*\n * Translated by svsaot from %s.\n */\n", name);
+    fputs(aot_headers, out);
+    fprintf(out, "\n");
+    for (addr = 0; addr <= BITS(15); addr++) {
+        if ((map[addr] & AOT_LEADER) && aot_code(addr, &word))
+            fprintf(out, "static svs_aot_block_t b%05o;\n", addr);
+    }
+
+    // Блоки: до перехода, до начала другого блока или до данных.
+    for (addr = 0; addr <= BITS(15); addr++) {
+        if (! (map[addr] & AOT_LEADER) || ! aot_code(addr, &word))
+            continue;
+        fprintf(out, "\nstatic void b%05o(struct ElSvsProcessor *cpu, const struct svs_aot_runtime *rt)\n{\n", addr);
+        fprintf(out, "    SVS_AOT_BEGIN;\n\n");
+        bool loops = aot_loops(map, addr);
+        if (loops)
+            fprintf(out, "again:\n");
+        bool mod = false;
+        for (w = addr; ; ) {
+            uint32_t left = (word >> 24) & BITS(24), right = word & BITS(24);
+            int reg, a, opcode;
+
+            if (w == addr)
+                fprintf(out, "    SVS_AOT_FIRST(0%o, 0%016lloull);\n", w, (unsigned long long) word);
+            else
+                fprintf(out, "    SVS_AOT_WORD(0%o, 0%016lloull);\n", w, (unsigned long long) word);
+
+            opcode = aot_decode(left, &reg, &a);
+            fprintf(out, "    SVS_AOT_LEFT(0%o);", opcode);
+            aot_comment(out, left);
+            if (aot_is_jump(opcode)) {
+                if (loops && aot_target(opcode, reg, a, mod) == (int) addr)
+                    fprintf(out, "    SVS_AOT_AGAIN(0%o);\n", addr);
+                break;
+            }
+            mod = (opcode == 0220 || opcode == 0230);
+
+            opcode = aot_decode(right, &reg, &a);
+            fprintf(out, "    SVS_AOT_RIGHT(0%o, 0%016lloull, 0%o);", w, (unsigned long long) word, opcode);
+            aot_comment(out, right);
+            if (aot_is_jump(opcode)) {
+                if (loops && aot_target(opcode, reg, a, mod) == (int) addr)
+                    fprintf(out, "    SVS_AOT_AGAIN(0%o);\n", addr);
+                break;
+            }
+            mod = (opcode == 0220 || opcode == 0230);
+            if (w == BITS(15) || w + 1 - addr >= AOT_MAX_WORDS)
+                break;
+
+            // Следующее слово.
+            w++;
+            if (! aot_code(w, &word))
+                break;
+            if (map[w] & AOT_LEADER) {
+                fprintf(out, "    SVS_AOT_NEXT(0%o);\n", w);
+                break;
+            }
+        }
+        fprintf(out, "}\n");
+        nblocks++;
+    }
+
+    fprintf(out, "\nstatic const struct svs_aot_block blocks[] = {\n");
+    for (addr = 0; addr <= BITS(15); addr++) {
+        if ((map[addr] & AOT_LEADER) && aot_code(addr, &word))
+            fprintf(out, "    { 0%05o, b%05o },\n", addr, addr);
+    }
+    fprintf(out, "    { 0, NULL },\n};\n\n");
+    fprintf(out, "const struct svs_aot_image svs_aot_image = {\n");
+    fprintf(out, "    SVS_AOT_VERSION, sizeof(struct ElSvsProcessor), %u, blocks,\n};\n", nblocks);
+    return nblocks;
+}
+
+//
+// Сборка разделяемого объекта из текста на Си: компилятор из
+// переменной CC или cc.  Текст не зависит от других файлов.
+// Компилятор запускается через execvp(), без оболочки: CC делится
+// на слова по пробелам, ключи из CC идут после ключей по умолчанию.
+//
+bool svs_aot_compile(const char *source, const char *object)
+{
+    const char *cc = getenv("CC");
+    char *argv[AOT_MAX_ARGS], *save = NULL, *word;
+    int argc = 0, status;
+
+    char *words = strdup((cc && *cc) ? cc : "cc");
+    if (! words) {
+        perror("svs_aot_compile");
+        return false;
+    }
+    word = strtok_r(words, " \t", &save);
+    argv[argc++] = word ? word : "cc";
+    argv[argc++] = "-std=c11";
+    argv[argc++] = "-O2";
+    argv[argc++] = "-shared";
+    argv[argc++] = "-fPIC";
+    while ((word = strtok_r(NULL, " \t", &save)) != NULL && argc < AOT_MAX_ARGS - 6)
+        argv[argc++] = word;
+    argv[argc++] = "-o";
+    argv[argc++] = (char*) object;
+    argv[argc++] = "-x";
+    argv[argc++] = "c";
+    argv[argc++] = (char*) source;
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    free(words);
+    if (pid < 0) {
+        perror("svs_aot_compile");
+        return false;
+    }
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("svs_aot_compile");
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+//
+// Трансляция программы из памяти, сборка и загрузка в процессор.
+// Текст и объект создаются в личном каталоге, сделанном mkdtemp(),
+// и удаляются после загрузки вместе с каталогом.
+//
+bool svs_aot_build(struct ElSvsProcessor *cpu, const char *name, const unsigned *entry,
+                   unsigned nentries, bool all)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char dir[256], source[sizeof(dir) + 16], object[sizeof(dir) + 16];
+    bool ok = false;
+
+    snprintf(dir, sizeof(dir), "%s/svsaot-XXXXXX", (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+    if (! mkdtemp(dir)) {
+        perror(dir);
+        return false;
+    }
+    snprintf(source, sizeof(source), "%s/prog.c", dir);
+    snprintf(object, sizeof(object), "%s/prog.so", dir);
+
+    FILE *output = fopen(source, "w");
+    if (! output) {
+        perror(source);
+    } else {
+        svs_aot_translate(output, name, entry, nentries, all);
+        ok = fclose(output) == 0 &&
+             svs_aot_compile(source, object) &&
+             ElSvsAotLoad(cpu, object);
+    }
+    unlink(source);
+    unlink(object);
+    rmdir(dir);
+    return ok;
+}
@@ -227,7 +227,9 @@ void svs_add(struct ElSvsProcessor *cpu, uint64_t val, int negate_acc, int negat
         a2 = acc;
     }
     mr = 0;
-    neg = is_negative(&a1);
+    // Знак берём по значению: модуль -1 равен +1 и имеет
+    // мантиссу 01.00...0, у которой бит 41 тоже установлен.
+    neg = a1.mantissa < 0;
     if (diff == 0) {
         // Nothing to do.
     } else if (diff <= 40) {
@@ -69,8 +69,11 @@ static const char *sim_stop_messages[] = {
 //
 void ElSvsSetPult(struct ElSvsProcessor *cpu, unsigned index, uint64_t val)
 {
-    if (index > 0 && index < 010)
+    if (index > 0 && index < 010) {
+        if (cpu->replay && ! svs_replay_input(cpu, REPLAY_PULT, index, val))
+            return;
         cpu->pult[index] = val;
+    }
 }
 
 //
@@ -97,6 +100,7 @@ void cpu_reset(struct ElSvsProcessor *cpu, unsigned cpu_index)
     cpu->core.RZ = 0;
     memset(cpu->core.RP, 0, sizeof(cpu->core.RP));
     memset(cpu->core.RPS, 0, sizeof(cpu->core.RPS));
+    mmu_select(cpu);
 
     cpu->core.RPR = 0;
     cpu->core.GRM = 0;
@@ -105,12 +109,15 @@ void cpu_reset(struct ElSvsProcessor *cpu, unsigned cpu_index)
     cpu->core.POP = 0;
     cpu->core.OPOP = 0;
     cpu->core.RKP = 0;
+    cpu->iintr = 0;
+    cpu->pair_pc = ~0u;
 
     cpu->core.PC = 1;
+    cpu->dirty = DIRTY_ALL;
 
     if (cpu->trace_instructions | cpu->trace_extracodes | cpu->trace_fetch |
         cpu->trace_memory | cpu->trace_exceptions | cpu->trace_registers) {
-        fprintf(cpu->log_output, "cpu%d --- Reset\n", cpu->index);
+        svs_trace_text(cpu, "cpu%d --- Reset\n", cpu->index);
     }
     //TODO: mpd_reset(cpu);
 }
@@ -166,6 +173,91 @@ unsigned ElSvsGetRAU(struct ElSvsProcessor *cpu)
     return cpu->core.RAU;
 }
 
+//
+// Get or clear performance counters.
+//
+void ElSvsGetStats(struct ElSvsProcessor *cpu, ElSvsStats *stats)
+{
+    *stats = cpu->stats;
+}
+
+void ElSvsResetStats(struct ElSvsProcessor *cpu)
+{
+    memset(&cpu->stats, 0, sizeof(cpu->stats));
+}
+
+void ElSvsSetPairStats(struct ElSvsProcessor *cpu, ElSvsPairStats *pairs)
+{
+    cpu->pairs = pairs;
+    cpu->pair_pc = ~0u;
+}
+
+//
+// Install host implementation of extracode.
+//
+void ElSvsSetExtracode(struct ElSvsProcessor *cpu, unsigned opcode, ElSvsExtracode handler)
+{
+    if ((opcode < 050 || opcode > 077) && opcode != 020 && opcode != 021) {
+        fprintf(stderr, "Wrong extracode: э%o\n", opcode);
+        exit(1);
+    }
+    cpu->extracode[opcode] = handler;
+}
+
+//
+// Set breakpoint or watchpoint.
+//
+void ElSvsSetBreakpoint(struct ElSvsProcessor *cpu, ElSvsBreakKind kind, unsigned addr)
+{
+    if (kind >= ELSVS_BREAK_KINDS) {
+        fprintf(stderr, "Wrong breakpoint kind: %d\n", kind);
+        exit(1);
+    }
+    addr = ADDR(addr);
+    cpu->brk_map[kind][addr / 64] |= 1ULL << (addr % 64);
+    cpu->brk_pages[kind] |= 1u << (addr >> 10);
+}
+
+//
+// Clear breakpoint or watchpoint.
+// Page flag is removed with the last breakpoint on the page.
+//
+void ElSvsClearBreakpoint(struct ElSvsProcessor *cpu, ElSvsBreakKind kind, unsigned addr)
+{
+    unsigned page, i;
+
+    if (kind >= ELSVS_BREAK_KINDS) {
+        fprintf(stderr, "Wrong breakpoint kind: %d\n", kind);
+        exit(1);
+    }
+    addr = ADDR(addr);
+    cpu->brk_map[kind][addr / 64] &= ~(1ULL << (addr % 64));
+
+    page = addr >> 10;
+    for (i = page * 1024 / 64; i < (page + 1) * 1024 / 64; i++) {
+        if (cpu->brk_map[kind][i])
+            return;
+    }
+    cpu->brk_pages[kind] &= ~(1u << page);
+}
+
+void ElSvsClearAllBreakpoints(struct ElSvsProcessor *cpu)
+{
+    memset(cpu->brk_pages, 0, sizeof(cpu->brk_pages));
+    memset(cpu->brk_map, 0, sizeof(cpu->brk_map));
+}
+
+//
+// Есть ли точка останова на адресе.
+// После останова на точке команда при продолжении выполняется без останова.
+//
+bool svs_brk_match(struct ElSvsProcessor *cpu, ElSvsBreakKind kind, unsigned addr)
+{
+    if (cpu->brk_skip)
+        return false;
+    return cpu->brk_map[kind][addr / 64] >> (addr % 64) & 1;
+}
+
 //
 // Request routine
 //
@@ -173,16 +265,34 @@ void cpu_req(struct ElSvsProcessor *cpu)
 {
     if (cpu->trace_instructions | cpu->trace_extracodes | cpu->trace_fetch |
         cpu->trace_memory | cpu->trace_exceptions | cpu->trace_registers) {
-        fprintf(cpu->log_output, "cpu%d --- Request from control panel\n", cpu->index);
+        svs_trace_text(cpu, "cpu%d --- Request from control panel\n", cpu->index);
     }
     cpu->core.GRVP |= GRVP_PANEL_REQ;
 }
 
+//
+// Request from control panel, by host.
+// When recording, it is written to the log.
+//
+void ElSvsPanelRequest(struct ElSvsProcessor *cpu)
+{
+    if (cpu->replay && ! svs_replay_input(cpu, REPLAY_REQUEST, 0, 0))
+        return;
+    cpu_req(cpu);
+}
+
 //
 // Enable/disable tracing.
 //
 void ElSvsSetTrace(struct ElSvsProcessor *cpu, const char *trace_mode, const char *filename)
 {
+    bool binary = false, async = false, drop = false;
+
+    // Write out the binary trace buffer and pending records
+    // of the background writer.
+    svs_trace_binary(cpu, false);
+    svs_trace_async_stop(cpu);
+
     if (cpu->log_output != stdout) {
         // Close previous log file.
         fclose(cpu->log_output);
@@ -190,30 +300,37 @@ void ElSvsSetTrace(struct ElSvsProcessor *cpu, const char *trace_mode, const cha
     }
 
     // Disable all trace options.
-    cpu->trace_instructions = false;
-    cpu->trace_extracodes = false;
-    cpu->trace_fetch = false;
-    cpu->trace_memory = false;
-    cpu->trace_exceptions = false;
-    cpu->trace_registers = false;
+    cpu->trace_flags = 0;
+    svs_trace_enable(cpu, false);
 
     if (trace_mode && trace_mode[0]) {
         // Parse the mode string and enable all requested trace flags.
+        // With filter, they are enabled per instruction.
         int i;
         for (i = 0; trace_mode[i]; i++) {
             switch (trace_mode[i]) {
-            case 'i': cpu->trace_instructions = true; break;
-            case 'e': cpu->trace_extracodes = true; break;
-            case 'f': cpu->trace_fetch = true; break;
-            case 'm': cpu->trace_memory = true; break;
-            case 'x': cpu->trace_exceptions = true; break;
-            case 'r': cpu->trace_registers = true; break;
+            case 'i': cpu->trace_flags |= TRACE_FLAG_INSTRUCTIONS; break;
+            case 'e': cpu->trace_flags |= TRACE_FLAG_EXTRACODES; break;
+            case 'f': cpu->trace_flags |= TRACE_FLAG_FETCH; break;
+            case 'm': cpu->trace_flags |= TRACE_FLAG_MEMORY; break;
+            case 'x': cpu->trace_flags |= TRACE_FLAG_EXCEPTIONS; break;
+            case 'r': cpu->trace_flags |= TRACE_FLAG_REGISTERS; break;
+            case 'b': binary = true; break;
+            case 'a': async = true; break;
+            case 'd': drop = true; break;
             default:
                 fprintf(stderr, "Wrong trace option: %c\n", trace_mode[i]);
                 exit(1);
             }
         }
+        svs_trace_enable(cpu, ! cpu->trace_armed);
 
+        if (async) {
+            // Output by the background thread, possibly
+            // into a file shared with other processors.
+            svs_trace_async_start(cpu, filename, binary, drop);
+            return;
+        }
         if (filename && filename[0]) {
             // Open new log file.
             cpu->log_output = fopen(filename, "a");
@@ -221,8 +338,11 @@ void ElSvsSetTrace(struct ElSvsProcessor *cpu, const char *trace_mode, const cha
                 perror(filename);
                 exit(1);
             }
-            setlinebuf(cpu->log_output);
+            if (! binary)
+                setlinebuf(cpu->log_output);
         }
+        if (binary)
+            svs_trace_binary(cpu, true);
     }
 }
 
@@ -231,14 +351,18 @@ void ElSvsSetTrace(struct ElSvsProcessor *cpu, const char *trace_mode, const cha
 //
 struct ElSvsProcessor *ElSvsAllocate(int cpu_index)
 {
-    struct ElSvsProcessor *cpu = calloc(1, sizeof(struct ElSvsProcessor));
+    // Выравнивание на строку кэша: см. struct ElSvsProcessor.
+    struct ElSvsProcessor *cpu = aligned_alloc(SVS_CACHE_LINE, sizeof(struct ElSvsProcessor));
 
     if (!cpu) {
         perror(__func__);
         abort();
     }
+    memset(cpu, 0, sizeof(struct ElSvsProcessor));
     cpu_reset(cpu, cpu_index);
     cpu->log_output = stdout;
+    cpu->point_at = UINT64_MAX;
+    cpu->stop_at = UINT64_MAX;
     return cpu;
 }
 
@@ -271,6 +395,8 @@ void utf8_putc(unsigned ch, FILE *fout)
 static void cmd_002(struct ElSvsProcessor *cpu)
 {
     //printf("--- рег %03o", cpu->Aex & 0377);
+    cpu->dirty |= DIRTY_CTRL;
+    cpu->refetch = true;
 
     switch (cpu->Aex & 0377) {
 
@@ -278,91 +404,91 @@ static void cmd_002(struct ElSvsProcessor *cpu)
     case 024: case 025: case 026: case 027:
         // Запись в регистры приписки режима пользователя
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка приписки пользователя\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка приписки пользователя\n", cpu->index);
         mmu_set_rp(cpu, cpu->Aex & 7, cpu->core.ACC, 0);
         break;
 
     case 030: case 031: case 032: case 033:
         // Запись в регистры защиты
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Запись в регистр защиты\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Запись в регистр защиты\n", cpu->index);
         mmu_set_protection(cpu, cpu->Aex & 3, cpu->core.ACC);
         break;
 
     case 034:
         // Запись в регистр конфигурации оперативной памяти
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Запись конфигурации оперативной памяти\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Запись конфигурации оперативной памяти\n", cpu->index);
         // игнорируем
         break;
 
     case 035:
         // Запись в сигнал контроля оперативной памяти
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Запись в сигнал контроля оперативной памяти\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Запись в сигнал контроля оперативной памяти\n", cpu->index);
         // игнорируем
         break;
 
     case 0235:
         // Чтение сигнала контроля от оперативной памяти
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение сигнала контроля оперативной памяти\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение сигнала контроля оперативной памяти\n", cpu->index);
         cpu->core.ACC = 0;
         break;
 
     case 0236:
         // Считывание сигналов запрета запроса в МОП от коммутаторов памяти
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение ЗЗ\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение ЗЗ\n", cpu->index);
         cpu->core.ACC = 0; // не используем
         break;
 
     case 037:
         // Гашение регистра внутренних прерываний
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Гашение РПР\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Гашение РПР\n", cpu->index);
         cpu->core.RPR &= cpu->core.ACC | RPR_WIRED_BITS;
         break;
 
     case 0237:
         // Чтение главного регистра прерываний
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение ГРП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение ГРП\n", cpu->index);
         cpu->core.ACC = cpu->core.RPR;
         break;
 
     case 044:
         // Запись в регистр тега
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка тега\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка тега\n", cpu->index);
         cpu->core.TagR = cpu->core.ACC;
         break;
 
     case 0244:
         // Чтение регистра тега
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение регистра тега\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение регистра тега\n", cpu->index);
         cpu->core.ACC = cpu->core.TagR;
         break;
 
     case 0245:
         // Чтение регистра ТЕГБРЧ
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение ТЕГБРЧ\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение ТЕГБРЧ\n", cpu->index);
         cpu->core.ACC = 0; //TODO
         break;
 
     case 046:
         // Запись маски внешних прерываний
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка ГРМ\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка ГРМ\n", cpu->index);
         cpu->core.GRM = cpu->core.ACC;
         break;
 
     case 0246:
         // Чтение маски внешних прерываний
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение ГРМ\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение ГРМ\n", cpu->index);
         cpu->core.ACC = cpu->core.GRM;
         break;
 
@@ -370,21 +496,21 @@ static void cmd_002(struct ElSvsProcessor *cpu)
         // Clearing the external interrupt register:
         // it is impossible to clear wired (stateless) bits this way
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Гашение РВП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Гашение РВП\n", cpu->index);
         cpu->core.GRVP &= cpu->core.ACC | GRVP_WIRED_BITS;
         break;
 
     case 0247:
         // Чтение регистра внешних прерываний
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение РВП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение РВП\n", cpu->index);
         cpu->core.ACC = cpu->core.GRVP;
         break;
 
     case 050:
         // Запись в регистр прерываний процессорам
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Запись в ПП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Запись в ПП\n", cpu->index);
         cpu->core.PP = cpu->core.ACC & (CONF_IOM_MASK | CONF_CPU_MASK | CONF_DATA_MASK);
         if (cpu->core.ACC & CONF_MT) {
             // Передача младшей половины байта.
@@ -404,14 +530,14 @@ static void cmd_002(struct ElSvsProcessor *cpu)
     case 0250:
         // Чтение номера процессора
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение номера процессора\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение номера процессора\n", cpu->index);
         cpu->core.ACC = cpu->index;
         break;
 
     case 051:
         // Запись в регистр ответов процессорам
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Запись в ОПП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Запись в ОПП\n", cpu->index);
         cpu->core.OPP = cpu->core.ACC & (CONF_IOM_MASK | CONF_CPU_MASK | CONF_DATA_MASK);
         if (cpu->core.ACC & CONF_MT) {
             // Передача старшей половины байта.
@@ -426,7 +552,7 @@ static void cmd_002(struct ElSvsProcessor *cpu)
     case 052:
         // Гашение регистра прерываний от процессоров
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Гашение ПОП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Гашение ПОП\n", cpu->index);
         // Оставляем бит передачи МПД.
         cpu->core.POP &= cpu->core.ACC | CONF_MT;
         break;
@@ -434,77 +560,77 @@ static void cmd_002(struct ElSvsProcessor *cpu)
     case 0252:
         // Чтение регистра прерываний от процессоров
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение ПОП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение ПОП\n", cpu->index);
         cpu->core.ACC = cpu->core.POP;
         break;
 
     case 053:
         // Гашение регистра ответов от процессоров
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Гашение ОПОП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Гашение ОПОП\n", cpu->index);
         cpu->core.OPOP &= cpu->core.ACC;
         break;
 
     case 0253:
         // Чтение регистра ответов от процессоров
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение ОПОП\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение ОПОП\n", cpu->index);
         cpu->core.ACC = cpu->core.OPOP;
         break;
 
     case 054:
         // Запись в регистр конфигурации процессора
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка конфигурации процессора\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка конфигурации процессора\n", cpu->index);
         cpu->core.RKP = cpu->core.ACC & (CONF_IOM_MASK | CONF_CPU_MASK | CONF_MR | CONF_MT);
         break;
 
     case 0254:
         // Чтение регистра конфигурации процессора
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение регистра конфигурации процессора\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение регистра конфигурации процессора\n", cpu->index);
         cpu->core.ACC = cpu->core.RKP;
         break;
 
     case 055:
         // Запись в регистр аварии процессоров
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Запись в регистр аварии процессоров\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Запись в регистр аварии процессоров\n", cpu->index);
         // игнорируем
         break;
 
     case 0255:
         // Чтение регистра аварии процессоров
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение регистра аварии процессоров\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение регистра аварии процессоров\n", cpu->index);
         cpu->core.ACC = 0;
         break;
 
     case 056:
         // Запись в регистр часов
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка часов\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка часов\n", cpu->index);
         //TODO
         break;
 
     case 0256:
         // Чтение регистра часов
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение регистра часов\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение регистра часов\n", cpu->index);
         cpu->core.ACC = 0; //TODO
         break;
 
     case 057:
         // Запись в регистр таймера
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка таймера\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка таймера\n", cpu->index);
         //TODO
         break;
 
     case 0257:
         // Чтение регистра таймера
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Чтение регистра таймера\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Чтение регистра таймера\n", cpu->index);
         cpu->core.ACC = 0; //TODO
         break;
 
@@ -512,7 +638,7 @@ static void cmd_002(struct ElSvsProcessor *cpu)
     case 064: case 065: case 066: case 067:
         // Запись в регистры приписки супервизора
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка приписки супервизора\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка приписки супервизора\n", cpu->index);
         mmu_set_rp(cpu, cpu->Aex & 7, cpu->core.ACC, 1);
         break;
 
@@ -524,7 +650,7 @@ static void cmd_002(struct ElSvsProcessor *cpu)
         // разрядов (ПКП и ПКЛ).
         //
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Установка режимов УУ\n", cpu->index);
+            svs_trace_text(cpu, "cpu%d --- Установка режимов УУ\n", cpu->index);
 
         if (cpu->Aex & 1) cpu->core.RUU |= RUU_AVOST_DISABLE;
         else              cpu->core.RUU &= ~RUU_AVOST_DISABLE;
@@ -539,7 +665,7 @@ static void cmd_002(struct ElSvsProcessor *cpu)
     case 0140:
         // Сброс контрольных признаков (СКП).
         if (cpu->trace_instructions | cpu->trace_registers)
-            fprintf(cpu->log_output, "cpu%d --- Сброс контрольных признаков\n",
+            svs_trace_text(cpu, "cpu%d --- Сброс контрольных признаков\n",
                 cpu->index);
         //TODO
         break;
@@ -551,9 +677,15 @@ static void cmd_002(struct ElSvsProcessor *cpu)
             longjmp(cpu->exception, ESS_UNIMPLEMENTED);
         }
 #endif
-        // Неиспользуемые адреса
-        printf("--- %05o%s: РЕГ %o - неизвестный спец.регистр",
-            cpu->core.PC, (cpu->core.RUU & RUU_RIGHT_INSTR) ? "п" : "л", cpu->Aex);
+        // Неиспользуемые адреса.  Счётчик команд уже указывает
+        // на следующую команду: после левой - на правую того же слова.
+        if (cpu->trace_exceptions) {
+            bool left = (cpu->core.RUU & RUU_RIGHT_INSTR) != 0;
+
+            svs_trace_text(cpu, "cpu%d --- %05o%s: РЕГ %o - неизвестный спец.регистр\n",
+                cpu->index, left ? cpu->core.PC : ADDR(cpu->core.PC - 1),
+                left ? "л" : "п", cpu->Aex);
+        }
         break;
     }
 }
@@ -575,17 +707,29 @@ static int is_extracode(int opcode)
 }
 
 //
-// Execute one instruction, placed on address PC:RUU_RIGHT_INSTR.
-// When stopped, perform a longjmp to cpu->exception,
-// sending a stop code.
+// Код операции команды из 24 разрядов.
 //
-void cpu_one_instr(struct ElSvsProcessor *cpu)
+static inline int insn_opcode(uint32_t insn)
 {
-    int reg, opcode, addr, paddr, nextpc, next_mod;
-    uint64_t word;
+    return (insn & BBIT(20)) ? (insn >> 12) & 0370 : (insn >> 12) & 077;
+}
+
+//
+// Execute one instruction of the fetched word, left or right half
+// as given by RUU_RIGHT_INSTR.  When op is not negative, it is the
+// opcode of the instruction, already known to the caller: the switch
+// is then folded into a single case.  Only handlers of fused pairs
+// use it; everything else calls the single copy in cpu_execute().
+//
+static inline __attribute__((always_inline))
+void cpu_execute_op(struct ElSvsProcessor *cpu, uint64_t word, int paddr, const int op)
+{
+    int reg, opcode, addr, nextpc, next_mod, n;
+
+    // Счётчик команд для текущего режима и половины слова.
+    uint64_t *counter = &cpu->stats.instructions[IS_SUPERVISOR(cpu->core.RUU) != 0]
+                                                [(cpu->core.RUU & RUU_RIGHT_INSTR) != 0];
 
-    cpu->corr_stack = 0;
-    word = mmu_fetch(cpu, cpu->core.PC, &paddr);
     if (cpu->core.RUU & RUU_RIGHT_INSTR)
         cpu->RK = (uint32_t)word;         // get right instruction
     else
@@ -594,22 +738,49 @@ void cpu_one_instr(struct ElSvsProcessor *cpu)
     cpu->RK &= BITS(24);
 
     reg = cpu->RK >> 20;
-    if (cpu->RK & BBIT(20)) {
+    if ((op >= 0) ? (op & 0200) : (cpu->RK & BBIT(20))) {
         addr = cpu->RK & BITS(15);
-        opcode = (cpu->RK >> 12) & 0370;
+        opcode = (op >= 0) ? op : (cpu->RK >> 12) & 0370;
     } else {
         addr = cpu->RK & BITS(12);
         if (cpu->RK & BBIT(19))
             addr |= 070000;
-        opcode = (cpu->RK >> 12) & 077;
+        opcode = (op >= 0) ? op : (cpu->RK >> 12) & 077;
     }
 
+    // Бортовой самописец: новая команда и результат предыдущей.
+    struct ElSvsFlight *f = &cpu->flight[cpu->flight_count++ % SVS_FLIGHT_SIZE];
+    f->ACC = cpu->core.ACC;
+    f->Aex = cpu->Aex;
+    f->PC = cpu->core.PC;
+    f->right = (cpu->core.RUU & RUU_RIGHT_INSTR) != 0;
+    f->paddr = paddr;
+    f->RK = cpu->RK;
+
+    // После выборки: физический адрес и код операции.
+    if (cpu->trace_filter_on && ! svs_trace_match(cpu, paddr, opcode))
+        svs_trace_enable(cpu, false);
+
     // Трассировка команды: адрес, код и мнемоника.
     if (cpu->trace_instructions ||
         (cpu->trace_extracodes && is_extracode(opcode))) {
         svs_trace_opcode(cpu, paddr);
     }
 
+    // Пары команд слова, выполненных подряд, если их считают.
+    if (cpu->pairs) {
+        if (cpu->core.RUU & RUU_RIGHT_INSTR) {
+            if (cpu->pair_pc == cpu->core.PC) {
+                int left = insn_opcode((word >> 24) & BITS(24));
+
+                cpu->pairs->pairs[SVS_PAIR_INDEX(left)][SVS_PAIR_INDEX(opcode)]++;
+            }
+            cpu->pair_pc = ~0u;
+        } else {
+            cpu->pair_pc = cpu->core.PC;
+        }
+    }
+
     nextpc = ADDR(cpu->core.PC + 1);
     if (cpu->core.RUU & RUU_RIGHT_INSTR) {
         cpu->core.PC += 1;                               // increment PC
@@ -930,6 +1101,8 @@ void cpu_one_instr(struct ElSvsProcessor *cpu)
             if ((cpu->core.M[PSW] & PSW_MMAP_DISABLE) &&
                 (reg == IBP || reg == DWP))
                 cpu->core.M[reg] |= BBIT(16);
+            if (reg == PSW)
+                mmu_select(cpu);
 
         } else
             cpu->core.M[cpu->Aex & 017] = ADDR(cpu->core.ACC);
@@ -949,6 +1122,8 @@ void cpu_one_instr(struct ElSvsProcessor *cpu)
         cpu->core.M[rg] = ad;
         if ((cpu->core.M[PSW] & PSW_MMAP_DISABLE) && (rg == IBP || rg == DWP))
             cpu->core.M[rg] |= BBIT(16);
+        if (rg == PSW)
+            mmu_select(cpu);
         cpu->core.M[0] = 0;
         cpu->core.RAU = SET_LOGICAL(cpu->core.RAU);
         break;
@@ -971,6 +1146,8 @@ transfer_modifier:
             if ((cpu->core.M[PSW] & PSW_MMAP_DISABLE) &&
                 ((cpu->Aex & 037) == IBP || (cpu->Aex & 037) == DWP))
                 cpu->core.M[cpu->Aex & 037] |= BBIT(16);
+            if ((cpu->Aex & 037) == PSW)
+                mmu_select(cpu);
 
         } else
             cpu->core.M[cpu->Aex & 017] = cpu->core.M[reg];
@@ -1008,7 +1185,36 @@ transfer_modifier:
     case 0200:                                      // э20
     case 0210:                                      // э21
 stop_as_extracode:
+            n = (opcode <= 077) ? opcode : opcode >> 3;
+            cpu->stats.extracodes[n]++;
             cpu->Aex = ADDR(addr + cpu->core.M[reg]);
+            if (cpu->extracode[n]) {
+                // Экстракод, реализованный на стороне хоста.
+                // Регистры устанавливаются как при входе в экстракод,
+                // но режимы УУ остаются прежними.
+                cpu->core.M[ERET] = nextpc;
+                cpu->core.M[SPSW] = (cpu->core.M[PSW] & (PSW_INTR_DISABLE | PSW_MMAP_DISABLE |
+                                               PSW_PROT_DISABLE)) | IS_SUPERVISOR(cpu->core.RUU);
+                cpu->core.M[14] = cpu->Aex;
+
+                ElSvsStatus status = cpu->extracode[n](cpu, cpu->Aex);
+                cpu->dirty = DIRTY_ALL;
+                if (status == ESS_OK) {
+                    // Возврат как по команде "выпр".
+                    cpu->core.M[PSW] = cpu->core.M[SPSW] & (SPSW_INTR_DISABLE |
+                                                  SPSW_MMAP_DISABLE | SPSW_PROT_DISABLE);
+                    cpu->core.PC = cpu->core.M[ERET];
+                    cpu->core.RUU &= ~RUU_RIGHT_INSTR;
+                    cpu->core.RUU = SET_SUPERVISOR(cpu->core.RUU,
+                                              cpu->core.M[SPSW] & (SPSW_EXTRACODE | SPSW_INTERRUPT));
+                    mmu_select(cpu);
+                    break;
+                }
+                if (status != ESS_UNIMPLEMENTED)
+                    longjmp(cpu->exception, status);
+
+                // Выполняем экстракод программой.
+            }
             // Адрес возврата из экстракода.
             cpu->core.M[ERET] = nextpc;
             // Сохранённые режимы УУ.
@@ -1019,6 +1225,7 @@ stop_as_extracode:
                           PSW_PROT_DISABLE | /*?*/ PSW_INTR_HALT;
             cpu->core.M[14] = cpu->Aex;
             cpu->core.RUU = SET_SUPERVISOR(cpu->core.RUU, SPSW_EXTRACODE);
+            mmu_select(cpu);
 
             if (opcode <= 077)
                 cpu->core.PC = 0500 + opcode;            // э50-э77
@@ -1029,6 +1236,7 @@ stop_as_extracode:
     case 0220:                                      // мода, utc
         cpu->Aex = ADDR(addr + cpu->core.M[reg]);
         next_mod = cpu->Aex;
+        cpu->stats.modifiers++;
         break;
     case 0230:                                      // мод, wtc
         if (! addr && reg == 017) {
@@ -1037,6 +1245,7 @@ stop_as_extracode:
         }
         cpu->Aex = ADDR(addr + cpu->core.M[reg]);
         next_mod = ADDR(mmu_load(cpu, cpu->Aex));
+        cpu->stats.modifiers++;
         break;
     case 0240:                                      // уиа, vtm
         cpu->Aex = addr;
@@ -1047,6 +1256,7 @@ stop_as_extracode:
                              PSW_MMAP_DISABLE | PSW_PROT_DISABLE);
             cpu->core.M[PSW] |= addr & (PSW_INTR_DISABLE |
                                    PSW_MMAP_DISABLE | PSW_PROT_DISABLE);
+            mmu_select(cpu);
         }
         break;
     case 0250:                                      // слиа, utm
@@ -1058,6 +1268,7 @@ stop_as_extracode:
                              PSW_MMAP_DISABLE | PSW_PROT_DISABLE);
             cpu->core.M[PSW] |= addr & (PSW_INTR_DISABLE |
                                    PSW_MMAP_DISABLE | PSW_PROT_DISABLE);
+            mmu_select(cpu);
         }
         break;
     case 0260:                                      // по, uza
@@ -1123,6 +1334,7 @@ stop_as_extracode:
             cpu->core.RUU &= ~RUU_RIGHT_INSTR;
         cpu->core.RUU = SET_SUPERVISOR(cpu->core.RUU,
                                   cpu->core.M[SPSW] & (SPSW_EXTRACODE | SPSW_INTERRUPT));
+        mmu_select(cpu);
         if (cpu->core.M[SPSW] & SPSW_MOD_RK)
             next_mod = cpu->core.M[MOD];
         break;
@@ -1186,6 +1398,7 @@ branch_zero:
         // Внешние прерывания отсутствуют.
         cpu->core.GRVP &= ~GRVP_REQUEST;
     }
+    ++*counter;
 
     // Трассировка изменённых регистров.
     if (cpu->trace_registers) {
@@ -1201,6 +1414,196 @@ branch_zero:
 #endif
 }
 
+//
+// Execute one instruction of the fetched word: the single
+// out-of-line copy of the interpreter.
+//
+static __attribute__((noinline))
+void cpu_execute(struct ElSvsProcessor *cpu, uint64_t word, int paddr)
+{
+    cpu_execute_op(cpu, word, paddr, -1);
+}
+
+//
+// Execute one instruction, placed on address PC:RUU_RIGHT_INSTR.
+// When stopped, perform a longjmp to cpu->exception,
+// sending a stop code.
+//
+void cpu_one_instr(struct ElSvsProcessor *cpu)
+{
+    int paddr;
+
+    // Запуск трассировки по событию и фильтр: до выборки команды
+    // проверяем процессор, режим и виртуальный адрес.
+    if (cpu->trace_filter_on | cpu->trace_trigger_on)
+        svs_trace_select(cpu);
+
+    cpu->corr_stack = 0;
+    uint64_t word = mmu_fetch(cpu, cpu->core.PC, &paddr);
+    cpu_execute(cpu, word, paddr);
+}
+
+//
+// Команды для оттранслированного кода.  Код операции известен заранее,
+// но команды выполняются общей копией интерпретатора: копия на каждый
+// код операции не помещается в кэш команд.
+//
+#define AOT_OPCODES(X) \
+    X(000) X(001) X(002) X(003) X(004) X(005) X(006) X(007) \
+    X(010) X(011) X(012) X(013) X(014) X(015) X(016) X(017) \
+    X(020) X(021) X(022) X(023) X(024) X(025) X(026) X(027) \
+    X(030) X(031) X(032) X(033) X(034) X(035) X(036) X(037) \
+    X(040) X(041) X(042) X(043) X(044) X(045) X(046) X(047) \
+    X(050) X(051) X(052) X(053) X(054) X(055) X(056) X(057) \
+    X(060) X(061) X(062) X(063) X(064) X(065) X(066) X(067) \
+    X(070) X(071) X(072) X(073) X(074) X(075) X(076) X(077) \
+    X(0200) X(0210) X(0220) X(0230) X(0240) X(0250) X(0260) X(0270) \
+    X(0300) X(0310) X(0320) X(0330) X(0340) X(0350) X(0360) X(0370)
+
+#define AOT_ENTRY(op) [op] = cpu_execute,
+const struct svs_aot_runtime svs_aot_runtime = {
+    .insn = { AOT_OPCODES(AOT_ENTRY) },
+    .execute = cpu_execute,
+    .fetch = mmu_fetch,
+};
+
+//
+// Переход к правой команде слова, как в цикле simulate().
+// Если левая команда не писала в память и не меняла приписку
+// и режимы (признак refetch), слово не могло измениться, и повторная
+// выборка только учитывается в счётчике.  Иначе слово выбирается
+// снова; возвращает false, если оно изменилось.
+//
+static inline bool cpu_next_half(struct ElSvsProcessor *cpu, uint64_t *word,
+                                 int *paddr)
+{
+    cpu->brk_skip = false;
+    cpu->icount++;
+    cpu->corr_stack = 0;
+    if (! cpu->refetch) {
+        cpu->stats.fetches++;
+        return true;
+    }
+    uint64_t again = mmu_fetch(cpu, cpu->core.PC, paddr);
+    bool same = (again == *word);
+    *word = again;
+    return same;
+}
+
+#define PAIR(left, right)   ((left) << 9 | (right))
+
+//
+// Execute both instructions of the word at PC:0, for the fused engine.
+// Called when no stop, interrupt or trace filter can come between
+// the halves.  The word is fetched once, and frequent pairs of opcodes
+// run as single handlers.  The pairs are the most frequent in the
+// ElSvsPairStats histogram of the bemsh corpus (runbemsh -p) and of
+// the job start (bench_startjob), where the left one does not jump.
+// The state after each half, also on an exception in either half,
+// is the same as after cpu_one_instr().
+//
+static void cpu_one_word(struct ElSvsProcessor *cpu)
+{
+    int paddr;
+
+    cpu->corr_stack = 0;
+    uint64_t word = mmu_fetch(cpu, cpu->core.PC, &paddr);
+    cpu->refetch = false;
+    unsigned pc = cpu->core.PC;
+    unsigned supervisor = IS_SUPERVISOR(cpu->core.RUU);
+    int left = insn_opcode(word >> 24 & BITS(24));
+
+    // Пары без переходов в левой команде.
+    switch (PAIR(left, insn_opcode(word & BITS(24)))) {
+    case PAIR(010, 000):                            // сч, зп
+        cpu_execute_op(cpu, word, paddr, 010);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 000);
+        return;
+    case PAIR(010, 025):                            // сч, вчп
+        cpu_execute_op(cpu, word, paddr, 010);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 025);
+        return;
+    case PAIR(010, 034):                            // сч, слпа
+        cpu_execute_op(cpu, word, paddr, 010);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 034);
+        return;
+    case PAIR(010, 036):                            // сч, сда
+        cpu_execute_op(cpu, word, paddr, 010);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 036);
+        return;
+    case PAIR(010, 0270):                           // сч, пе
+        cpu_execute_op(cpu, word, paddr, 010);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 0270);
+        return;
+    case PAIR(012, 0260):                           // нтж, по
+        cpu_execute_op(cpu, word, paddr, 012);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 0260);
+        return;
+    case PAIR(012, 0270):                           // нтж, пе
+        cpu_execute_op(cpu, word, paddr, 012);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 0270);
+        return;
+    case PAIR(013, 0370):                           // слц, цикл
+        cpu_execute_op(cpu, word, paddr, 013);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute_op(cpu, word, paddr, 0370);
+        return;
+    case PAIR(0250, 0370):                          // слиа, цикл
+        // Слиа в M0 меняет режимы.
+        cpu_execute_op(cpu, word, paddr, 0250);
+        if (cpu_next_half(cpu, &word, &paddr))
+            cpu_execute_op(cpu, word, paddr, 0370);
+        else
+            cpu_execute(cpu, word, paddr);
+        return;
+    case PAIR(000, 0370):                           // зп, цикл
+        // Запись могла изменить само слово.
+        cpu_execute_op(cpu, word, paddr, 000);
+        if (cpu_next_half(cpu, &word, &paddr))
+            cpu_execute_op(cpu, word, paddr, 0370);
+        else
+            cpu_execute(cpu, word, paddr);
+        return;
+    case PAIR(000, 036):                            // зп, сда
+        cpu_execute_op(cpu, word, paddr, 000);
+        if (cpu_next_half(cpu, &word, &paddr))
+            cpu_execute_op(cpu, word, paddr, 036);
+        else
+            cpu_execute(cpu, word, paddr);
+        return;
+    }
+
+    // Модификация адреса правой команды.
+    if (left == 0220) {                             // мода
+        cpu_execute_op(cpu, word, paddr, 0220);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute(cpu, word, paddr);
+        return;
+    }
+    if (left == 0230) {                             // мод
+        cpu_execute_op(cpu, word, paddr, 0230);
+        cpu_next_half(cpu, &word, &paddr);
+        cpu_execute(cpu, word, paddr);
+        return;
+    }
+
+    // Прочие пары: правая команда выполняется из того же слова,
+    // если левая не передала управление и не сменила режим.
+    cpu_execute(cpu, word, paddr);
+    if (cpu->core.PC != pc || ! (cpu->core.RUU & RUU_RIGHT_INSTR) ||
+        IS_SUPERVISOR(cpu->core.RUU) != supervisor)
+        return;
+    cpu_next_half(cpu, &word, &paddr);
+    cpu_execute(cpu, word, paddr);
+}
+
 //
 // Операция прерывания 1: внутреннее прерывание.
 // Описана в 9-м томе технического описания БЭСМ-6, страница 119.
@@ -1220,6 +1623,7 @@ void op_int_1(struct ElSvsProcessor *cpu, const char *msg)
     cpu->core.PC = 0500;
     cpu->core.RUU &= ~RUU_RIGHT_INSTR;
     cpu->core.RUU = SET_SUPERVISOR(cpu->core.RUU, SPSW_INTERRUPT);
+    mmu_select(cpu);
 }
 
 //
@@ -1239,32 +1643,56 @@ void op_int_2(struct ElSvsProcessor *cpu)
     cpu->core.PC = 0501;
     cpu->core.RUU &= ~RUU_RIGHT_INSTR;
     cpu->core.RUU = SET_SUPERVISOR(cpu->core.RUU, SPSW_INTERRUPT);
+    mmu_select(cpu);
 }
 
 //
 // Main instruction fetch/decode loop
 //
-ElSvsStatus ElSvsSimulate(struct ElSvsProcessor *cpu)
+static ElSvsStatus simulate(struct ElSvsProcessor *cpu)
 {
-    int iintr = 0;
+    // Продолжение после останова по счётчику команд.
+    // Меняется между setjmp() и longjmp(), поэтому volatile.
+    volatile int iintr = cpu->iintr;
+
+    cpu->iintr = 0;
 
     // Трассировка начального состояния.
     if (cpu->trace_registers) {
         svs_trace_registers(cpu);
     }
 
+    // Пары команд одного слова выполняются вместе,
+    // если фильтр трассировки не проверяет каждую команду.
+    const bool fuse = cpu->fuse && ! (cpu->trace_filter_on | cpu->trace_trigger_on);
+
+    // Оттранслированный код, если нет точек останова по выполнению.
+    const struct ElSvsAot *aot = (cpu->brk_pages[ELSVS_BREAK_EXEC] ||
+        cpu->trace_filter_on || cpu->trace_trigger_on) ? NULL : cpu->aot;
+
     // Restore register state
     cpu->core.PC &= BITS(15);                            // mask PC
     mmu_setup(cpu);                                 // copy RP to TLB
+    mmu_select(cpu);                                // memory access for PSW/RUU modes
 
     // An internal interrupt or user intervention
     ElSvsStatus r = setjmp(cpu->exception);
     if (r) {
         const char *message = sim_stop_messages[r];
 
+        // Прерванная команда могла изменить любые регистры.
+        cpu->dirty = DIRTY_ALL;
+        cpu->brk_skip = false;
+
+        if (cpu->trace_armed && cpu->trace_trigger.on_exception &&
+            cpu->trace_trigger.exception == r) {
+            // Запуск трассировки по исключению.
+            svs_trace_fire(cpu);
+        }
+
         if (cpu->trace_instructions | cpu->trace_memory |
             cpu->trace_registers | cpu->trace_fetch) {
-            fprintf(cpu->log_output, "cpu%d --- %s\n",
+            svs_trace_text(cpu, "cpu%d --- %s\n",
                 cpu->index, message);
         }
         cpu->core.M[017] += cpu->corr_stack;
@@ -1287,6 +1715,7 @@ ret:        return r;
                 --cpu->core.PC;
             }
             cpu->core.RUU ^= RUU_RIGHT_INSTR;
+            cpu->brk_skip = true;
             goto ret;
         case ESS_BADCMD:
             if (cpu->core.M[PSW] & PSW_INTR_HALT)        // ПоП
@@ -1401,6 +1830,7 @@ ret:        return r;
             cpu->core.RPR |= RPR_DIVZERO|RPR_RAM_CHECK;
             break;
         }
+        cpu->stats.internal_interrupts[r]++;
         ++iintr;
     }
 
@@ -1410,6 +1840,16 @@ ret:        return r;
 
     // Main instruction fetch/decode loop
     for (;;) {
+        // Снимок, событие из журнала или останов по счётчику команд.
+        // Признак прерывания сохраняется, чтобы продолжить так же,
+        // как без останова.
+        if (cpu->icount >= cpu->point_at) {
+            cpu->iintr = iintr;
+            if (svs_replay_point(cpu))
+                return ESS_OK;
+            cpu->iintr = 0;
+        }
+
         if (cpu->core.PC > BITS(15) && IS_SUPERVISOR(cpu->core.RUU)) {
             //
             // Runaway instruction execution in supervisor mode
@@ -1418,14 +1858,11 @@ ret:        return r;
             return ESS_RUNOUT;                 // stop simulation
         }
 
-#if 0
-        //TODO: enable breakpoints.
-        if ((sim_brk_summ & SWMASK('E')) &&     // breakpoint?
-            sim_brk_test(cpu->core.PC, SWMASK('E')) &&
+        if (BRK_TEST(cpu, ELSVS_BREAK_EXEC, cpu->core.PC) &&   // breakpoint?
             ! (cpu->core.RUU & RUU_RIGHT_INSTR)) {
+            cpu->brk_skip = true;
             return ESS_IBKPT;                  // stop simulation
         }
-#endif
 
         if (! iintr && ! (cpu->core.RUU & RUU_RIGHT_INSTR) &&
             ! (cpu->core.M[PSW] & PSW_INTR_DISABLE))
@@ -1434,27 +1871,71 @@ ret:        return r;
                 // internal interrupt
                 if (cpu->trace_instructions | cpu->trace_memory |
                     cpu->trace_registers | cpu->trace_fetch) {
-                    fprintf(cpu->log_output, "cpu%d --- Внутреннее прерывание\n",
+                    svs_trace_text(cpu, "cpu%d --- Внутреннее прерывание\n",
                         cpu->index);
                 }
                 op_int_2(cpu);
             }
             if (cpu->core.GRVP & cpu->core.GRM) {
                 // external interrupt
+                uint32_t pending = cpu->core.GRVP & cpu->core.GRM;
+                int bit;
+
                 if (cpu->trace_instructions | cpu->trace_memory |
                     cpu->trace_registers | cpu->trace_fetch) {
-                    fprintf(cpu->log_output, "cpu%d --- Внешнее прерывание\n",
+                    svs_trace_text(cpu, "cpu%d --- Внешнее прерывание\n",
                         cpu->index);
                 }
+                for (bit = 0; pending; bit++, pending >>= 1) {
+                    if (pending & 1)
+                        cpu->stats.external_interrupts[bit]++;
+                }
                 op_int_2(cpu);
             }
         }
 
-        cpu_one_instr(cpu);                     // one instr
+        cpu->icount++;
+        if (aot && ! iintr && ! (cpu->core.RUU & RUU_RIGHT_INSTR) &&
+            cpu->core.PC <= BITS(15) && aot->block[cpu->core.PC])
+            aot->block[cpu->core.PC](cpu, &svs_aot_runtime); // translated block
+        else if (fuse && ! iintr && ! (cpu->core.RUU & RUU_RIGHT_INSTR) &&
+            cpu->icount < cpu->point_at)
+            cpu_one_word(cpu);                  // both instructions of the word
+        else
+            cpu_one_instr(cpu);                 // one instr
         iintr = 0;
+        cpu->brk_skip = false;
     }
 }
 
+ElSvsStatus ElSvsSimulate(struct ElSvsProcessor *cpu)
+{
+    ElSvsStatus r = simulate(cpu);
+
+    // Двоичная трасса дописывается в файл при каждом выходе,
+    // чтобы хост мог завершиться без закрытия трассировки.
+    if (cpu->trace_buf)
+        svs_trace_flush(cpu);
+
+    switch (r) {
+    case ESS_OK:
+    case ESS_HALT:
+    case ESS_IBKPT:
+    case ESS_RWATCH:
+    case ESS_WWATCH:
+    case ESS_INSN_ADDR_MATCH:
+    case ESS_LOAD_ADDR_MATCH:
+    case ESS_STORE_ADDR_MATCH:
+        // Нормальный останов.
+        break;
+    default:
+        // Аварийный останов: выдаём последние команды.
+        svs_trace_flight(cpu);
+        break;
+    }
+    return r;
+}
+
 //
 // A 250 Hz clock as per the original documentation,
 // and matching the available software binaries.
@@ -1465,8 +1946,19 @@ void cpu_activate_timer(struct ElSvsProcessor *cpu)
 {
     if (cpu->trace_instructions | cpu->trace_memory |
         cpu->trace_registers | cpu->trace_fetch) {
-        fprintf(cpu->log_output, "---- --- Timer\n");
+        svs_trace_text(cpu, "---- --- Timer\n");
     }
 
     cpu->core.GRVP |= GRVP_TIMER;
 }
+
+//
+// Timer interrupt, by host.
+// When recording, it is written to the log.
+//
+void ElSvsTimerInterrupt(struct ElSvsProcessor *cpu)
+{
+    if (cpu->replay && ! svs_replay_input(cpu, REPLAY_TIMER, 0, 0))
+        return;
+    cpu_activate_timer(cpu);
+}
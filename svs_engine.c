@@ -0,0 +1,154 @@
+/*
+ * Execution engines of the processor.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+//
+// Пошаговое выполнение: останов и продолжение после каждой команды.
+// Проверяет, что останов по счётчику не влияет на результат.
+//
+static ElSvsStatus run_stepwise(struct ElSvsProcessor *cpu, uint64_t n)
+{
+    ElSvsStatus r = ESS_OK;
+
+    while (n-- > 0 && r == ESS_OK)
+        r = ElSvsStep(cpu, 1);
+    return r;
+}
+
+//
+// Выполнение обеих команд слова вместе, с обработчиками частых пар.
+//
+static ElSvsStatus run_fused(struct ElSvsProcessor *cpu, uint64_t n)
+{
+    cpu->fuse = true;
+    ElSvsStatus r = ElSvsStep(cpu, n);
+    cpu->fuse = false;
+    return r;
+}
+
+//
+// Выполнение из кода, оттранслированного заранее.  При первом вызове
+// для процессора все слова команд памяти транслируются и собираются
+// в разделяемый объект; код, изменённый позже, интерпретируется.
+//
+static ElSvsStatus run_aot(struct ElSvsProcessor *cpu, uint64_t n)
+{
+    if (! cpu->aot) {
+        unsigned entry = cpu->core.PC;
+
+        if (! svs_aot_build(cpu, "engine", &entry, 1, true))
+            return ESS_UNIMPLEMENTED;
+    }
+    return ElSvsStep(cpu, n);
+}
+
+//
+// Механизмы выполнения.  Первый - эталонный.
+//
+const struct ElSvsEngine svs_engines[] = {
+    { "reference",  "simulate() with cpu_one_instr()",  ElSvsStep },
+    { "stepwise",   "stop and resume after every instruction", run_stepwise },
+    { "fused",      "pairs of instructions in a word as one step", run_fused },
+    { "aot",        "blocks translated ahead of time, built on first run", run_aot },
+    { NULL },
+};
+
+//
+// Найти механизм по имени.
+//
+const struct ElSvsEngine *svs_engine_find(const char *name)
+{
+    const struct ElSvsEngine *e;
+
+    for (e = svs_engines; e->name; e++) {
+        if (strcmp(e->name, name) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+//
+// Описание расхождения значений.
+//
+static bool differ(char *what, size_t size, const char *name, int index,
+                   uint64_t value, uint64_t expect)
+{
+    if (index >= 0)
+        snprintf(what, size, "%s%o = %llo, expected %llo", name, index,
+                 (unsigned long long) value, (unsigned long long) expect);
+    else
+        snprintf(what, size, "%s = %llo, expected %llo", name,
+                 (unsigned long long) value, (unsigned long long) expect);
+    return false;
+}
+
+//
+// Сравнение состояния процессоров.
+// Возвращает false и описание первого расхождения, a - эталон.
+//
+bool svs_engine_compare(const struct ElSvsProcessor *a, const struct ElSvsProcessor *b,
+                        char *what, size_t size)
+{
+    unsigned i;
+
+#define CHECK(field, name, index) \
+    if (a->field != b->field) \
+        return differ(what, size, name, index, b->field, a->field)
+
+    CHECK(core.PC, "PC", -1);
+    CHECK(core.RUU, "RUU", -1);
+    CHECK(core.RAU, "RAU", -1);
+    CHECK(core.ACC, "ACC", -1);
+    CHECK(core.RMR, "RMR", -1);
+    for (i = 0; i < SVS_NREGS; i++) {
+        CHECK(core.M[i], "M", i);
+    }
+    for (i = 0; i < 8; i++) {
+        CHECK(core.RP[i], "RP", i);
+        CHECK(core.RPS[i], "RPS", i);
+    }
+    for (i = 0; i < 32; i++) {
+        CHECK(UTLB[i], "UTLB", i);
+        CHECK(STLB[i], "STLB", i);
+    }
+    CHECK(core.RZ, "RZ", -1);
+    CHECK(core.TagR, "TAG", -1);
+    CHECK(core.RPR, "RPR", -1);
+    CHECK(core.GRVP, "GRVP", -1);
+    CHECK(core.GRM, "GRM", -1);
+    CHECK(core.PP, "PP", -1);
+    CHECK(core.OPP, "OPP", -1);
+    CHECK(core.POP, "POP", -1);
+    CHECK(core.OPOP, "OPOP", -1);
+    CHECK(core.RKP, "RKP", -1);
+    CHECK(core.bad_addr, "EADDR", -1);
+    CHECK(RK, "RK", -1);
+    CHECK(Aex, "Aex", -1);
+    CHECK(icount, "icount", -1);
+#undef CHECK
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * Extracodes, implemented on the host side.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+#include <math.h>
+
+//
+// Э50: элементарные функции, как в Диспаке.
+// Аргумент и результат на сумматоре.
+// При выходе из области определения экстракод выполняется
+// программой ОС, которая выдаёт диагностику.
+//
+ElSvsStatus ElSvsExtracodeMath(struct ElSvsProcessor *cpu, unsigned addr)
+{
+    double x = svs_to_ieee(cpu->core.ACC);
+
+    switch (addr) {
+    case 070:                                       // корень
+        if (x < 0)
+            return ESS_UNIMPLEMENTED;
+        x = sqrt(x);
+        break;
+    case 071:                                       // синус
+        x = sin(x);
+        break;
+    case 072:                                       // косинус
+        x = cos(x);
+        break;
+    case 073:                                       // арктангенс
+        x = atan(x);
+        break;
+    case 074:                                       // арксинус
+        if (x < -1 || x > 1)
+            return ESS_UNIMPLEMENTED;
+        x = asin(x);
+        break;
+    case 075:                                       // логарифм
+        if (x <= 0)
+            return ESS_UNIMPLEMENTED;
+        x = log(x);
+        break;
+    case 076:                                       // экспонента
+        if (x > 43)
+            return ESS_UNIMPLEMENTED;               // переполнение
+        x = exp(x);
+        break;
+    case 077:                                       // целая часть
+        x = floor(x);
+        break;
+    default:
+        // Прочие функции э50 выполняются программой.
+        return ESS_UNIMPLEMENTED;
+    }
+    cpu->core.ACC = (x == 0) ? 0 : ieee_to_svs(x);
+    cpu->core.RAU = SET_ADDITIVE(cpu->core.RAU);
+    return ESS_OK;
+}
+
+//
+// Install built-in host extracodes.
+//
+void ElSvsSetHostExtracodes(struct ElSvsProcessor *cpu)
+{
+    ElSvsSetExtracode(cpu, 050, ElSvsExtracodeMath);
+}
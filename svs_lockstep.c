@@ -0,0 +1,355 @@
+/*
+ * Lockstep comparison of the simulator against a reference trace.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "el_master_api.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <string.h>
+
+//
+// Регистры, изменение которых всегда попадает в трассу.
+// Если симулятор изменил такой регистр, а в трассе записи нет,
+// это расхождение.
+//
+#define CHECK_ACC       (1ULL << 36)
+#define CHECK_RMR       (1ULL << 37)
+#define CHECK_RAU       (1ULL << 38)
+#define CHECK_RUU       (1ULL << 39)
+#define CHECK_M(n)      (1ULL << (n))
+
+//
+// Состояние сравнения.
+//
+struct lockstep {
+    struct ElSvsProcessor *cpu;
+    ElSvsLockstepResult *result;
+    struct ElSvsCoreState before;       // регистры до команды
+    uint64_t reported;                  // изменения из трассы, CHECK_xxx
+    bool stepped;                       // выполнена хотя бы одна команда
+};
+
+//
+// Запомнить расхождение.
+//
+static bool diverge(struct lockstep *ls, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(ls->result->message, sizeof(ls->result->message), fmt, ap);
+    va_end(ap);
+    return false;
+}
+
+//
+// Пропустить префикс "cpuN" и пробелы.
+//
+static const char *skip_prefix(const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (strncmp(p, "cpu", 3) == 0 && isdigit((unsigned char) p[3])) {
+        p += 3;
+        while (isdigit((unsigned char) *p))
+            p++;
+    }
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+//
+// Восьмеричное значение, записанное группами цифр через пробел.
+// Группы выровнены по границам разрядов, кратным трём,
+// поэтому цифры просто сцепляются.
+//
+static bool parse_octal(const char *p, uint64_t *value)
+{
+    unsigned ndigits = 0;
+
+    *value = 0;
+    for (; *p && *p != '\n'; p++) {
+        if (*p >= '0' && *p <= '7') {
+            *value = (*value << 3) | (*p - '0');
+            ndigits++;
+        } else if (*p != ' ' && *p != '\t' && *p != '\r') {
+            return false;
+        }
+    }
+    return ndigits > 0;
+}
+
+//
+// Значение регистра по имени из трассы.
+// Для регистров, изменение которых проверяется, выдаётся признак CHECK_xxx.
+//
+static bool get_register(const struct ElSvsCoreState *core, const char *name,
+                         uint64_t *value, uint64_t *check)
+{
+    unsigned n;
+    char c;
+
+    *check = 0;
+    if (sscanf(name, "M%o%c", &n, &c) == 1 && n < SVS_NREGS) {
+        *value = core->M[n];
+        *check = CHECK_M(n);
+    } else if (sscanf(name, "RPS%o%c", &n, &c) == 1 && n < 8) {
+        *value = core->RPS[n];
+    } else if (sscanf(name, "RP%o%c", &n, &c) == 1 && n < 8) {
+        *value = core->RP[n];
+    } else if (strcmp(name, "ACC") == 0) {
+        *value = core->ACC;
+        *check = CHECK_ACC;
+    } else if (strcmp(name, "RMR") == 0) {
+        *value = core->RMR;
+        *check = CHECK_RMR;
+    } else if (strcmp(name, "RAU") == 0) {
+        *value = core->RAU;
+        *check = CHECK_RAU;
+    } else if (strcmp(name, "RUU") == 0) {
+        *value = core->RUU;
+        *check = CHECK_RUU;
+    } else if (strcmp(name, "RZ") == 0) {
+        *value = core->RZ;
+    } else if (strcmp(name, "EADDR") == 0) {
+        *value = core->bad_addr;
+    } else if (strcmp(name, "TAG") == 0) {
+        *value = core->TagR;
+    } else if (strcmp(name, "PP") == 0) {
+        *value = core->PP;
+    } else if (strcmp(name, "OPP") == 0) {
+        *value = core->OPP;
+    } else if (strcmp(name, "POP") == 0) {
+        *value = core->POP;
+    } else if (strcmp(name, "OPOP") == 0) {
+        *value = core->OPOP;
+    } else if (strcmp(name, "RKP") == 0) {
+        *value = core->RKP;
+    } else if (strcmp(name, "RPR") == 0) {
+        *value = core->RPR;
+    } else if (strcmp(name, "GRVP") == 0) {
+        *value = core->GRVP;
+    } else if (strcmp(name, "GRM") == 0) {
+        *value = core->GRM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+//
+// Конец команды: регистры, изменённые симулятором,
+// должны быть упомянуты в трассе.
+//
+static bool check_unreported(struct lockstep *ls)
+{
+    const struct ElSvsCoreState *now = &ls->cpu->core;
+    const struct ElSvsCoreState *was = &ls->before;
+    unsigned i;
+
+    if (! ls->stepped)
+        return true;
+    if (now->ACC != was->ACC && ! (ls->reported & CHECK_ACC))
+        return diverge(ls, "ACC changed to %016llo, not in trace",
+                       (unsigned long long) now->ACC);
+    if (now->RMR != was->RMR && ! (ls->reported & CHECK_RMR))
+        return diverge(ls, "RMR changed to %016llo, not in trace",
+                       (unsigned long long) now->RMR);
+    if (now->RAU != was->RAU && ! (ls->reported & CHECK_RAU))
+        return diverge(ls, "RAU changed to %02o, not in trace", now->RAU);
+    if ((now->RUU & ~RUU_RIGHT_INSTR) != (was->RUU & ~RUU_RIGHT_INSTR) &&
+        ! (ls->reported & CHECK_RUU))
+        return diverge(ls, "RUU changed to %03o, not in trace", now->RUU);
+    for (i = 0; i < SVS_NREGS; i++) {
+        if (now->M[i] != was->M[i] && ! (ls->reported & CHECK_M(i)))
+            return diverge(ls, "M%o changed to %05o, not in trace", i, now->M[i]);
+    }
+    return true;
+}
+
+//
+// Команда из трассы: "VVVVV PPPPPPP L: код мнемоника".
+// Выполняем одну команду и сравниваем адрес, половину слова и код.
+//
+static bool check_instruction(struct lockstep *ls, unsigned vaddr, unsigned paddr,
+                              char half, const char *code)
+{
+    struct ElSvsProcessor *cpu = ls->cpu;
+    unsigned reg, op, addr;
+    int n1, n2;
+
+    // Код команды, как печатает svs_fprint_insn():
+    // длинный формат с двузначным кодом операции, короткий с трёхзначным.
+    if (sscanf(code, "%o %n%o%n %o", &reg, &n1, &op, &n2, &addr) != 3)
+        return diverge(ls, "bad instruction record");
+    uint32_t insn = (n2 - n1 == 2) ? (reg << 20 | op << 15 | addr)
+                                   : (reg << 20 | op << 12 | addr);
+
+    if (! check_unreported(ls))
+        return false;
+
+    ls->before = cpu->core;
+    ls->reported = 0;
+    ls->stepped = true;
+
+    unsigned count = cpu->flight_count;
+    ElSvsStatus status = ElSvsStep(cpu, 1);
+    if (cpu->flight_count == count)
+        return diverge(ls, "simulator stopped before %05o %c: status %d",
+                       vaddr, half, status);
+
+    const struct ElSvsFlight *f = &cpu->flight[(cpu->flight_count - 1) % SVS_FLIGHT_SIZE];
+    char fhalf = f->right ? 'R' : 'L';
+    ls->result->instructions++;
+    if (f->PC != vaddr || fhalf != half || f->RK != insn)
+        return diverge(ls, "executed %05o %c: %08o, expected %05o %c: %08o",
+                       f->PC, fhalf, f->RK, vaddr, half, insn);
+    if (f->paddr != paddr)
+        return diverge(ls, "instruction %05o at physical %07o, expected %07o",
+                       vaddr, f->paddr, paddr);
+    return true;
+}
+
+//
+// Изменение регистра: "Write ИМЯ = значение".
+//
+static bool check_register(struct lockstep *ls, const char *p)
+{
+    char name[16];
+    int n;
+    uint64_t expect, value, check;
+
+    if (sscanf(p, "%15s = %n", name, &n) != 1 || ! parse_octal(p + n, &expect))
+        return diverge(ls, "bad register record");
+    if (! get_register(&ls->cpu->core, name, &value, &check)) {
+        // Регистр, которого нет в симуляторе.
+        return true;
+    }
+    ls->reported |= check;
+    if (value != expect)
+        return diverge(ls, "%s = %llo, expected %llo", name,
+                       (unsigned long long) value, (unsigned long long) expect);
+    return true;
+}
+
+//
+// Запись в память: "Memory Write [VVVVV PPPPPPP] = TT:значение".
+// Слово из 64 разрядов печатается как старшие 48 разрядов,
+// двоеточие и младшие 16 разрядов двумя группами.
+//
+static bool check_memory(struct lockstep *ls, const char *p)
+{
+    unsigned vaddr, paddr, tag, lo4, lo12;
+    int n;
+    uint64_t expect;
+    ElMasterTag mtag;
+    ElMasterWord word;
+    char text[128];
+
+    if (sscanf(p, "[%o %o] = %o:%n", &vaddr, &paddr, &tag, &n) != 3)
+        return diverge(ls, "bad memory record");
+    snprintf(text, sizeof(text), "%s", p + n);
+
+    char *lo = strchr(text, ':');
+    if (lo) {
+        // 64-битное слово.
+        *lo++ = 0;
+        if (! parse_octal(text, &expect) || sscanf(lo, "%o %o", &lo4, &lo12) != 2)
+            return diverge(ls, "bad memory record");
+        expect = expect << 16 | lo4 << 12 | lo12;
+    } else {
+        if (! parse_octal(text, &expect))
+            return diverge(ls, "bad memory record");
+        expect <<= 16;
+    }
+    if (elMasterRamWordRead(paddr, &mtag, &word) != EMS_OK)
+        return diverge(ls, "cannot read memory at %07o", paddr);
+    if (lo == NULL)
+        word &= ~(ElMasterWord) 0xffff;
+    if (word != expect || mtag != tag)
+        return diverge(ls, "memory [%07o] = %02o:%016llo, expected %02o:%016llo",
+                       paddr, mtag, (unsigned long long) (word >> 16),
+                       tag, (unsigned long long) (expect >> 16));
+    return true;
+}
+
+//
+// Разбор одной строки трассы.  Строки других видов пропускаются.
+//
+static bool check_line(struct lockstep *ls, const char *line)
+{
+    const char *p = skip_prefix(line);
+    unsigned vaddr, paddr;
+    char half;
+    int n;
+
+    if (strncmp(p, "Write ", 6) == 0)
+        return check_register(ls, p + 6);
+    if (strncmp(p, "Memory Write ", 13) == 0)
+        return check_memory(ls, p + 13);
+    if (sscanf(p, "%o %o %c: %n", &vaddr, &paddr, &half, &n) == 3 &&
+        (half == 'L' || half == 'R'))
+        return check_instruction(ls, vaddr, paddr, half, p + n);
+    return true;
+}
+
+//
+// Run the processor in lockstep with a reference trace.
+//
+bool ElSvsLockstep(struct ElSvsProcessor *cpu, FILE *trace, ElSvsLockstepResult *result)
+{
+    struct lockstep ls = { .cpu = cpu, .result = result };
+    char line[1024];
+    bool ok = true;
+
+    memset(result, 0, sizeof(*result));
+    while (fgets(line, sizeof(line), trace)) {
+        size_t len = strlen(line);
+
+        result->line++;
+        if (! check_line(&ls, line)) {
+            ok = false;
+            break;
+        }
+
+        // Остаток слишком длинной строки пропускаем.
+        if (len > 0 && line[len-1] != '\n') {
+            int c;
+            while ((c = getc(trace)) != EOF && c != '\n')
+                continue;
+        }
+    }
+    if (ok && ! check_unreported(&ls)) {
+        ok = false;
+    }
+    if (ok && ferror(trace)) {
+        diverge(&ls, "read error");
+        ok = false;
+    }
+    if (ok) {
+        result->line = 0;
+    }
+    return ok;
+}
@@ -25,11 +25,22 @@
 #include "el_svs_api.h"
 #include "el_svs_internal.h"
 
-static void mmu_protection_check(struct ElSvsProcessor *cpu, int vaddr)
+//
+// Режим работы памяти, в котором выбран вариант доступа.
+// Проверки режимов вычисляются при компиляции каждого варианта,
+// а не при каждом обращении.
+//
+#define MMU_MAPPED      1       // приписка работает
+#define MMU_PROTECT     2       // защита включена
+#define MMU_SUPERVISOR  4       // режим супервизора
+#define MMU_WRITE_WATCH 8       // ЗПСЧ по записи, иначе по чтению
+
+static inline __attribute__((always_inline))
+void mmu_protection_check(struct ElSvsProcessor *cpu, int vaddr, const unsigned mode)
 {
     // Защита блокируется в режиме супервизора для физических (!) адресов 1-7 (ТО-8) - WTF?
-    int tmp_prot_disabled = (cpu->core.M[PSW] & PSW_PROT_DISABLE) ||
-        (IS_SUPERVISOR(cpu->core.RUU) && (cpu->core.M[PSW] & PSW_MMAP_DISABLE) && vaddr < 010);
+    int tmp_prot_disabled = !(mode & MMU_PROTECT) ||
+        ((mode & MMU_SUPERVISOR) && !(mode & MMU_MAPPED) && vaddr < 010);
 
     // Защита не заблокирована, а лист закрыт
     if (! tmp_prot_disabled && (cpu->core.RZ & (1 << (vaddr >> 10)))) {
@@ -43,18 +54,19 @@ static void mmu_protection_check(struct ElSvsProcessor *cpu, int vaddr)
 //
 // Трансляция виртуального адреса в физический.
 //
-static int va_to_pa(struct ElSvsProcessor *cpu, int vaddr)
+static inline __attribute__((always_inline))
+int va_to_pa(struct ElSvsProcessor *cpu, int vaddr, const unsigned mode)
 {
     int paddr;
 
-    if (cpu->core.M[PSW] & PSW_MMAP_DISABLE) {
+    if (!(mode & MMU_MAPPED)) {
         // Приписка отключена.
         paddr = vaddr;
     } else {
         // Приписка работает.
         int vpage    = vaddr >> 10;
         int offset   = vaddr & BITS(10);
-        int physpage = IS_SUPERVISOR(cpu->core.RUU) ?
+        int physpage = (mode & MMU_SUPERVISOR) ?
                        cpu->STLB[vpage] : cpu->UTLB[vpage];
 
         paddr = (physpage << 10) | offset;
@@ -66,21 +78,34 @@ static int va_to_pa(struct ElSvsProcessor *cpu, int vaddr)
 // Запись слова и тега в память по виртуальному адресу.
 // Возвращает физический адрес слова.
 //
-static int mmu_store_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t val64, uint8_t t)
+static inline __attribute__((always_inline))
+int mmu_store_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t val64, uint8_t t,
+                       const unsigned mode)
 {
+    cpu->stats.stores++;
+    cpu->refetch = true;
     vaddr &= BITS(15);
+    if (cpu->trace_armed && cpu->trace_trigger.on_write &&
+        cpu->trace_trigger.write_addr == vaddr) {
+        // Запуск трассировки по записи в память.
+        svs_trace_fire(cpu);
+    }
     if (vaddr == 0)
         return 0;
 
-    mmu_protection_check(cpu, vaddr);
+    mmu_protection_check(cpu, vaddr, mode);
+
+    // Точка останова по записи.
+    if (BRK_TEST(cpu, ELSVS_BREAK_WRITE, vaddr))
+        longjmp(cpu->exception, ESS_WWATCH);
 
     // Различаем адреса с припиской и без
-    if (cpu->core.M[PSW] & PSW_MMAP_DISABLE) {
+    if (!(mode & MMU_MAPPED)) {
         // Приписка отключена.
         if (vaddr < 010) {
             // Игнорируем запись в тумблерные регистры.
             if (cpu->trace_instructions | cpu->trace_memory | cpu->trace_registers) {
-                fprintf(cpu->log_output, "cpu%d --- Ignore write to pult register %d\n",
+                svs_trace_text(cpu, "cpu%d --- Ignore write to pult register %d\n",
                     cpu->index, vaddr);
             }
             return 0;
@@ -88,20 +113,16 @@ static int mmu_store_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t va
     } else {
         // Приписка работает.
         // ЗПСЧ: ЗП
-        if (cpu->core.M[DWP] == vaddr && (cpu->core.M[PSW] & PSW_WRITE_WATCH))
+        if ((mode & MMU_WRITE_WATCH) && cpu->core.M[DWP] == vaddr)
             longjmp(cpu->exception, ESS_STORE_ADDR_MATCH);
-#if 0
-        // Точка останова по записи.
-        if (sim_brk_summ & SWMASK('W') &&
-            sim_brk_test(vaddr, SWMASK('W')))
-            longjmp(cpu->exception, ESS_WWATCH);
-#endif
     }
 
     // Вычисляем физический адрес.
-    int paddr = va_to_pa(cpu, vaddr);
+    int paddr = va_to_pa(cpu, vaddr, mode);
 
     // Пишем в память.
+    if (cpu->shadow_log)
+        svs_shadow_write(cpu, paddr, t, val64);
     elMasterRamWordWrite(paddr, t, val64);
 
     return paddr;
@@ -110,7 +131,8 @@ static int mmu_store_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t va
 //
 // Запись 48-битного слова в память.
 //
-void mmu_store(struct ElSvsProcessor *cpu, int vaddr, uint64_t val)
+static inline __attribute__((always_inline))
+void mmu_store_mode(struct ElSvsProcessor *cpu, int vaddr, uint64_t val, const unsigned mode)
 {
     // Вычисляем тег.
     // Если ПКП=0 и ПКЛ=0, то тег 35 (команда),
@@ -118,42 +140,33 @@ void mmu_store(struct ElSvsProcessor *cpu, int vaddr, uint64_t val)
     uint8_t t = (cpu->core.RUU & (RUU_CHECK_RIGHT | RUU_CHECK_LEFT)) ?
         TAG_NUMBER48 : TAG_INSN48;
 
-    int paddr = mmu_store_with_tag(cpu, vaddr, val << 16, t);
+    int paddr = mmu_store_with_tag(cpu, vaddr, val << 16, t, mode);
 
-    if (paddr != 0 && cpu->trace_memory) {
-        fprintf(cpu->log_output, "cpu%d       Memory Write [%05o %07o] = %02o:",
-            cpu->index, vaddr, paddr, t);
-        svs_fprint_48bits(cpu->log_output, val);
-        fprintf(cpu->log_output, "\n");
-    }
+    if (paddr != 0 && cpu->trace_memory)
+        svs_trace_memory(cpu, TRACE_WRITE, vaddr, paddr, t, val);
 }
 
 //
 // Запись 64-битного слова в память.
 //
-void mmu_store64(struct ElSvsProcessor *cpu, int vaddr, uint64_t val64)
+static inline __attribute__((always_inline))
+void mmu_store64_mode(struct ElSvsProcessor *cpu, int vaddr, uint64_t val64, const unsigned mode)
 {
-    int paddr = mmu_store_with_tag(cpu, vaddr, val64, cpu->core.TagR);
-
-    if (paddr != 0 && cpu->trace_memory) {
-        fprintf(cpu->log_output, "cpu%d       Memory Write [%05o %07o] = %02o:",
-            cpu->index, vaddr, paddr, cpu->core.TagR);
-        fprintf(cpu->log_output, "%04o %04o %04o %04o:%02o %04o\n",
-            (int) (val64 >> 52) & 07777,
-            (int) (val64 >> 40) & 07777,
-            (int) (val64 >> 28) & 07777,
-            (int) (val64 >> 16) & 07777,
-            (int) (val64 >> 12) & 017,
-            (int) val64 & 07777);
-    }
+    int paddr = mmu_store_with_tag(cpu, vaddr, val64, cpu->core.TagR, mode);
+
+    if (paddr != 0 && cpu->trace_memory)
+        svs_trace_memory(cpu, TRACE_WRITE64, vaddr, paddr, cpu->core.TagR, val64);
 }
 
 //
 // Чтение операнда и тега из памяти по виртуальному адресу.
 // Возвращает физический адрес слова.
 //
-static int mmu_load_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t *val64, uint8_t *t)
+static inline __attribute__((always_inline))
+int mmu_load_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t *val64, uint8_t *t,
+                      const unsigned mode)
 {
+    cpu->stats.loads++;
     vaddr &= BITS(15);
     if (vaddr == 0) {
         *val64 = 0;
@@ -161,26 +174,24 @@ static int mmu_load_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t *va
         return 0;
     }
 
-    mmu_protection_check(cpu, vaddr);
+    mmu_protection_check(cpu, vaddr, mode);
+
+    // Точка останова по считыванию.
+    if (BRK_TEST(cpu, ELSVS_BREAK_READ, vaddr))
+        longjmp(cpu->exception, ESS_RWATCH);
 
     // Различаем адреса с припиской и без
-    if (cpu->core.M[PSW] & PSW_MMAP_DISABLE) {
+    if (!(mode & MMU_MAPPED)) {
         // Приписка отключена.
     } else {
         // Приписка работает.
         // ЗПСЧ: СЧ
-        if (cpu->core.M[DWP] == vaddr && !(cpu->core.M[PSW] & PSW_WRITE_WATCH))
+        if (!(mode & MMU_WRITE_WATCH) && cpu->core.M[DWP] == vaddr)
             longjmp(cpu->exception, ESS_LOAD_ADDR_MATCH);
-#if 0
-        // Точка останова по считыванию.
-        if (sim_brk_summ & SWMASK('R') &&
-            sim_brk_test(vaddr, SWMASK('R')))
-            longjmp(cpu->exception, ESS_RWATCH);
-#endif
     }
 
     // Вычисляем физический адрес слова
-    int paddr = va_to_pa(cpu, vaddr);
+    int paddr = va_to_pa(cpu, vaddr, mode);
 
     if (paddr >= 010) {
         // Из памяти
@@ -197,31 +208,21 @@ static int mmu_load_with_tag(struct ElSvsProcessor *cpu, int vaddr, uint64_t *va
 // Чтение 64-битного операнда.
 // Тег попадает в регистр тега.
 //
-uint64_t mmu_load64(struct ElSvsProcessor *cpu, int vaddr, int tag_check)
+static inline __attribute__((always_inline))
+uint64_t mmu_load64_mode(struct ElSvsProcessor *cpu, int vaddr, int tag_check, const unsigned mode)
 {
     uint64_t val64;
     uint8_t t;
-    int paddr = mmu_load_with_tag(cpu, vaddr, &val64, &t);
-
-    if (paddr != 0 && cpu->trace_memory) {
-        if (paddr < 010)
-            fprintf(cpu->log_output, "cpu%d       Read  TR%o = ", cpu->index, paddr);
-        else
-            fprintf(cpu->log_output, "cpu%d       Memory Read [%05o %07o] = %02o:",
-                cpu->index, vaddr, paddr, t);
-        fprintf(cpu->log_output, "%04o %04o %04o %04o:%02o %04o\n",
-            (int) (val64 >> 52) & 07777,
-            (int) (val64 >> 40) & 07777,
-            (int) (val64 >> 28) & 07777,
-            (int) (val64 >> 16) & 07777,
-            (int) (val64 >> 12) & 017,
-            (int) val64 & 07777);
-    }
+    int paddr = mmu_load_with_tag(cpu, vaddr, &val64, &t, mode);
+
+    if (paddr != 0 && cpu->trace_memory)
+        svs_trace_memory(cpu, TRACE_READ64, vaddr, paddr, t, val64);
 
     // Прерывание (контроль числа), если попалось 48-битное слово.
     if (tag_check && IS_48BIT(t) /*&& (mmu_unit.flags & CHECK_ENB)*/) {
         cpu->core.bad_addr = paddr & 7;
-        printf("--- (%05o) контроль числа", paddr);
+        if (cpu->trace_exceptions)
+            printf("--- (%05o) контроль числа", paddr);
         longjmp(cpu->exception, ESS_RAM_CHECK);
     }
 
@@ -232,28 +233,23 @@ uint64_t mmu_load64(struct ElSvsProcessor *cpu, int vaddr, int tag_check)
 //
 // Чтение 48-битного операнда.
 //
-uint64_t mmu_load(struct ElSvsProcessor *cpu, int vaddr)
+static inline __attribute__((always_inline))
+uint64_t mmu_load_mode(struct ElSvsProcessor *cpu, int vaddr, const unsigned mode)
 {
     uint64_t val;
     uint8_t t;
-    int paddr = mmu_load_with_tag(cpu, vaddr, &val, &t);
+    int paddr = mmu_load_with_tag(cpu, vaddr, &val, &t, mode);
 
     val >>= 16;
-    if (paddr != 0 && cpu->trace_memory) {
-        if (paddr < 010)
-            fprintf(cpu->log_output, "cpu%d       Read  TR%o = ", cpu->index, paddr);
-        else
-            fprintf(cpu->log_output, "cpu%d       Memory Read [%05o %07o] = %02o:",
-                cpu->index, vaddr, paddr, t);
-        svs_fprint_48bits(cpu->log_output, val);
-        fprintf(cpu->log_output, "\n");
-    }
+    if (paddr != 0 && cpu->trace_memory)
+        svs_trace_memory(cpu, TRACE_READ, vaddr, paddr, t, val);
 
     // Прерывание (контроль числа), если попалось 64-битное слово.
     // На тумблерных регистрах контроля числа не бывает.
     if (paddr >= 010 && ! IS_48BIT(t) /*&& (mmu_unit.flags & CHECK_ENB)*/) {
         cpu->core.bad_addr = paddr & 7;
-        printf("--- (%05o) контроль числа", paddr);
+        if (cpu->trace_exceptions)
+            printf("--- (%05o) контроль числа", paddr);
         longjmp(cpu->exception, ESS_RAM_CHECK);
     }
 
@@ -261,10 +257,11 @@ uint64_t mmu_load(struct ElSvsProcessor *cpu, int vaddr)
     return val & BITS48;
 }
 
-static void mmu_fetch_check(struct ElSvsProcessor *cpu, int vaddr)
+static inline __attribute__((always_inline))
+void mmu_fetch_check(struct ElSvsProcessor *cpu, int vaddr, const unsigned mode)
 {
     // В режиме супервизора защиты нет
-    if (! IS_SUPERVISOR(cpu->core.RUU)) {
+    if (!(mode & MMU_SUPERVISOR)) {
         int page = cpu->UTLB[vaddr >> 10];
         //
         // Для команд в режиме пользователя признак защиты -
@@ -282,25 +279,27 @@ static void mmu_fetch_check(struct ElSvsProcessor *cpu, int vaddr)
 //
 // Выборка команды
 //
-uint64_t mmu_fetch(struct ElSvsProcessor *cpu, int vaddr, int *paddrp)
+static inline __attribute__((always_inline))
+uint64_t mmu_fetch_mode(struct ElSvsProcessor *cpu, int vaddr, int *paddrp, const unsigned mode)
 {
     uint64_t val;
     uint8_t t;
 
+    cpu->stats.fetches++;
     if (vaddr == 0) {
         if (cpu->trace_exceptions)
             printf("--- передача управления на 0");
         longjmp(cpu->exception, ESS_INSN_CHECK);
     }
 
-    mmu_fetch_check(cpu, vaddr);
+    mmu_fetch_check(cpu, vaddr, mode);
 
     // КРА
-    if (cpu->core.M[IBP] == vaddr && ! IS_SUPERVISOR(cpu->core.RUU))
+    if (!(mode & MMU_SUPERVISOR) && cpu->core.M[IBP] == vaddr)
         longjmp(cpu->exception, ESS_INSN_ADDR_MATCH);
 
     // Вычисляем физический адрес слова
-    int paddr = IS_SUPERVISOR(cpu->core.RUU) ? vaddr : va_to_pa(cpu, vaddr);
+    int paddr = (mode & MMU_SUPERVISOR) ? vaddr : va_to_pa(cpu, vaddr, mode);
 
     if (paddr >= 010) {
         // Из памяти
@@ -315,17 +314,14 @@ uint64_t mmu_fetch(struct ElSvsProcessor *cpu, int vaddr, int *paddrp)
 
     if (cpu->trace_fetch && !(cpu->core.RUU & RUU_RIGHT_INSTR)) {
         // Print the fetch information.
-        fprintf(cpu->log_output, "cpu%d       Fetch [%05o %07o] = %o:",
-            cpu->index, vaddr, paddr, t);
-        svs_fprint_insn(cpu->log_output, (val >> 24) & BITS(24));
-        svs_fprint_insn(cpu->log_output, val & BITS(24));
-        fprintf(cpu->log_output, "\n");
+        svs_trace_memory(cpu, TRACE_FETCH, vaddr, paddr, t, val);
     }
 
     // Прерывание (контроль команды), если попалась не 48-битная команда.
     // Тумблерные регистры только с командной сверткой.
     if (paddr >= 010 && ! IS_INSN48(t)) {
-        printf("--- (%05o) контроль команды", vaddr);
+        if (cpu->trace_exceptions)
+            printf("--- (%05o) контроль команды", vaddr);
         longjmp(cpu->exception, ESS_INSN_CHECK);
     }
 
@@ -333,6 +329,55 @@ uint64_t mmu_fetch(struct ElSvsProcessor *cpu, int vaddr, int *paddrp)
     return val & BITS48;
 }
 
+//
+// Варианты доступа к памяти для всех сочетаний режимов.
+//
+#define MMU_MODES(X) \
+    X(0)  X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7) \
+    X(8)  X(9)  X(10) X(11) X(12) X(13) X(14) X(15)
+
+#define MMU_ACCESS(m) \
+    static uint64_t mmu_load_##m(struct ElSvsProcessor *cpu, int vaddr) \
+        { return mmu_load_mode(cpu, vaddr, m); } \
+    static uint64_t mmu_load64_##m(struct ElSvsProcessor *cpu, int vaddr, int tag_check) \
+        { return mmu_load64_mode(cpu, vaddr, tag_check, m); } \
+    static void mmu_store_##m(struct ElSvsProcessor *cpu, int vaddr, uint64_t val) \
+        { mmu_store_mode(cpu, vaddr, val, m); } \
+    static void mmu_store64_##m(struct ElSvsProcessor *cpu, int vaddr, uint64_t val64) \
+        { mmu_store64_mode(cpu, vaddr, val64, m); } \
+    static uint64_t mmu_fetch_##m(struct ElSvsProcessor *cpu, int vaddr, int *paddrp) \
+        { return mmu_fetch_mode(cpu, vaddr, paddrp, m); }
+MMU_MODES(MMU_ACCESS)
+
+#define MMU_ENTRY(m) [m] = { \
+    mmu_load_##m, mmu_load64_##m, mmu_store_##m, mmu_store64_##m, mmu_fetch_##m },
+static const struct svs_mmu_access mmu_access[16] = {
+    MMU_MODES(MMU_ENTRY)
+};
+
+//
+// Выбор варианта доступа к памяти по текущим режимам УУ.
+// Вызывается при каждом изменении M[PSW] или режима супервизора в РУУ.
+// Смена доступа требует повторной выборки слова команды.
+//
+void mmu_select(struct ElSvsProcessor *cpu)
+{
+    unsigned mode = 0;
+
+    if (!(cpu->core.M[PSW] & PSW_MMAP_DISABLE))
+        mode |= MMU_MAPPED;
+    if (!(cpu->core.M[PSW] & PSW_PROT_DISABLE))
+        mode |= MMU_PROTECT;
+    if (IS_SUPERVISOR(cpu->core.RUU))
+        mode |= MMU_SUPERVISOR;
+    if (cpu->core.M[PSW] & PSW_WRITE_WATCH)
+        mode |= MMU_WRITE_WATCH;
+    if (cpu->mmu != &mmu_access[mode]) {
+        cpu->mmu = &mmu_access[mode];
+        cpu->refetch = true;
+    }
+}
+
 void mmu_set_rp(struct ElSvsProcessor *cpu, int idx, uint64_t val, int supervisor)
 {
     uint32_t p0, p1, p2, p3;
@@ -350,6 +395,9 @@ void mmu_set_rp(struct ElSvsProcessor *cpu, int idx, uint64_t val, int superviso
     p1 &= mask;
     p2 &= mask;
     p3 &= mask;
+    cpu->stats.tlb_reloads++;
+    cpu->dirty |= DIRTY_RP;
+    cpu->refetch = true;
 
     if (supervisor) {
         cpu->core.RPS[idx] = p0 | p1 << 12 | (uint64_t)p2 << 24 | (uint64_t)p3 << 36;
@@ -391,4 +439,6 @@ void mmu_set_protection(struct ElSvsProcessor *cpu, int idx, uint64_t val)
 
     val = ((val >> 20) & 0xff) << (idx * 8);
     cpu->core.RZ = (uint32_t)((cpu->core.RZ & ~mask) | val);
+    cpu->dirty |= DIRTY_RP;
+    cpu->refetch = true;
 }
@@ -0,0 +1,349 @@
+/*
+ * Record, replay and reverse execution of a single processor.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _DEFAULT_SOURCE
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Внешнее событие: происходит, когда начато icount команд.
+//
+struct replay_event {
+    uint64_t icount;            // счётчик команд
+    unsigned kind;              // REPLAY_xxx
+    unsigned index;             // номер тумблерного регистра
+    uint64_t value;             // значение тумблерного регистра
+};
+
+//
+// Снимок состояния процессора и памяти.
+//
+struct replay_snapshot {
+    uint64_t icount;            // счётчик команд
+    size_t cursor;              // число событий до снимка
+    char *data;                 // образ состояния и памяти
+    size_t size;
+};
+
+//
+// Журнал записи.
+// Процессор воспроизводит события из журнала, пока не дойдёт
+// до конца записи; после этого события снова записываются.
+//
+struct ElSvsReplay {
+    uint64_t interval;          // команд между снимками
+    uint64_t next_snapshot;     // когда делать следующий снимок
+    uint64_t end;               // конец записи, по счётчику команд
+    unsigned max_snapshots;     // сколько снимков хранить
+    unsigned nsnapshots;
+    struct replay_snapshot *snapshot;
+    size_t nevents;             // события в журнале
+    size_t max_events;
+    size_t cursor;              // следующее воспроизводимое событие
+    struct replay_event *event;
+};
+
+//
+// Воспроизводится ли журнал.
+//
+static bool replaying(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsReplay *rp = cpu->replay;
+
+    return cpu->icount < rp->end || rp->cursor < rp->nevents;
+}
+
+//
+// Снять снимок состояния и памяти.
+// Когда снимков слишком много, самый старый удаляется вместе
+// с предшествующими ему событиями.
+//
+static bool take_snapshot(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsReplay *rp = cpu->replay;
+    struct replay_snapshot *s;
+    unsigned i;
+
+    if (rp->nsnapshots == rp->max_snapshots) {
+        free(rp->snapshot[0].data);
+        memmove(&rp->snapshot[0], &rp->snapshot[1],
+                --rp->nsnapshots * sizeof(rp->snapshot[0]));
+
+        size_t drop = rp->snapshot[0].cursor;
+        memmove(&rp->event[0], &rp->event[drop],
+                (rp->nevents - drop) * sizeof(rp->event[0]));
+        rp->nevents -= drop;
+        rp->cursor -= drop;
+        for (i = 0; i < rp->nsnapshots; i++)
+            rp->snapshot[i].cursor -= drop;
+    }
+
+    s = &rp->snapshot[rp->nsnapshots];
+    s->icount = cpu->icount;
+    s->cursor = rp->cursor;
+
+    FILE *output = open_memstream(&s->data, &s->size);
+    if (! output) {
+        perror(__func__);
+        return false;
+    }
+    bool ok = svs_state_write(cpu, output) && svs_memory_write(output);
+    if (fclose(output) != 0)
+        ok = false;
+    if (! ok) {
+        perror(__func__);
+        free(s->data);
+        return false;
+    }
+    rp->nsnapshots++;
+    rp->next_snapshot = cpu->icount + rp->interval;
+    return true;
+}
+
+//
+// Восстановить состояние и память по снимку.
+// Режимы трассировки не меняются.
+//
+static bool load_snapshot(struct ElSvsProcessor *cpu, struct replay_snapshot *s)
+{
+    FILE *input = fmemopen(s->data, s->size, "r");
+    if (! input) {
+        perror(__func__);
+        return false;
+    }
+    bool ok = svs_state_read(cpu, input, false) && svs_memory_read(input);
+    fclose(input);
+    if (! ok) {
+        fprintf(stderr, "%s: Bad snapshot\n", __func__);
+        return false;
+    }
+    cpu->replay->cursor = s->cursor;
+    return true;
+}
+
+//
+// Вычислить ближайшую точку, где нужно вмешаться в выполнение.
+//
+void svs_replay_schedule(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsReplay *rp = cpu->replay;
+    uint64_t at = cpu->stop_at;
+
+    if (rp) {
+        if (rp->next_snapshot < at)
+            at = rp->next_snapshot;
+        if (rp->cursor < rp->nevents && rp->event[rp->cursor].icount < at)
+            at = rp->event[rp->cursor].icount;
+    }
+    cpu->point_at = at;
+}
+
+//
+// Точка перед началом команды: воспроизвести события,
+// снять снимок, остановиться по счётчику команд.
+// Возвращает true для останова.
+//
+bool svs_replay_point(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsReplay *rp = cpu->replay;
+    bool stop = false;
+
+    if (rp) {
+        while (rp->cursor < rp->nevents &&
+               rp->event[rp->cursor].icount <= cpu->icount) {
+            struct replay_event *e = &rp->event[rp->cursor++];
+
+            switch (e->kind) {
+            case REPLAY_TIMER:
+                cpu_activate_timer(cpu);
+                break;
+            case REPLAY_REQUEST:
+                cpu_req(cpu);
+                break;
+            case REPLAY_PULT:
+                cpu->pult[e->index] = e->value;
+                break;
+            }
+        }
+        if (cpu->icount >= rp->next_snapshot && ! take_snapshot(cpu)) {
+            // Нет памяти: снимки больше не делаем.
+            rp->next_snapshot = UINT64_MAX;
+        }
+    }
+    if (cpu->icount >= cpu->stop_at) {
+        cpu->stop_at = UINT64_MAX;
+        stop = true;
+    }
+    svs_replay_schedule(cpu);
+    return stop;
+}
+
+//
+// Внешнее событие от хоста.
+// При записи событие заносится в журнал, и возвращается true.
+// При воспроизведении событие игнорируется: возвращается false.
+//
+bool svs_replay_input(struct ElSvsProcessor *cpu, unsigned kind, unsigned index, uint64_t value)
+{
+    struct ElSvsReplay *rp = cpu->replay;
+    struct replay_event *e;
+
+    if (replaying(cpu))
+        return false;
+
+    if (rp->nevents == rp->max_events) {
+        size_t n = rp->max_events ? rp->max_events * 2 : 1024;
+
+        e = realloc(rp->event, n * sizeof(rp->event[0]));
+        if (! e) {
+            perror(__func__);
+            return true;
+        }
+        rp->event = e;
+        rp->max_events = n;
+    }
+    e = &rp->event[rp->nevents++];
+    e->icount = cpu->icount;
+    e->kind = kind;
+    e->index = index;
+    e->value = value;
+    rp->cursor = rp->nevents;
+    return true;
+}
+
+//
+// Start recording.
+//
+bool ElSvsRecordStart(struct ElSvsProcessor *cpu, uint64_t interval, unsigned nsnapshots)
+{
+    struct ElSvsReplay *rp;
+
+    ElSvsRecordStop(cpu);
+    if (interval == 0 || nsnapshots == 0 || cpu->shadow)
+        return false;
+
+    rp = calloc(1, sizeof(*rp));
+    if (rp)
+        rp->snapshot = calloc(nsnapshots, sizeof(rp->snapshot[0]));
+    if (! rp || ! rp->snapshot) {
+        perror(__func__);
+        free(rp);
+        return false;
+    }
+    rp->interval = interval;
+    rp->max_snapshots = nsnapshots;
+    rp->end = cpu->icount;
+    cpu->replay = rp;
+
+    if (! take_snapshot(cpu)) {
+        ElSvsRecordStop(cpu);
+        return false;
+    }
+    svs_replay_schedule(cpu);
+    return true;
+}
+
+//
+// Stop recording and free the log.
+//
+void ElSvsRecordStop(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsReplay *rp = cpu->replay;
+    unsigned i;
+
+    if (! rp)
+        return;
+    for (i = 0; i < rp->nsnapshots; i++)
+        free(rp->snapshot[i].data);
+    free(rp->snapshot);
+    free(rp->event);
+    free(rp);
+    cpu->replay = NULL;
+    svs_replay_schedule(cpu);
+}
+
+uint64_t ElSvsGetInstructionCount(struct ElSvsProcessor *cpu)
+{
+    return cpu->icount;
+}
+
+//
+// Run the given number of instructions.
+//
+ElSvsStatus ElSvsStep(struct ElSvsProcessor *cpu, uint64_t n)
+{
+    if (n == 0)
+        return ESS_OK;
+    cpu->stop_at = cpu->icount + n;
+    svs_replay_schedule(cpu);
+
+    ElSvsStatus r = ElSvsSimulate(cpu);
+
+    cpu->stop_at = UINT64_MAX;
+    svs_replay_schedule(cpu);
+    return r;
+}
+
+//
+// Step backwards: restore the nearest snapshot and run forward.
+// Stops seen in the recorded run are passed, as the host did.
+//
+ElSvsStatus ElSvsReverseStep(struct ElSvsProcessor *cpu, uint64_t n)
+{
+    struct ElSvsReplay *rp = cpu->replay;
+    uint64_t target, last;
+    ElSvsStatus r = ESS_OK, last_status;
+    unsigned i;
+
+    if (! rp || rp->nsnapshots == 0)
+        return ESS_UNIMPLEMENTED;
+
+    // Запоминаем, докуда дошла запись.
+    if (cpu->icount > rp->end)
+        rp->end = cpu->icount;
+
+    target = (cpu->icount > n) ? cpu->icount - n : 0;
+    if (target < rp->snapshot[0].icount)
+        target = rp->snapshot[0].icount;
+    for (i = rp->nsnapshots - 1; rp->snapshot[i].icount > target; i--)
+        continue;
+    if (! load_snapshot(cpu, &rp->snapshot[i]))
+        return ESS_UNIMPLEMENTED;
+
+    last = cpu->icount;
+    last_status = ESS_OK;
+    while (cpu->icount < target) {
+        r = ElSvsStep(cpu, target - cpu->icount);
+        if (r == ESS_OK)
+            break;
+
+        // Повторный останов на том же месте: дальше не пройти.
+        if (cpu->icount == last && r == last_status)
+            return r;
+        last = cpu->icount;
+        last_status = r;
+    }
+    return ESS_OK;
+}
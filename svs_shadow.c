@@ -0,0 +1,325 @@
+/*
+ * Shadow execution: validation of an execution engine by the reference.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _DEFAULT_SOURCE
+#include "el_master_api.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Запись в память во время проверяемого отрезка.
+//
+struct shadow_write {
+    uint32_t paddr;             // физический адрес
+    uint32_t seq;               // порядковый номер записи
+    uint8_t engine;             // 1 - проверяемый механизм, 0 - эталон
+    ElMasterTag old_tag, tag;   // тег до и после записи
+    ElMasterWord old_word, word; // слово до и после записи
+};
+
+struct ElSvsShadow {
+    const struct ElSvsEngine *engine; // проверяемый механизм
+    uint64_t period;            // команд между началами проверок
+    uint64_t length;            // команд в проверяемом отрезке
+    uint64_t next;              // счётчик команд следующей проверки
+    char *snapshot;             // префикс имён файлов снимка, или NULL
+    struct ElSvsProcessor *start; // состояние в начале отрезка
+    struct ElSvsProcessor *ref; // эталонный процессор
+    FILE *devnull;              // вывод эталонного процессора
+    bool engine_phase;          // идёт выполнение проверяемым механизмом
+    struct shadow_write *log;   // журнал записи в память
+    unsigned nlog, maxlog;
+    ElSvsShadowStats stats;
+};
+
+bool ElSvsShadowStart(struct ElSvsProcessor *cpu, const char *engine,
+                      uint64_t period, uint64_t length, const char *snapshot)
+{
+    const struct ElSvsEngine *e = svs_engine_find(engine);
+
+    if (! e || period == 0 || length == 0 || length > period || cpu->replay)
+        return false;
+    ElSvsShadowStop(cpu);
+
+    struct ElSvsShadow *sh = calloc(1, sizeof(*sh));
+    if (! sh)
+        return false;
+    sh->engine = e;
+    sh->period = period;
+    sh->length = length;
+    sh->next = cpu->icount;
+    sh->devnull = fopen("/dev/null", "w");
+    if (snapshot && *snapshot)
+        sh->snapshot = strdup(snapshot);
+    if (! sh->devnull || (snapshot && *snapshot && ! sh->snapshot)) {
+        if (sh->devnull)
+            fclose(sh->devnull);
+        free(sh);
+        return false;
+    }
+
+    // Вспомогательные процессоры без трассировки.
+    sh->start = ElSvsAllocate(cpu->index);
+    sh->ref = ElSvsAllocate(cpu->index);
+    sh->start->log_output = sh->devnull;
+    sh->ref->log_output = sh->devnull;
+    sh->ref->shadow = sh;
+    cpu->shadow = sh;
+    return true;
+}
+
+void ElSvsShadowStop(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsShadow *sh = cpu->shadow;
+
+    if (! sh)
+        return;
+    free(sh->start);
+    free(sh->ref);
+    fclose(sh->devnull);
+    free(sh->snapshot);
+    free(sh->log);
+    free(sh);
+    cpu->shadow = NULL;
+    cpu->shadow_log = false;
+}
+
+void ElSvsShadowGetStats(struct ElSvsProcessor *cpu, ElSvsShadowStats *stats)
+{
+    if (cpu->shadow)
+        *stats = cpu->shadow->stats;
+    else
+        memset(stats, 0, sizeof(*stats));
+}
+
+//
+// Запись слова в память: запоминаем прежнее и новое значение.
+//
+void svs_shadow_write(struct ElSvsProcessor *cpu, unsigned paddr, uint8_t tag, uint64_t word)
+{
+    struct ElSvsShadow *sh = cpu->shadow;
+
+    if (sh->nlog == sh->maxlog) {
+        unsigned n = sh->maxlog ? sh->maxlog * 2 : 1024;
+        struct shadow_write *log = realloc(sh->log, n * sizeof(*log));
+
+        if (! log) {
+            perror(__func__);
+            abort();
+        }
+        sh->log = log;
+        sh->maxlog = n;
+    }
+    struct shadow_write *w = &sh->log[sh->nlog];
+    w->paddr = paddr;
+    w->seq = sh->nlog++;
+    w->engine = sh->engine_phase;
+    w->tag = tag;
+    w->word = word;
+    if (elMasterRamWordRead(paddr, &w->old_tag, &w->old_word) != EMS_OK) {
+        w->old_tag = 0;
+        w->old_word = 0;
+    }
+}
+
+//
+// Откат записей журнала с номерами from...to-1, в обратном порядке.
+//
+static void shadow_undo(struct ElSvsShadow *sh, unsigned from, unsigned to)
+{
+    while (to-- > from)
+        elMasterRamWordWrite(sh->log[to].paddr, sh->log[to].old_tag, sh->log[to].old_word);
+}
+
+static int compare_writes(const void *a, const void *b)
+{
+    const struct shadow_write *x = a, *y = b;
+
+    if (x->paddr != y->paddr)
+        return (x->paddr < y->paddr) ? -1 : 1;
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    const struct shadow_write *x = a, *y = b;
+
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+//
+// Сравнение памяти после обоих прогонов.  По каждому адресу
+// окончательное значение - последняя запись своего прогона,
+// а если записи не было - значение до начала отрезка.
+//
+static bool shadow_compare_memory(struct ElSvsShadow *sh, unsigned nengine, char *what, size_t size)
+{
+    unsigned i, j;
+    bool ok = true;
+
+    // Обычно оба прогона пишут одно и то же в том же порядке.
+    if (2 * nengine == sh->nlog) {
+        for (i = 0; i < nengine; i++) {
+            const struct shadow_write *w = &sh->log[i], *r = &sh->log[nengine + i];
+
+            if (w->paddr != r->paddr || w->tag != r->tag || w->word != r->word)
+                break;
+        }
+        if (i == nengine)
+            return true;
+    }
+
+    qsort(sh->log, sh->nlog, sizeof(sh->log[0]), compare_writes);
+    for (i = 0; i < sh->nlog && ok; i = j) {
+        const struct shadow_write *w = &sh->log[i];
+        ElMasterTag tag[2] = { w->old_tag, w->old_tag };
+        ElMasterWord word[2] = { w->old_word, w->old_word };
+
+        for (j = i; j < sh->nlog && sh->log[j].paddr == w->paddr; j++) {
+            tag[sh->log[j].engine] = sh->log[j].tag;
+            word[sh->log[j].engine] = sh->log[j].word;
+        }
+        if (tag[0] != tag[1] || word[0] != word[1]) {
+            snprintf(what, size, "memory [%07o] = %02o:%016llo, expected %02o:%016llo",
+                     w->paddr, tag[1], (unsigned long long) word[1],
+                     tag[0], (unsigned long long) word[0]);
+            ok = false;
+        }
+    }
+
+    // Восстанавливаем порядок записей, для отката.
+    if (! ok)
+        qsort(sh->log, sh->nlog, sizeof(sh->log[0]), compare_seq);
+    return ok;
+}
+
+//
+// Сохранение снимка начала отрезка: память откатывается
+// к началу отрезка и затем снова приводится к результату эталона.
+//
+static void shadow_snapshot(struct ElSvsShadow *sh, unsigned nengine, char *name, size_t size)
+{
+    unsigned i;
+
+    snprintf(name, size, "%s-%llu", sh->snapshot, (unsigned long long) sh->start->icount);
+    size_t len = strlen(name);
+
+    shadow_undo(sh, nengine, sh->nlog);
+    snprintf(name + len, size - len, ".state");
+    bool ok = ElSvsSaveState(sh->start, name);
+    snprintf(name + len, size - len, ".mem");
+    ok = ElSvsSaveMemory(name) && ok;
+    for (i = nengine; i < sh->nlog; i++)
+        elMasterRamWordWrite(sh->log[i].paddr, sh->log[i].tag, sh->log[i].word);
+    name[len] = 0;
+    if (! ok)
+        snprintf(name, size, "not saved");
+}
+
+//
+// Проверка отрезка из n команд: выполнение механизмом, откат памяти,
+// повтор эталоном и сравнение.  Память остаётся в состоянии после эталона.
+//
+static ElSvsStatus shadow_check(struct ElSvsProcessor *cpu, uint64_t n)
+{
+    struct ElSvsShadow *sh = cpu->shadow;
+    struct ElSvsProcessor *ref = sh->ref;
+    char what[160], name[256];
+    unsigned i;
+
+    ElSvsCopyState(sh->start, cpu);
+
+    // Проверяемый механизм.
+    sh->nlog = 0;
+    sh->engine_phase = true;
+    cpu->shadow_log = true;
+    ElSvsStatus status = sh->engine->run(cpu, n);
+    cpu->shadow_log = false;
+    unsigned nengine = sh->nlog;
+    shadow_undo(sh, 0, nengine);
+
+    // Эталон, с теми же точками останова и экстракодами хоста.
+    ElSvsCopyState(ref, sh->start);
+    memcpy(ref->brk_pages, cpu->brk_pages, sizeof(ref->brk_pages));
+    for (i = 0; i < ELSVS_BREAK_KINDS; i++) {
+        if (cpu->brk_pages[i])
+            memcpy(ref->brk_map[i], cpu->brk_map[i], sizeof(ref->brk_map[i]));
+    }
+    memcpy(ref->extracode, cpu->extracode, sizeof(ref->extracode));
+    ref->brk_skip = cpu->brk_skip;
+    sh->engine_phase = false;
+    ref->shadow_log = true;
+    ElSvsStatus expect = ElSvsStep(ref, n);
+    ref->shadow_log = false;
+
+    sh->stats.segments++;
+    sh->stats.instructions += ref->icount - sh->start->icount;
+    if (status != expect)
+        snprintf(what, sizeof(what), "status %d, expected %d", status, expect);
+    else if (svs_engine_compare(ref, cpu, what, sizeof(what)) &&
+             shadow_compare_memory(sh, nengine, what, sizeof(what)))
+        return status;
+
+    // Расхождение: выдаём и продолжаем с результата эталона.
+    sh->stats.divergences++;
+    if (sh->snapshot)
+        shadow_snapshot(sh, nengine, name, sizeof(name));
+    else
+        snprintf(name, sizeof(name), "not saved");
+    svs_trace_text(cpu, "cpu%d --- Shadow divergence of engine %s in %llu instructions from %llu: %s; snapshot %s\n",
+                   cpu->index, sh->engine->name, (unsigned long long) n,
+                   (unsigned long long) sh->start->icount, what, name);
+    ElSvsCopyState(cpu, ref);
+    return expect;
+}
+
+//
+// Run instructions by the engine, with checks of sampled segments.
+//
+ElSvsStatus ElSvsShadowStep(struct ElSvsProcessor *cpu, uint64_t n)
+{
+    struct ElSvsShadow *sh = cpu->shadow;
+    ElSvsStatus r = ESS_OK;
+
+    if (! sh)
+        return ElSvsStep(cpu, n);
+
+    while (n > 0 && r == ESS_OK) {
+        uint64_t count;
+
+        if (cpu->icount < sh->next) {
+            count = sh->next - cpu->icount;
+            if (count > n)
+                count = n;
+            r = sh->engine->run(cpu, count);
+        } else {
+            count = (sh->length < n) ? sh->length : n;
+            sh->next = cpu->icount + sh->period;
+            r = shadow_check(cpu, count);
+        }
+        n -= count;
+    }
+    return r;
+}
@@ -0,0 +1,459 @@
+/*
+ * Saving and restoring processor state and memory.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _DEFAULT_SOURCE
+#include "el_master_api.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+#include <string.h>
+#include <unistd.h>
+
+#define STATE_MAGIC     0x4554415453535653ULL   // "SVSSTATE"
+#define STATE_VERSION   7
+#define MEMORY_VERSION  2
+
+//
+// Образ состояния процессора.
+// Формат двоичный, для той же сборки симулятора:
+// размер образа проверяется при восстановлении.
+//
+struct state_image {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t size;                      // размер образа
+    struct ElSvsCoreState core;         // регистры
+    uint64_t pult[8];                   // тумблерные регистры
+    uint32_t RK, Aex;                   // регистр команд, исполнительный адрес
+    uint32_t UTLB[32];                  // приписка пользователя
+    uint32_t STLB[32];                  // приписка супервизора
+    unsigned trace_flags;               // режимы трассировки
+    bool trace_filter_on;               // фильтр трассировки
+    ElSvsTraceFilter trace_filter;
+    bool trace_trigger_on;              // запуск трассировки по событию
+    bool trace_armed;
+    ElSvsTraceTrigger trace_trigger;
+    uint64_t trace_countdown;
+    uint64_t trace_remaining;
+    ElSvsStats stats;                   // счётчики производительности
+    uint64_t icount;                    // счётчик команд
+    int32_t iintr;                      // признак прерывания
+};
+
+//
+// Write processor state to stream.
+//
+bool svs_state_write(struct ElSvsProcessor *cpu, FILE *output)
+{
+    struct state_image image;
+
+    memset(&image, 0, sizeof(image));
+    image.magic = STATE_MAGIC;
+    image.version = STATE_VERSION;
+    image.size = sizeof(image);
+    image.core = cpu->core;
+    memcpy(image.pult, cpu->pult, sizeof(image.pult));
+    image.RK = cpu->RK;
+    image.Aex = cpu->Aex;
+    memcpy(image.UTLB, cpu->UTLB, sizeof(image.UTLB));
+    memcpy(image.STLB, cpu->STLB, sizeof(image.STLB));
+    image.trace_flags = cpu->trace_flags;
+    image.trace_filter_on = cpu->trace_filter_on;
+    image.trace_filter = cpu->trace_filter;
+    image.trace_trigger_on = cpu->trace_trigger_on;
+    image.trace_armed = cpu->trace_armed;
+    image.trace_trigger = cpu->trace_trigger;
+    image.trace_countdown = cpu->trace_countdown;
+    image.trace_remaining = cpu->trace_remaining;
+    image.stats = cpu->stats;
+    image.icount = cpu->icount;
+    image.iintr = cpu->iintr;
+
+    return fwrite(&image, sizeof(image), 1, output) == 1;
+}
+
+//
+// Read processor state from stream.
+// Trace settings are restored only when requested.
+//
+bool svs_state_read(struct ElSvsProcessor *cpu, FILE *input, bool trace)
+{
+    struct state_image image;
+
+    if (fread(&image, sizeof(image), 1, input) != 1 ||
+        image.magic != STATE_MAGIC || image.version != STATE_VERSION ||
+        image.size != sizeof(image))
+        return false;
+
+    cpu->core = image.core;
+    memcpy(cpu->pult, image.pult, sizeof(cpu->pult));
+    cpu->RK = image.RK;
+    cpu->Aex = image.Aex;
+    memcpy(cpu->UTLB, image.UTLB, sizeof(cpu->UTLB));
+    memcpy(cpu->STLB, image.STLB, sizeof(cpu->STLB));
+    if (trace) {
+        cpu->trace_flags = image.trace_flags;
+        cpu->trace_filter_on = image.trace_filter_on;
+        cpu->trace_filter = image.trace_filter;
+        cpu->trace_trigger_on = image.trace_trigger_on;
+        cpu->trace_armed = image.trace_armed;
+        cpu->trace_trigger = image.trace_trigger;
+        cpu->trace_countdown = image.trace_countdown;
+        cpu->trace_remaining = image.trace_remaining;
+        svs_trace_enable(cpu, ! cpu->trace_armed);
+    }
+    cpu->stats = image.stats;
+    cpu->icount = image.icount;
+    cpu->iintr = image.iintr;
+
+    // Трасса регистров продолжается от восстановленного состояния.
+    cpu->prev = cpu->core;
+    cpu->dirty = 0;
+    cpu->flight_count = 0;
+    cpu->brk_skip = false;
+    return true;
+}
+
+//
+// Save processor state to file.
+//
+bool ElSvsSaveState(struct ElSvsProcessor *cpu, const char *filename)
+{
+    FILE *output = fopen(filename, "w");
+    if (! output) {
+        perror(filename);
+        return false;
+    }
+    bool ok = svs_state_write(cpu, output);
+    if (fclose(output) != 0)
+        ok = false;
+    if (! ok)
+        perror(filename);
+    return ok;
+}
+
+//
+// Restore processor state from file.
+// Processor index and trace output are not changed.
+// Recording of the run is stopped.
+//
+bool ElSvsRestoreState(struct ElSvsProcessor *cpu, const char *filename)
+{
+    FILE *input = fopen(filename, "r");
+    if (! input) {
+        perror(filename);
+        return false;
+    }
+    ElSvsRecordStop(cpu);
+    bool ok = svs_state_read(cpu, input, true);
+    fclose(input);
+    if (! ok) {
+        fprintf(stderr, "%s: Bad processor state\n", filename);
+        return false;
+    }
+    return true;
+}
+
+//
+// Copy processor state in memory.
+// Only state changed by simulation is copied.
+//
+void ElSvsCopyState(struct ElSvsProcessor *dst, const struct ElSvsProcessor *src)
+{
+    if (dst->replay)
+        ElSvsRecordStop(dst);
+
+    dst->core = src->core;
+    memcpy(dst->pult, src->pult, sizeof(dst->pult));
+    dst->RK = src->RK;
+    dst->Aex = src->Aex;
+    memcpy(dst->UTLB, src->UTLB, sizeof(dst->UTLB));
+    memcpy(dst->STLB, src->STLB, sizeof(dst->STLB));
+    dst->corr_stack = src->corr_stack;
+    dst->stats = src->stats;
+    dst->icount = src->icount;
+    dst->iintr = src->iintr;
+
+    dst->prev = dst->core;
+    dst->dirty = 0;
+    dst->flight_count = 0;
+    dst->brk_skip = false;
+}
+
+//
+// Участок ненулевых слов в образе памяти: заголовок, слова, затем
+// теги, дополненные до 8 байтов.  Слова следующего участка остаются
+// выровненными, и участки отображённого файла пишутся в память
+// прямо из отображения.
+//
+struct memory_run {
+    uint32_t addr;                      // начальный адрес
+    uint32_t count;                     // число слов
+};
+
+#define RUN_TAGS_SIZE(n) (((n) + 7) & ~7u)
+
+//
+// Default block write for hosts which store words one by one.
+//
+__attribute__((weak))
+ElMasterStatus elMasterRamBlockWrite(
+    ElMasterRamAddress address,
+    unsigned count,
+    const ElMasterTag *pTags,
+    const ElMasterWord *pWords)
+{
+    unsigned i;
+
+    for (i = 0; i < count; i++) {
+        ElMasterStatus status = elMasterRamWordWrite(address + i, pTags[i], pWords[i]);
+        if (status != EMS_OK)
+            return status;
+    }
+    return EMS_OK;
+}
+
+//
+// Write non-zero words of RAM to stream, in runs,
+// starting from the given address.
+//
+bool svs_memory_write_runs(FILE *output, unsigned first)
+{
+    static const ElMasterTag pad[8];
+    ElMasterWord word[1024];
+    ElMasterTag tag[1024 + 8];
+    struct memory_run run;
+    unsigned addr;
+    bool ok = true;
+
+    for (addr = first; ok && addr < SVS_MEMSIZE; ) {
+        // Пропускаем нулевые слова.
+        for (; addr < SVS_MEMSIZE; addr++) {
+            if (elMasterRamWordRead(addr, &tag[0], &word[0]) == EMS_OK &&
+                (word[0] | tag[0]))
+                break;
+        }
+        if (addr >= SVS_MEMSIZE)
+            break;
+
+        // Набираем участок ненулевых слов.
+        run.addr = addr;
+        for (run.count = 1, addr++; addr < SVS_MEMSIZE && run.count < 1024; addr++) {
+            if (elMasterRamWordRead(addr, &tag[run.count], &word[run.count]) != EMS_OK ||
+                ! (word[run.count] | tag[run.count]))
+                break;
+            run.count++;
+        }
+        unsigned npad = RUN_TAGS_SIZE(run.count) - run.count;
+        ok = fwrite(&run, sizeof(run), 1, output) == 1 &&
+             fwrite(word, sizeof(word[0]), run.count, output) == run.count &&
+             fwrite(tag, 1, run.count, output) == run.count &&
+             fwrite(pad, 1, npad, output) == npad;
+    }
+
+    run.addr = 0;
+    run.count = 0;
+    if (ok)
+        ok = (fwrite(&run, sizeof(run), 1, output) == 1);
+    return ok;
+}
+
+//
+// Check a run header against the address reached.
+//
+static bool memory_run_valid(const struct memory_run *run, unsigned addr)
+{
+    if (run->count == 0)
+        return true;
+    return run->count <= 1024 && run->addr >= addr &&
+           run->addr <= SVS_MEMSIZE && run->count <= SVS_MEMSIZE - run->addr;
+}
+
+//
+// Clear words from the address up to the limit, by blocks.
+//
+static void memory_clear(unsigned addr, unsigned limit)
+{
+    static const ElMasterWord zero_word[1024];
+    static const ElMasterTag zero_tag[1024];
+
+    while (addr < limit) {
+        unsigned n = (limit - addr < 1024) ? limit - addr : 1024;
+
+        elMasterRamBlockWrite(addr, n, zero_tag, zero_word);
+        addr += n;
+    }
+}
+
+//
+// Read runs of words from stream into RAM.  Runs must go in order,
+// starting from the given address.  When clear is set, words missing
+// in the stream are cleared.
+//
+bool svs_memory_read_runs(FILE *input, unsigned first, bool clear)
+{
+    ElMasterWord word[1024];
+    ElMasterTag tag[1024 + 8];
+    struct memory_run run;
+    unsigned addr = first;
+
+    for (;;) {
+        if (fread(&run, sizeof(run), 1, input) != 1 ||
+            ! memory_run_valid(&run, addr) ||
+            fread(word, sizeof(word[0]), run.count, input) != run.count ||
+            fread(tag, 1, RUN_TAGS_SIZE(run.count), input) != RUN_TAGS_SIZE(run.count))
+            return false;
+        if (run.count == 0)
+            break;
+
+        // Очищаем промежуток перед участком.
+        if (clear)
+            memory_clear(addr, run.addr);
+        elMasterRamBlockWrite(run.addr, run.count, tag, word);
+        addr = run.addr + run.count;
+    }
+    if (clear)
+        memory_clear(addr, SVS_MEMSIZE);
+    return true;
+}
+
+//
+// Load runs of words from a buffer, usually a mapped file.
+// Words are written into RAM right from the buffer.
+//
+bool svs_memory_load_runs(const void *data, size_t size, unsigned first)
+{
+    const char *p = data, *end = p + size;
+    unsigned addr = first;
+
+    for (;;) {
+        const struct memory_run *run = (const struct memory_run*) p;
+
+        if ((size_t) (end - p) < sizeof(*run) || ! memory_run_valid(run, addr))
+            return false;
+        p += sizeof(*run);
+        if (run->count == 0)
+            return true;
+
+        size_t len = run->count * sizeof(ElMasterWord) + RUN_TAGS_SIZE(run->count);
+        if ((size_t) (end - p) < len)
+            return false;
+        elMasterRamBlockWrite(run->addr, run->count,
+                              (const ElMasterTag*) (p + run->count * sizeof(ElMasterWord)),
+                              (const ElMasterWord*) p);
+        addr = run->addr + run->count;
+        p += len;
+    }
+}
+
+//
+// Write contents of RAM to stream.
+// Only non-zero words are written, in runs.
+//
+bool svs_memory_write(FILE *output)
+{
+    struct svs_memory_header header = { SVS_MEMORY_MAGIC, MEMORY_VERSION, SVS_MEMSIZE };
+
+    return fwrite(&header, sizeof(header), 1, output) == 1 &&
+           svs_memory_write_runs(output, 0);
+}
+
+//
+// Read contents of RAM from stream.
+// Words missing in the image are cleared.
+//
+bool svs_memory_read(FILE *input)
+{
+    struct svs_memory_header header;
+
+    if (fread(&header, sizeof(header), 1, input) != 1 ||
+        memcmp(header.magic, SVS_MEMORY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MEMORY_VERSION || header.size != SVS_MEMSIZE)
+        return false;
+
+    return svs_memory_read_runs(input, 0, true);
+}
+
+//
+// Save contents of RAM to file.
+//
+bool ElSvsSaveMemory(const char *filename)
+{
+    FILE *output = fopen(filename, "w");
+    if (! output) {
+        perror(filename);
+        return false;
+    }
+    bool ok = svs_memory_write(output);
+    if (fclose(output) != 0)
+        ok = false;
+    if (! ok)
+        perror(filename);
+    return ok;
+}
+
+//
+// Restore contents of RAM from file.
+//
+bool ElSvsRestoreMemory(const char *filename)
+{
+    FILE *input = fopen(filename, "r");
+    if (! input) {
+        perror(filename);
+        return false;
+    }
+    bool ok = svs_memory_read(input);
+    fclose(input);
+    if (! ok) {
+        fprintf(stderr, "%s: Bad memory image\n", filename);
+        return false;
+    }
+    return true;
+}
+
+//
+// Fork a child simulation: a copy of the process, with memory pages
+// shared copy-on-write until modified.
+// Pending trace output is written out before fork, otherwise
+// buffers of the parent would be duplicated in the child.
+//
+int ElSvsFork(struct ElSvsProcessor *cpu)
+{
+    // Фоновый поток вывода трассы не переживает fork.
+    if (cpu->trace_queue)
+        ElSvsSetTrace(cpu, "", "");
+    if (cpu->trace_buf)
+        svs_trace_flush(cpu);
+    fflush(NULL);
+
+    int pid = fork();
+    if (pid < 0) {
+        perror(__func__);
+        return -1;
+    }
+    if (pid == 0) {
+        // Дочерний процесс.
+        svs_trace_async_forked();
+        cpu->flight_count = 0;
+    }
+    return pid;
+}
@@ -22,17 +22,198 @@
  * SOFTWARE.
  */
 #include "el_svs_internal.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 
+//
+// Номера регистров в записях TRACE_REG.
+//
+enum {
+    REG_M = 0,                  // M0...M35
+    REG_ACC = SVS_NREGS,
+    REG_RMR,
+    REG_RAU,
+    REG_RUU,
+    REG_RP,                     // RP0...RP7
+    REG_RPS = REG_RP + 8,       // RPS0...RPS7
+    REG_RZ = REG_RPS + 8,
+    REG_EADDR,
+    REG_TAG,
+    REG_PP,
+    REG_OPP,
+    REG_POP,
+    REG_OPOP,
+    REG_RKP,
+    REG_RPR,
+    REG_GRVP,
+    REG_GRM,
+};
+
+static const char *reg_name[] = {
+    "ACC", "RMR", "RAU", "RUU", "RP", "RP", "RP", "RP", "RP", "RP", "RP", "RP",
+    "RPS", "RPS", "RPS", "RPS", "RPS", "RPS", "RPS", "RPS", "RZ", "EADDR", "TAG",
+    "PP", "OPP", "POP", "OPOP", "RKP", "RPR", "GRVP", "GRM",
+};
+
+//
+// Сброс буфера двоичной трассировки в файл.
+//
+void svs_trace_flush(struct ElSvsProcessor *cpu)
+{
+    if (cpu->trace_count > 0) {
+        fwrite(cpu->trace_buf, sizeof(cpu->trace_buf[0]), cpu->trace_count, cpu->log_output);
+        cpu->trace_count = 0;
+    }
+    fflush(cpu->log_output);
+}
+
+//
+// Включение и выключение двоичного режима трассировки.
+// При включении в файл записывается заголовок.
+//
+void svs_trace_binary(struct ElSvsProcessor *cpu, bool on)
+{
+    if (cpu->trace_buf) {
+        svs_trace_flush(cpu);
+        free(cpu->trace_buf);
+        cpu->trace_buf = NULL;
+    }
+    if (on) {
+        cpu->trace_buf = malloc(SVS_TRACE_BUFSZ * sizeof(cpu->trace_buf[0]));
+        if (! cpu->trace_buf) {
+            perror(__func__);
+            abort();
+        }
+        struct ElSvsTraceRecord rec = {
+            .type = TRACE_HEADER, .cpu = cpu->index,
+            .vaddr = TRACE_VERSION, .value = TRACE_MAGIC,
+        };
+        svs_trace_emit(cpu, &rec);
+    }
+}
+
+//
+// Запись в трассу: напечатать или поместить в буфер.
+//
+void svs_trace_emit(struct ElSvsProcessor *cpu, const struct ElSvsTraceRecord *rec)
+{
+    if (cpu->trace_queue) {
+        svs_trace_push(cpu, rec, 1);
+        return;
+    }
+    if (! cpu->trace_buf) {
+        svs_trace_print(cpu->log_output, rec, NULL);
+        return;
+    }
+    cpu->trace_buf[cpu->trace_count++] = *rec;
+    if (cpu->trace_count == SVS_TRACE_BUFSZ)
+        svs_trace_flush(cpu);
+}
+
+//
+// Текстовое сообщение в трассу.
+// В двоичном режиме текст следует за заголовком в нескольких записях.
+//
+void svs_trace_text(struct ElSvsProcessor *cpu, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (! cpu->trace_buf && ! cpu->trace_queue) {
+        fputs(buf, cpu->log_output);
+        return;
+    }
+
+    unsigned len = strlen(buf);
+    struct ElSvsTraceRecord rec = { .type = TRACE_TEXT, .cpu = cpu->index, .vaddr = len };
+    unsigned i;
+
+    if (cpu->trace_queue) {
+        // Заголовок и текст помещаются в очередь вместе.
+        struct ElSvsTraceRecord msg[1 + sizeof(buf) / sizeof(rec)];
+
+        memset(msg, 0, sizeof(msg));
+        msg[0] = rec;
+        memcpy(&msg[1], buf, len);
+        svs_trace_push(cpu, msg, 1 + (len + sizeof(rec) - 1) / sizeof(rec));
+        return;
+    }
+
+    svs_trace_emit(cpu, &rec);
+    for (i = 0; i < len; i += sizeof(rec)) {
+        memset(&rec, 0, sizeof(rec));
+        memcpy(&rec, buf + i, (len - i < sizeof(rec)) ? len - i : sizeof(rec));
+        svs_trace_emit(cpu, &rec);
+    }
+}
+
+//
+// Обращение к памяти: чтение, запись или выборка команды.
+//
+void svs_trace_memory(struct ElSvsProcessor *cpu, int type, int vaddr, int paddr,
+    int tag, uint64_t value)
+{
+    struct ElSvsTraceRecord rec = {
+        .type = type, .cpu = cpu->index, .tag = tag,
+        .vaddr = vaddr, .paddr = paddr, .value = value,
+    };
+    svs_trace_emit(cpu, &rec);
+}
+
+//
+// Выполнение команды: адрес, код и мнемоника.
+//
 void svs_trace_opcode(struct ElSvsProcessor *cpu, int paddr)
 {
-    // Print instruction.
-    fprintf(cpu->log_output, "cpu%d %05o %07o %c: ",
-        cpu->index, cpu->core.PC, paddr,
-        (cpu->core.RUU & RUU_RIGHT_INSTR) ? 'R' : 'L');
-    svs_fprint_insn(cpu->log_output, cpu->RK);
-    fprintf(cpu->log_output, " ");
-    svs_fprint_cmd(cpu->log_output, cpu->RK);
-    fprintf(cpu->log_output, "\n");
+    struct ElSvsTraceRecord rec = {
+        .type = TRACE_INSN, .cpu = cpu->index,
+        .tag = (cpu->core.RUU & RUU_RIGHT_INSTR) ? 'R' : 'L',
+        .vaddr = cpu->core.PC, .paddr = paddr, .value = cpu->RK,
+    };
+    svs_trace_emit(cpu, &rec);
+}
+
+//
+// Выдача бортового самописца: последние команды, начиная с самой старой,
+// со значением сумматора и исполнительным адресом после выполнения.
+//
+void svs_trace_flight(struct ElSvsProcessor *cpu)
+{
+    unsigned count = cpu->flight_count;
+    unsigned n = (count < SVS_FLIGHT_SIZE) ? count : SVS_FLIGHT_SIZE;
+    unsigned i;
+
+    if (n == 0)
+        return;
+
+    svs_trace_text(cpu, "cpu%d --- Последние команды: %u\n", cpu->index, n);
+    for (i = count - n; i != count; i++) {
+        const struct ElSvsFlight *f = &cpu->flight[i % SVS_FLIGHT_SIZE];
+
+        // Результат команды запомнен вместе со следующей.
+        const struct ElSvsFlight *next = &cpu->flight[(i + 1) % SVS_FLIGHT_SIZE];
+        uint64_t acc = (i + 1 == count) ? cpu->core.ACC : next->ACC;
+        unsigned aex = (i + 1 == count) ? cpu->Aex : next->Aex;
+
+        struct ElSvsTraceRecord rec = {
+            .type = TRACE_INSN, .cpu = cpu->index, .tag = f->right ? 'R' : 'L',
+            .vaddr = f->PC, .paddr = f->paddr, .value = f->RK,
+        };
+        svs_trace_emit(cpu, &rec);
+
+        rec = (struct ElSvsTraceRecord) {
+            .type = TRACE_REG, .cpu = cpu->index, .vaddr = REG_ACC, .value = acc,
+        };
+        svs_trace_emit(cpu, &rec);
+        svs_trace_text(cpu, "cpu%d       Aex = %05o\n", cpu->index, aex);
+    }
+    if (! cpu->trace_queue)
+        fflush(cpu->log_output);
 }
 
 //
@@ -58,101 +239,406 @@ void svs_fprint_48bits(FILE *of, uint64_t value)
         (int) value & 07777);
 }
 
+//
+// Print 64-bit value with tag bits as octal.
+//
+static void fprint_64bits(FILE *of, uint64_t value)
+{
+    fprintf(of, "%04o %04o %04o %04o:%02o %04o",
+        (int) (value >> 52) & 07777,
+        (int) (value >> 40) & 07777,
+        (int) (value >> 28) & 07777,
+        (int) (value >> 16) & 07777,
+        (int) (value >> 12) & 017,
+        (int) value & 07777);
+}
+
+//
+// Печать изменения регистра.
+//
+static void print_register(FILE *of, const struct ElSvsTraceRecord *rec)
+{
+    unsigned id = rec->vaddr;
+
+    fprintf(of, "cpu%d       Write ", rec->cpu);
+    if (id < REG_ACC) {
+        fprintf(of, "M%o = %05o\n", id, (unsigned) rec->value);
+        return;
+    }
+    if (id >= REG_RP && id < REG_RP + 8)
+        fprintf(of, "RP%o = ", id - REG_RP);
+    else if (id >= REG_RPS && id < REG_RPS + 8)
+        fprintf(of, "RPS%o = ", id - REG_RPS);
+    else
+        fprintf(of, "%s = ", reg_name[id - REG_ACC]);
+
+    switch (id) {
+    case REG_RAU:
+        fprintf(of, "%02o\n", (unsigned) rec->value);
+        break;
+    case REG_RUU:
+    case REG_EADDR:
+    case REG_TAG:
+        fprintf(of, "%03o\n", (unsigned) rec->value);
+        break;
+    case REG_RZ:
+    case REG_GRVP:
+    case REG_GRM:
+        fprint_32bits(of, rec->value);
+        fprintf(of, "\n");
+        break;
+    default:
+        svs_fprint_48bits(of, rec->value);
+        fprintf(of, "\n");
+        break;
+    }
+}
+
+//
+// Печать записи трассы в текстовом виде.
+// Для записи TRACE_TEXT текст сообщения передаётся отдельно.
+//
+void svs_trace_print(FILE *of, const struct ElSvsTraceRecord *rec, const char *text)
+{
+    switch (rec->type) {
+    case TRACE_HEADER:
+        break;
+    case TRACE_INSN:
+        fprintf(of, "cpu%d %05o %07o %c: ",
+            rec->cpu, rec->vaddr, rec->paddr, rec->tag);
+        svs_fprint_insn(of, rec->value);
+        fprintf(of, " ");
+        svs_fprint_cmd(of, rec->value);
+        fprintf(of, "\n");
+        break;
+    case TRACE_FETCH:
+        fprintf(of, "cpu%d       Fetch [%05o %07o] = %o:",
+            rec->cpu, rec->vaddr, rec->paddr, rec->tag);
+        svs_fprint_insn(of, (rec->value >> 24) & BITS(24));
+        svs_fprint_insn(of, rec->value & BITS(24));
+        fprintf(of, "\n");
+        break;
+    case TRACE_READ:
+    case TRACE_READ64:
+        if (rec->paddr < 010)
+            fprintf(of, "cpu%d       Read  TR%o = ", rec->cpu, rec->paddr);
+        else
+            fprintf(of, "cpu%d       Memory Read [%05o %07o] = %02o:",
+                rec->cpu, rec->vaddr, rec->paddr, rec->tag);
+        if (rec->type == TRACE_READ)
+            svs_fprint_48bits(of, rec->value);
+        else
+            fprint_64bits(of, rec->value);
+        fprintf(of, "\n");
+        break;
+    case TRACE_WRITE:
+    case TRACE_WRITE64:
+        fprintf(of, "cpu%d       Memory Write [%05o %07o] = %02o:",
+            rec->cpu, rec->vaddr, rec->paddr, rec->tag);
+        if (rec->type == TRACE_WRITE)
+            svs_fprint_48bits(of, rec->value);
+        else
+            fprint_64bits(of, rec->value);
+        fprintf(of, "\n");
+        break;
+    case TRACE_REG:
+        print_register(of, rec);
+        break;
+    case TRACE_TEXT:
+        if (text)
+            fputs(text, of);
+        break;
+    default:
+        fprintf(of, "cpu%d --- Unknown trace record %d\n", rec->cpu, rec->type);
+        break;
+    }
+}
+
+//
+// Преобразование двоичной трассы в текст.
+// Возвращает false при неверном формате файла.
+//
+bool svs_trace_decode(FILE *input, FILE *output)
+{
+    struct ElSvsTraceRecord rec;
+    char text[256 + sizeof(rec)];
+    unsigned i;
+
+    while (fread(&rec, sizeof(rec), 1, input) == 1) {
+        if (rec.type == TRACE_HEADER) {
+            // Заголовок: может встретиться несколько раз,
+            // если файл дописывался.
+            if (rec.value != TRACE_MAGIC || rec.vaddr != TRACE_VERSION)
+                return false;
+            continue;
+        }
+        if (rec.type != TRACE_TEXT) {
+            svs_trace_print(output, &rec, NULL);
+            continue;
+        }
+
+        // Текст сообщения в следующих записях.
+        if (rec.vaddr > 256)
+            return false;
+        for (i = 0; i < rec.vaddr; i += sizeof(rec)) {
+            if (fread(&text[i], sizeof(rec), 1, input) != 1)
+                return false;
+        }
+        text[rec.vaddr] = 0;
+        svs_trace_print(output, &rec, text);
+    }
+    return true;
+}
+
+//
+// Порядковый номер кода операции: 0...077 для коротких команд,
+// 0100...0117 для длинных.
+//
+static unsigned opcode_index(unsigned opcode)
+{
+    return (opcode <= 077) ? opcode : 0100 + ((opcode >> 3) & 017);
+}
+
+//
+// Add opcode to the trace filter.
+//
+void ElSvsTraceFilterOpcode(ElSvsTraceFilter *filter, unsigned opcode)
+{
+    unsigned n = opcode_index(opcode);
+
+    filter->opcodes[n >> 6] |= 1ULL << (n & 63);
+}
+
+//
+// Set or remove the trace filter.
+//
+void ElSvsSetTraceFilter(struct ElSvsProcessor *cpu, const ElSvsTraceFilter *filter)
+{
+    if (filter) {
+        cpu->trace_filter = *filter;
+        cpu->trace_filter_on = true;
+    } else {
+        cpu->trace_filter_on = false;
+        svs_trace_enable(cpu, true);
+    }
+}
+
+//
+// Arm or remove the trace trigger.
+//
+void ElSvsSetTraceTrigger(struct ElSvsProcessor *cpu, const ElSvsTraceTrigger *trigger)
+{
+    if (trigger) {
+        cpu->trace_trigger = *trigger;
+        cpu->trace_trigger_on = true;
+        cpu->trace_armed = true;
+        cpu->trace_countdown = trigger->after;
+        svs_trace_enable(cpu, false);
+    } else {
+        cpu->trace_trigger_on = false;
+        cpu->trace_armed = false;
+        svs_trace_enable(cpu, true);
+    }
+}
+
+//
+// Событие запуска трассировки произошло: открываем окно.
+//
+void svs_trace_fire(struct ElSvsProcessor *cpu)
+{
+    cpu->trace_armed = false;
+    cpu->trace_remaining = cpu->trace_trigger.duration;
+    svs_trace_enable(cpu, true);
+}
+
+//
+// Проверка запуска и остановки трассировки перед очередной командой.
+//
+static bool trigger_check(struct ElSvsProcessor *cpu)
+{
+    ElSvsTraceTrigger *t = &cpu->trace_trigger;
+
+    if (! cpu->trace_armed) {
+        // Окно трассировки открыто.
+        if (t->duration == 0 || cpu->trace_remaining-- > 0)
+            return true;
+
+        // Окно закрылось: ждём следующего события.
+        if (! t->repeat) {
+            t->on_pc = 0;
+            t->after = 0;
+            t->on_exception = 0;
+            t->on_write = 0;
+        }
+        cpu->trace_armed = true;
+        cpu->trace_countdown = t->after;
+    }
+    if (! (t->after && cpu->trace_countdown-- == 0) &&
+        ! (t->on_pc && cpu->core.PC == t->pc))
+        return false;
+
+    // Эта команда - первая в окне.
+    svs_trace_fire(cpu);
+    if (t->duration)
+        cpu->trace_remaining--;
+    return true;
+}
+
+//
+// Выбор режимов трассировки для очередной команды,
+// по событиям запуска и фильтру.
+//
+void svs_trace_select(struct ElSvsProcessor *cpu)
+{
+    bool on = true;
+
+    if (cpu->trace_trigger_on)
+        on = trigger_check(cpu);
+    if (on && cpu->trace_filter_on)
+        on = svs_trace_match(cpu, -1, -1);
+    svs_trace_enable(cpu, on);
+}
+
+//
+// Включить или отключить заданные режимы трассировки.
+//
+void svs_trace_enable(struct ElSvsProcessor *cpu, bool on)
+{
+    unsigned flags = on ? cpu->trace_flags : 0;
+
+    cpu->trace_instructions = (flags & TRACE_FLAG_INSTRUCTIONS) != 0;
+    cpu->trace_extracodes = (flags & TRACE_FLAG_EXTRACODES) != 0;
+    cpu->trace_fetch = (flags & TRACE_FLAG_FETCH) != 0;
+    cpu->trace_memory = (flags & TRACE_FLAG_MEMORY) != 0;
+    cpu->trace_exceptions = (flags & TRACE_FLAG_EXCEPTIONS) != 0;
+    cpu->trace_registers = (flags & TRACE_FLAG_REGISTERS) != 0;
+}
+
+//
+// Проверка команды по фильтру трассировки.
+// До выборки команды физический адрес и код операции неизвестны:
+// paddr и opcode равны -1, и проверяется только то, что известно.
+//
+bool svs_trace_match(struct ElSvsProcessor *cpu, int paddr, int opcode)
+{
+    const ElSvsTraceFilter *f = &cpu->trace_filter;
+    unsigned i, addr;
+
+    if (f->cpus && ! (f->cpus & (1u << cpu->index)))
+        return false;
+    if (f->modes) {
+        unsigned mode = IS_SUPERVISOR(cpu->core.RUU) ?
+            ELSVS_TRACE_SUPERVISOR : ELSVS_TRACE_USER;
+        if (! (f->modes & mode))
+            return false;
+    }
+    if (opcode >= 0 && (f->opcodes[0] | f->opcodes[1])) {
+        unsigned n = opcode_index(opcode);
+        if (! ((f->opcodes[n >> 6] >> (n & 63)) & 1))
+            return false;
+    }
+    if (f->nranges == 0)
+        return true;
+    for (i = 0; i < f->nranges && i < ELSVS_TRACE_MAXRANGES; i++) {
+        if (f->range[i].physical) {
+            if (paddr < 0)
+                return true;                    // проверим после выборки
+            addr = paddr;
+        } else {
+            addr = cpu->core.PC;
+        }
+        if (addr >= f->range[i].lo && addr <= f->range[i].hi)
+            return true;
+    }
+    return false;
+}
+
+//
+// Регистр изменился: запись в трассу.
+//
+static void trace_reg(struct ElSvsProcessor *cpu, int id, uint64_t value)
+{
+    struct ElSvsTraceRecord rec = {
+        .type = TRACE_REG, .cpu = cpu->index, .vaddr = id, .value = value,
+    };
+    svs_trace_emit(cpu, &rec);
+}
+
 //
 // Печать регистров процессора, изменившихся с прошлого вызова.
+// Редко меняющиеся регистры сравниваются, только когда
+// установлен признак записи в них.
 //
 void svs_trace_registers(struct ElSvsProcessor *cpu)
 {
+    uint64_t dirty = cpu->dirty;
     int i;
 
-    if (cpu->core.ACC != cpu->prev.ACC) {
-        fprintf(cpu->log_output, "cpu%d       Write ACC = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.ACC);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.RMR != cpu->prev.RMR) {
-        fprintf(cpu->log_output, "cpu%d       Write RMR = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.RMR);
-        fprintf(cpu->log_output, "\n");
-    }
+    if (cpu->core.ACC != cpu->prev.ACC)
+        trace_reg(cpu, REG_ACC, cpu->core.ACC);
+    if (cpu->core.RMR != cpu->prev.RMR)
+        trace_reg(cpu, REG_RMR, cpu->core.RMR);
     for (i = 0; i < SVS_NREGS; i++) {
-        if (cpu->core.M[i] != cpu->prev.M[i])
-            fprintf(cpu->log_output, "cpu%d       Write M%o = %05o\n",
-                cpu->index, i, cpu->core.M[i]);
+        if (cpu->core.M[i] != cpu->prev.M[i]) {
+            trace_reg(cpu, REG_M + i, cpu->core.M[i]);
+            cpu->prev.M[i] = cpu->core.M[i];
+        }
     }
     if (cpu->core.RAU != cpu->prev.RAU)
-        fprintf(cpu->log_output, "cpu%d       Write RAU = %02o\n",
-            cpu->index, cpu->core.RAU);
+        trace_reg(cpu, REG_RAU, cpu->core.RAU);
     if ((cpu->core.RUU & ~RUU_RIGHT_INSTR) != (cpu->prev.RUU & ~RUU_RIGHT_INSTR))
-        fprintf(cpu->log_output, "cpu%d       Write RUU = %03o\n",
-            cpu->index, cpu->core.RUU);
-    for (i = 0; i < 8; i++) {
-        if (cpu->core.RP[i] != cpu->prev.RP[i]) {
-            fprintf(cpu->log_output, "cpu%d       Write RP%o = ",
-                cpu->index, i);
-            svs_fprint_48bits(cpu->log_output, cpu->core.RP[i]);
-            fprintf(cpu->log_output, "\n");
-        }
-        if (cpu->core.RPS[i] != cpu->prev.RPS[i]) {
-            fprintf(cpu->log_output, "cpu%d       Write RPS%o = ",
-                cpu->index, i);
-            svs_fprint_48bits(cpu->log_output, cpu->core.RPS[i]);
-            fprintf(cpu->log_output, "\n");
+        trace_reg(cpu, REG_RUU, cpu->core.RUU);
+    if (dirty & DIRTY_RP) {
+        for (i = 0; i < 8; i++) {
+            if (cpu->core.RP[i] != cpu->prev.RP[i])
+                trace_reg(cpu, REG_RP + i, cpu->core.RP[i]);
+            if (cpu->core.RPS[i] != cpu->prev.RPS[i])
+                trace_reg(cpu, REG_RPS + i, cpu->core.RPS[i]);
         }
+        if (cpu->core.RZ != cpu->prev.RZ)
+            trace_reg(cpu, REG_RZ, cpu->core.RZ);
+        memcpy(cpu->prev.RP, cpu->core.RP, sizeof(cpu->prev.RP));
+        memcpy(cpu->prev.RPS, cpu->core.RPS, sizeof(cpu->prev.RPS));
+        cpu->prev.RZ = cpu->core.RZ;
+    }
+    if (cpu->core.bad_addr != cpu->prev.bad_addr)
+        trace_reg(cpu, REG_EADDR, cpu->core.bad_addr);
+    if (cpu->core.TagR != cpu->prev.TagR)
+        trace_reg(cpu, REG_TAG, cpu->core.TagR);
+    if (dirty & DIRTY_CTRL) {
+        if (cpu->core.PP != cpu->prev.PP)
+            trace_reg(cpu, REG_PP, cpu->core.PP);
+        if (cpu->core.OPP != cpu->prev.OPP)
+            trace_reg(cpu, REG_OPP, cpu->core.OPP);
+        if (cpu->core.POP != cpu->prev.POP)
+            trace_reg(cpu, REG_POP, cpu->core.POP);
+        if (cpu->core.OPOP != cpu->prev.OPOP)
+            trace_reg(cpu, REG_OPOP, cpu->core.OPOP);
+        if (cpu->core.RKP != cpu->prev.RKP)
+            trace_reg(cpu, REG_RKP, cpu->core.RKP);
+        if (cpu->core.RPR != cpu->prev.RPR)
+            trace_reg(cpu, REG_RPR, cpu->core.RPR);
+    }
+    if (cpu->core.GRVP != cpu->prev.GRVP)
+        trace_reg(cpu, REG_GRVP, cpu->core.GRVP);
+    if ((dirty & DIRTY_CTRL) && cpu->core.GRM != cpu->prev.GRM)
+        trace_reg(cpu, REG_GRM, cpu->core.GRM);
+
+    cpu->prev.ACC = cpu->core.ACC;
+    cpu->prev.RMR = cpu->core.RMR;
+    cpu->prev.RAU = cpu->core.RAU;
+    cpu->prev.RUU = cpu->core.RUU;
+    cpu->prev.bad_addr = cpu->core.bad_addr;
+    cpu->prev.TagR = cpu->core.TagR;
+    cpu->prev.GRVP = cpu->core.GRVP;
+    if (dirty & DIRTY_CTRL) {
+        cpu->prev.PP = cpu->core.PP;
+        cpu->prev.OPP = cpu->core.OPP;
+        cpu->prev.POP = cpu->core.POP;
+        cpu->prev.OPOP = cpu->core.OPOP;
+        cpu->prev.RKP = cpu->core.RKP;
+        cpu->prev.RPR = cpu->core.RPR;
+        cpu->prev.GRM = cpu->core.GRM;
     }
-    if (cpu->core.RZ != cpu->prev.RZ) {
-        fprintf(cpu->log_output, "cpu%d       Write RZ = ", cpu->index);
-        fprint_32bits(cpu->log_output, cpu->core.RZ);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.bad_addr != cpu->prev.bad_addr) {
-        fprintf(cpu->log_output, "cpu%d       Write EADDR = %03o\n",
-            cpu->index, cpu->core.bad_addr);
-    }
-    if (cpu->core.TagR != cpu->prev.TagR) {
-        fprintf(cpu->log_output, "cpu%d       Write TAG = %03o\n",
-            cpu->index, cpu->core.TagR);
-    }
-    if (cpu->core.PP != cpu->prev.PP) {
-        fprintf(cpu->log_output, "cpu%d       Write PP = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.PP);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.OPP != cpu->prev.OPP) {
-        fprintf(cpu->log_output, "cpu%d       Write OPP = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.OPP);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.POP != cpu->prev.POP) {
-        fprintf(cpu->log_output, "cpu%d       Write POP = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.POP);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.OPOP != cpu->prev.OPOP) {
-        fprintf(cpu->log_output, "cpu%d       Write OPOP = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.OPOP);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.RKP != cpu->prev.RKP) {
-        fprintf(cpu->log_output, "cpu%d       Write RKP = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.RKP);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.RPR != cpu->prev.RPR) {
-        fprintf(cpu->log_output, "cpu%d       Write RPR = ", cpu->index);
-        svs_fprint_48bits(cpu->log_output, cpu->core.RPR);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.GRVP != cpu->prev.GRVP) {
-        fprintf(cpu->log_output, "cpu%d       Write GRVP = ", cpu->index);
-        fprint_32bits(cpu->log_output, cpu->core.GRVP);
-        fprintf(cpu->log_output, "\n");
-    }
-    if (cpu->core.GRM != cpu->prev.GRM) {
-        fprintf(cpu->log_output, "cpu%d       Write GRM = ", cpu->index);
-        fprint_32bits(cpu->log_output, cpu->core.GRM);
-        fprintf(cpu->log_output, "\n");
-    }
-
-    cpu->prev = cpu->core;
+    cpu->dirty = 0;
 }
@@ -0,0 +1,365 @@
+/*
+ * SVS trace output in a background thread.
+ *
+ * Copyright (c) 2022 Leonid Broukhis, Serge Vakulenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _DEFAULT_SOURCE
+#include "el_svs_internal.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//
+// Каждый процессор помещает записи трассы в свою очередь
+// с одним писателем и одним читателем, без блокировок.
+// Фоновый поток забирает записи из всех очередей в порядке
+// глобальных номеров, форматирует и выводит в файлы.
+// Процессоры, пишущие в один файл, используют общий FILE.
+//
+#define QUEUE_SIZE      65536           // записей в очереди, степень двойки
+#define IDLE_USEC       100             // пауза фонового потока без работы
+
+struct trace_file {
+    struct trace_file *next;
+    char *name;                         // имя файла
+    FILE *output;                       // открытый файл
+    bool binary;                        // двоичный формат
+    int refs;                           // число очередей
+};
+
+struct trace_entry {
+    uint64_t seq;                       // глобальный номер события
+    struct ElSvsTraceRecord rec;
+};
+
+struct ElSvsTraceQueue {
+    struct ElSvsTraceQueue *next;
+    struct trace_file *file;            // куда выводить
+    int cpu;                            // номер процессора
+    bool drop;                          // при переполнении терять записи
+    atomic_size_t head;                 // индекс чтения, меняет фоновый поток
+    atomic_size_t tail;                 // индекс записи, меняет процессор
+    atomic_ulong dropped;               // число потерянных записей
+    unsigned long reported;             // сколько потерь уже выдано
+    struct trace_entry entry[QUEUE_SIZE];
+};
+
+static struct {
+    pthread_mutex_t lock;               // список очередей и файлов
+    pthread_cond_t wakeup;              // появилась очередь
+    bool started;                       // поток запущен
+    struct ElSvsTraceQueue *queues;     // активные очереди
+    struct trace_file *files;           // открытые файлы
+    uint64_t next_seq;                  // номер следующего выводимого события
+} writer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+};
+
+static atomic_uint_fast64_t global_seq; // счётчик событий всех процессоров
+
+static void pause_usec(long usec)
+{
+    struct timespec ts = { 0, usec * 1000 };
+
+    nanosleep(&ts, NULL);
+}
+
+//
+// Вывод записи в файл, текстом или в двоичном виде.
+// Текст сообщения находится в записях, следующих за заголовком.
+//
+static void write_record(struct trace_file *file, const struct ElSvsTraceRecord *rec,
+    const char *text)
+{
+    if (file->binary) {
+        fwrite(rec, sizeof(*rec), 1, file->output);
+        if (rec->type == TRACE_TEXT) {
+            unsigned n = (rec->vaddr + sizeof(*rec) - 1) / sizeof(*rec);
+            fwrite(text, sizeof(*rec), n, file->output);
+        }
+        return;
+    }
+    svs_trace_print(file->output, rec, text);
+}
+
+//
+// Сообщение о потерянных записях.
+//
+static void report_dropped(struct ElSvsTraceQueue *q)
+{
+    unsigned long dropped = atomic_load_explicit(&q->dropped, memory_order_relaxed);
+    char text[256 + sizeof(struct ElSvsTraceRecord)];
+
+    if (dropped == q->reported)
+        return;
+    memset(text, 0, sizeof(text));
+    snprintf(text, 256, "cpu%d --- Потеряно записей трассы: %lu\n",
+        q->cpu, dropped - q->reported);
+    q->reported = dropped;
+
+    struct ElSvsTraceRecord rec = { .type = TRACE_TEXT, .cpu = q->cpu, .vaddr = strlen(text) };
+    write_record(q->file, &rec, text);
+}
+
+//
+// Вывести очередное по порядку событие, если оно уже в очереди.
+// Вызывается с захваченной блокировкой.
+//
+static bool write_next()
+{
+    struct ElSvsTraceQueue *q, *best = NULL;
+    uint64_t best_seq = 0;
+
+    // Ищем очередь с наименьшим номером в голове.
+    for (q = writer.queues; q; q = q->next) {
+        size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+        if (head == tail)
+            continue;
+        uint64_t seq = q->entry[head % QUEUE_SIZE].seq;
+        if (! best || seq < best_seq) {
+            best = q;
+            best_seq = seq;
+        }
+    }
+    if (! best)
+        return false;
+
+    // Событие с меньшим номером ещё не помещено в очередь
+    // другим процессором: ждём его.
+    if (best_seq > writer.next_seq)
+        return false;
+
+    size_t head = atomic_load_explicit(&best->head, memory_order_relaxed);
+    const struct ElSvsTraceRecord *rec = &best->entry[head % QUEUE_SIZE].rec;
+    unsigned i, npayload = 0;
+    char text[256 + sizeof(*rec)];
+
+    if (rec->type == TRACE_TEXT) {
+        // Сообщение помещается в очередь целиком, одной операцией.
+        npayload = (rec->vaddr + sizeof(*rec) - 1) / sizeof(*rec);
+        for (i = 0; i < npayload; i++)
+            memcpy(&text[i * sizeof(*rec)], &best->entry[(head + 1 + i) % QUEUE_SIZE].rec,
+                sizeof(*rec));
+        text[rec->vaddr] = 0;
+    }
+    report_dropped(best);
+    write_record(best->file, rec, text);
+    writer.next_seq = best_seq + 1;
+    atomic_store_explicit(&best->head, head + 1 + npayload, memory_order_release);
+    return true;
+}
+
+//
+// Фоновый поток вывода трассы.
+//
+static void *writer_thread(void *arg)
+{
+    struct trace_file *f;
+    int n;
+
+    pthread_mutex_lock(&writer.lock);
+    for (;;) {
+        while (! writer.queues)
+            pthread_cond_wait(&writer.wakeup, &writer.lock);
+
+        // Порция записей, затем даём возможность
+        // подключить или отключить очередь.
+        for (n = 0; n < 4096; n++) {
+            if (! write_next())
+                break;
+        }
+        if (n == 0) {
+            // Нет работы: сбрасываем файлы.
+            for (f = writer.files; f; f = f->next)
+                fflush(f->output);
+        }
+        pthread_mutex_unlock(&writer.lock);
+        if (n == 0)
+            pause_usec(IDLE_USEC);
+        else
+            sched_yield();
+        pthread_mutex_lock(&writer.lock);
+    }
+    return NULL;
+}
+
+//
+// Поместить в очередь запись и, для сообщения, следующие за ней записи текста.
+// Все записи получают один номер события.
+//
+void svs_trace_push(struct ElSvsProcessor *cpu, const struct ElSvsTraceRecord *rec, unsigned n)
+{
+    struct ElSvsTraceQueue *q = cpu->trace_queue;
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned i;
+
+    // Ждём, пока освободится место, или теряем запись.
+    while (tail + n - atomic_load_explicit(&q->head, memory_order_acquire) > QUEUE_SIZE) {
+        if (q->drop) {
+            atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        pause_usec(IDLE_USEC);
+    }
+
+    uint64_t seq = atomic_fetch_add_explicit(&global_seq, 1, memory_order_relaxed);
+    for (i = 0; i < n; i++) {
+        q->entry[(tail + i) % QUEUE_SIZE].seq = seq;
+        q->entry[(tail + i) % QUEUE_SIZE].rec = rec[i];
+    }
+    atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+}
+
+//
+// Подключить процессор к фоновому выводу трассы в файл.
+// Без имени файла трасса выводится на stdout.
+//
+void svs_trace_async_start(struct ElSvsProcessor *cpu, const char *filename, bool binary, bool drop)
+{
+    struct ElSvsTraceQueue *q = calloc(1, sizeof(struct ElSvsTraceQueue));
+    struct trace_file *f;
+
+    if (! q) {
+        perror(__func__);
+        abort();
+    }
+    if (! filename || ! filename[0])
+        filename = "";
+    q->cpu = cpu->index;
+    q->drop = drop;
+
+    pthread_mutex_lock(&writer.lock);
+    for (f = writer.files; f; f = f->next) {
+        if (strcmp(f->name, filename) == 0)
+            break;
+    }
+    if (! f) {
+        f = calloc(1, sizeof(struct trace_file));
+        if (! f) {
+            perror(__func__);
+            abort();
+        }
+        f->name = strdup(filename);
+        f->binary = binary;
+        if (filename[0]) {
+            f->output = fopen(filename, "a");
+            if (! f->output) {
+                perror(filename);
+                exit(1);
+            }
+        } else {
+            f->output = stdout;
+        }
+        if (binary) {
+            struct ElSvsTraceRecord rec = {
+                .type = TRACE_HEADER, .cpu = cpu->index,
+                .vaddr = TRACE_VERSION, .value = TRACE_MAGIC,
+            };
+            fwrite(&rec, sizeof(rec), 1, f->output);
+        }
+        f->next = writer.files;
+        writer.files = f;
+    }
+    f->refs++;
+    q->file = f;
+
+    q->next = writer.queues;
+    writer.queues = q;
+    if (! writer.started) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, writer_thread, NULL) != 0) {
+            perror(__func__);
+            abort();
+        }
+        pthread_detach(thread);
+        writer.started = true;
+    }
+    pthread_cond_signal(&writer.wakeup);
+    pthread_mutex_unlock(&writer.lock);
+
+    cpu->trace_queue = q;
+}
+
+//
+// Отключить процессор от фонового вывода.
+// Дожидаемся вывода всех записей, закрываем файл после последнего процессора.
+//
+void svs_trace_async_stop(struct ElSvsProcessor *cpu)
+{
+    struct ElSvsTraceQueue *q = cpu->trace_queue, **qp;
+    struct trace_file *f, **fp;
+
+    if (! q)
+        return;
+    cpu->trace_queue = NULL;
+
+    while (atomic_load_explicit(&q->head, memory_order_acquire) !=
+           atomic_load_explicit(&q->tail, memory_order_relaxed))
+        pause_usec(IDLE_USEC);
+
+    pthread_mutex_lock(&writer.lock);
+    report_dropped(q);
+    for (qp = &writer.queues; *qp; qp = &(*qp)->next) {
+        if (*qp == q) {
+            *qp = q->next;
+            break;
+        }
+    }
+    f = q->file;
+    if (--f->refs == 0) {
+        for (fp = &writer.files; *fp; fp = &(*fp)->next) {
+            if (*fp == f) {
+                *fp = f->next;
+                break;
+            }
+        }
+        if (f->output != stdout)
+            fclose(f->output);
+        else
+            fflush(f->output);
+        free(f->name);
+        free(f);
+    } else {
+        fflush(f->output);
+    }
+    pthread_mutex_unlock(&writer.lock);
+    free(q);
+}
+
+//
+// В дочернем процессе после fork: фонового потока нет,
+// очереди и файлы родителя не используются.
+//
+void svs_trace_async_forked(void)
+{
+    pthread_mutex_init(&writer.lock, NULL);
+    pthread_cond_init(&writer.wakeup, NULL);
+    writer.started = false;
+    writer.queues = NULL;
+    writer.files = NULL;
+}
@@ -25,13 +25,23 @@
  *
  * svs_load()   - Load memory from file.
  * svs_dump()   - Dump memory to file.
+ *
+ * and their counterparts for binary images:
+ *
+ * svs_load_image()  - Load memory from binary image.
+ * svs_dump_image()  - Dump memory to binary image.
  */
+#define _DEFAULT_SOURCE
 #include "el_master_api.h"
 #include "el_svs_api.h"
 #include "el_svs_internal.h"
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static const char *opname_short_bemsh[64] = {
     "зп",  "зпм", "рег", "счм", "сл",  "вч",  "вчоб","вчаб",
@@ -376,6 +386,62 @@ void svs_fprint_cmd(FILE *of, uint32_t cmd)
     }
 }
 
+//
+// Пара команд слова и её число, для сортировки.
+//
+struct pair_count {
+    uint64_t count;
+    int left, right;                    // коды операций
+};
+
+static int compare_pairs(const void *a, const void *b)
+{
+    const struct pair_count *x = a, *y = b;
+
+    if (x->count != y->count)
+        return (x->count < y->count) ? 1 : -1;
+    if (x->left != y->left)
+        return x->left - y->left;
+    return x->right - y->right;
+}
+
+//
+// Печать самых частых пар команд слова, по убыванию числа,
+// делённого на scale.  Выдаётся не больше count пар.
+//
+void svs_fprint_pairs(FILE *of, const ElSvsPairStats *stats, unsigned count, double scale)
+{
+    struct pair_count *pair = malloc(0120 * 0120 * sizeof(pair[0]));
+    unsigned n = 0, l, r;
+
+    if (! pair)
+        return;
+    for (l = 0; l < 0120; l++) {
+        for (r = 0; r < 0120; r++) {
+            if (stats->pairs[l][r] == 0)
+                continue;
+            pair[n].count = stats->pairs[l][r];
+            pair[n].left = (l & 0100) ? 0200 | (l & 017) << 3 : l;
+            pair[n].right = (r & 0100) ? 0200 | (r & 017) << 3 : r;
+            n++;
+        }
+    }
+    qsort(pair, n, sizeof(pair[0]), compare_pairs);
+    for (r = 0; r < n && r < count; r++) {
+        char name[32];
+        int len, width = 0;
+
+        // Ширина поля в символах, а не в байтах UTF-8.
+        len = snprintf(name, sizeof(name), "%s, %s",
+                       svs_opname(pair[r].left), svs_opname(pair[r].right));
+        for (l = 0; l < (unsigned) len && name[l]; l++)
+            if ((name[l] & 0xc0) != 0x80)
+                width++;
+        fprintf(of, "  %s%*s %.1f\n", name, 20 - width, "", pair[r].count / scale);
+    }
+    free(pair);
+}
+
 //
 // Печать машинной инструкции в восьмеричном виде.
 //
@@ -412,12 +478,17 @@ uint64_t ElSvsAsm(const char *src)
 // с 0123 4567 0123 4567       - восьмеричное слово
 // к 00 22 00000 00 010 0000   - команды
 //
-static bool svs_read_line(FILE *input, int *type, uint64_t *val)
+// Формат .oct, адрес слова задан в самой строке (возвращается в addrp):
+// i 00010 уиа -5(1), э70 2002  - команды
+// d 02000 5156 6065 6443 4154  - восьмеричное слово
+//
+static bool svs_read_line(FILE *input, int *type, uint64_t *val, int *addrp)
 {
     char buf[512];
     const char *p;
     int i, c;
 again:
+    *addrp = -1;
     if (! fgets(buf, sizeof(buf), input)) {
         *type = 0;
         return true;
@@ -426,6 +497,16 @@ again:
     if (*p == '\n' || *p == ';')
         goto again;
     c = utf8_to_unicode(&p);
+    if (c == 'i' || c == 'I' || c == 'd' || c == 'D') {
+        // Адрес слова в формате .oct.
+        char *eptr;
+
+        *addrp = strtol(p, &eptr, 8);
+        if (eptr == p)
+            goto bad;
+        p = eptr;
+        c = (c == 'i' || c == 'I') ? CYRILLIC_SMALL_LETTER_KA : CYRILLIC_SMALL_LETTER_ES;
+    }
     if (c == CYRILLIC_SMALL_LETTER_VE ||
         c == CYRILLIC_CAPITAL_LETTER_VE ||
         c == 'b' || c == 'B') {
@@ -489,15 +570,26 @@ bad:
 //
 bool svs_load(struct ElSvsProcessor *cpu, FILE *input)
 {
-    int addr, type;
+    int addr, type, line_addr;
     uint64_t word;
+    bool start_seen = false;
 
     addr = 1;
     cpu->core.PC = 1;
     for (;;) {
-        if (!svs_read_line(input, &type, &word))
+        if (!svs_read_line(input, &type, &word, &line_addr))
             return false;
 
+        if (line_addr >= 0) {
+            addr = line_addr;
+
+            // В файле .oct нет адреса пуска:
+            // выполнение начинается с первой команды.
+            if (type == '*' && !start_seen) {
+                cpu->core.PC = addr;
+                start_seen = true;
+            }
+        }
         switch (type) {
         case 0:                 // EOF
             return true;
@@ -516,6 +608,7 @@ bool svs_load(struct ElSvsProcessor *cpu, FILE *input)
             break;
         case '@':               // start address
             cpu->core.PC = (uint32_t)word;
+            start_seen = true;
             break;
         }
         if (addr > SVS_MEMSIZE)
@@ -570,4 +663,86 @@ void svs_dump(struct ElSvsProcessor *cpu, FILE *of, const char *fnam)
             fprintf(of, "\t\t; %05o\n", addr);
         }
     }
+    fprintf(of, "\nп %05o\n", cpu->core.PC);
+}
+
+//
+// Двоичный образ памяти: общий заголовок, адрес пуска
+// и тумблерные регистры, затем участки слов, как в снимке памяти.
+//
+struct image_header {
+    struct svs_memory_header memory;    // SVS_IMAGE_MAGIC
+    uint32_t start;                     // адрес пуска
+    uint64_t pult[8];                   // тумблерные регистры
+};
+
+#define IMAGE_VERSION   3
+
+//
+// Load memory from binary image.  The file is mapped, and runs
+// of words go into RAM by blocks right from the mapping.
+//
+bool svs_load_image(struct ElSvsProcessor *cpu, const char *filename)
+{
+    const struct image_header *header;
+    struct stat st;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*header)) {
+        close(fd);
+        fprintf(stderr, "%s: Bad image\n", filename);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        return false;
+    }
+    header = map;
+    bool ok = memcmp(header->memory.magic, SVS_IMAGE_MAGIC, sizeof(header->memory.magic)) == 0 &&
+              header->memory.version == IMAGE_VERSION &&
+              header->memory.size == SVS_MEMSIZE &&
+              svs_memory_load_runs(header + 1, st.st_size - sizeof(*header), 010);
+    if (ok) {
+        memcpy(&cpu->pult[1], &header->pult[1], 7 * sizeof(cpu->pult[0]));
+        cpu->core.PC = header->start;
+    }
+    munmap(map, st.st_size);
+    if (! ok) {
+        fprintf(stderr, "%s: Bad image\n", filename);
+        return false;
+    }
+    return true;
+}
+
+//
+// Dump memory to binary image: non-zero words, in runs.
+//
+bool svs_dump_image(struct ElSvsProcessor *cpu, const char *filename)
+{
+    struct image_header header;
+
+    FILE *output = fopen(filename, "w");
+    if (! output) {
+        perror(filename);
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.memory.magic, SVS_IMAGE_MAGIC, sizeof(header.memory.magic));
+    header.memory.version = IMAGE_VERSION;
+    header.memory.size = SVS_MEMSIZE;
+    header.start = cpu->core.PC;
+    memcpy(header.pult, cpu->pult, sizeof(header.pult));
+    bool ok = fwrite(&header, sizeof(header), 1, output) == 1 &&
+              svs_memory_write_runs(output, 010);
+    if (fclose(output) != 0)
+        ok = false;
+    if (! ok)
+        perror(filename);
+    return ok;
 }
@@ -0,0 +1,122 @@
+/*
+ * Ahead-of-time translation of a memory image of SVS processor
+ * into C code, built as a shared object for ElSvsAotLoad().
+ *
+ * Blocks are found by following jumps from the start address
+ * of the image and from addresses given by -e; with -a every word
+ * of code starts a block.  Output ending in .c is left as source,
+ * otherwise the source is written next to it and compiled.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "el_master_api.h"
+#include "el_master_ram.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+//
+// Physical memory for the image: only pages in use are allocated.
+//
+static struct ElMasterRam *ram;
+
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return elMasterRamRead(ram, address, pTag, pWord);
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return elMasterRamWrite(ram, address, tag, word);
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: svsaot [-a] [-e addr]... input.oct|input.img output.so|output.c\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -a          start a block at every word of code\n");
+    fprintf(stderr, "  -e addr     entry address, octal; default start address of image\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned entry[32768];
+    unsigned nentries = 0;
+    bool all = false;
+    char magic[8];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ae:")) != -1) {
+        switch (opt) {
+        case 'a': all = true; break;
+        case 'e': entry[nentries++ & BITS(15)] = strtoul(optarg, NULL, 8) & BITS(15); break;
+        default:  usage();
+        }
+    }
+    if (argc - optind != 2)
+        usage();
+    const char *input_name = argv[optind];
+    const char *output_name = argv[optind + 1];
+
+    // Образ в тексте или в двоичном виде.
+    FILE *input = fopen(input_name, "r");
+    if (! input) {
+        perror(input_name);
+        return 1;
+    }
+    bool binary = fread(magic, sizeof(magic), 1, input) == 1 &&
+                  memcmp(magic, SVS_IMAGE_MAGIC, sizeof(magic)) == 0;
+    rewind(input);
+
+    ram = elMasterRamAllocate();
+    if (! ram) {
+        perror("svsaot");
+        return 1;
+    }
+    struct ElSvsProcessor *cpu = ElSvsAllocate(0);
+    if (binary ? ! svs_load_image(cpu, input_name) : ! svs_load(cpu, input)) {
+        fprintf(stderr, "%s: Bad input\n", input_name);
+        return 1;
+    }
+    fclose(input);
+    if (nentries == 0)
+        entry[nentries++] = cpu->core.PC;
+
+    // Текст на Си рядом с объектом.
+    size_t len = strlen(output_name);
+    bool source_only = len > 2 && strcmp(output_name + len - 2, ".c") == 0;
+    char *source = malloc(len + 3);
+    if (! source) {
+        perror("svsaot");
+        return 1;
+    }
+    strcpy(source, output_name);
+    if (! source_only)
+        strcat(source, ".c");
+
+    FILE *output = fopen(source, "w");
+    if (! output) {
+        perror(source);
+        return 1;
+    }
+    unsigned nblocks = svs_aot_translate(output, input_name, entry, nentries, all);
+    if (fclose(output) != 0) {
+        perror(source);
+        return 1;
+    }
+    printf("%s: %u blocks\n", source, nblocks);
+
+    if (! source_only && ! svs_aot_compile(source, output_name)) {
+        fprintf(stderr, "%s: Compilation failed\n", source);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,401 @@
+/*
+ * Differential fuzzing of execution engines of the SVS processor.
+ *
+ * Random programs are generated: valid instructions with addresses
+ * mostly in small code and data windows, random data and registers.
+ * Each program runs under two engines from the same initial state,
+ * in blocks of instructions; after every block the processor state,
+ * the stop status and the whole memory are compared.
+ * Programs run in several threads, each with its own memory.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "el_master_api.h"
+#include "el_master_ram.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+#define CODE_BASE       010             // начало программы
+#define CODE_SIZE       0400            // слов программы
+#define VECTOR_BASE     0500            // входы экстракодов и прерываний
+#define VECTOR_SIZE     0100
+#define DATA_BASE       02000           // данные
+#define DATA_SIZE       0400
+
+//
+// Physical memory of the engine running in this thread.
+//
+static _Thread_local struct ElMasterRam *ram;
+
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return elMasterRamRead(ram, address, pTag, pWord);
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return elMasterRamWrite(ram, address, tag, word);
+}
+
+//
+// Options.
+//
+static const struct ElSvsEngine *engine_a, *engine_b;
+static uint64_t seed;
+static uint64_t max_cases;              // 0 - no limit
+static double duration = 10;            // seconds
+static uint64_t block_size = 1000;      // instructions between comparisons
+static unsigned nblocks = 16;           // blocks per program
+static FILE *devnull;                   // output of stopped processors
+
+//
+// Shared progress.
+//
+static atomic_uint_fast64_t next_case;
+static atomic_bool failed;
+static struct timespec t_start;
+
+struct worker {
+    pthread_t thread;
+    uint64_t cases;
+    uint64_t instructions;
+};
+
+//
+// Генератор случайных чисел splitmix64.
+//
+static uint64_t rnd(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+//
+// Случайный исполнительный адрес: чаще в окнах данных и программы.
+//
+static unsigned random_addr(uint64_t *r)
+{
+    uint64_t x = rnd(r);
+
+    switch (x & 7) {
+    case 0: case 1: case 2: case 3:
+        return DATA_BASE + (x >> 3) % DATA_SIZE;
+    case 4: case 5:
+        return CODE_BASE + (x >> 3) % CODE_SIZE;
+    case 6:
+        return (x >> 3) & 077;
+    default:
+        return (x >> 3) & BITS(15);
+    }
+}
+
+//
+// Случайная допустимая команда.  Не генерируются соп и экстракоды
+// э20, э21, э47: они обращаются к внешним устройствам.
+// Экстракоды э50...э77 переходят на случайный код по адресу 0500+.
+// Стоп и выпр редки, чтобы программа не кончалась слишком рано;
+// рег обращается чаще к известным регистрам процессора.
+//
+static uint32_t random_insn(uint64_t *r)
+{
+    static const unsigned long_op[] = {
+        0220, 0230, 0240, 0250, 0260, 0270, 0300, 0310, 0340, 0350, 0360, 0370,
+    };
+    static const unsigned reg_addr[] = {
+        020, 021, 022, 023, 024, 025, 026, 027, 030, 031, 032, 033,
+        037, 044, 046, 047, 050, 052, 053, 054, 060, 061, 062, 063,
+        064, 065, 066, 067, 0100, 0103, 0104, 0107, 0237, 0244, 0246, 0247,
+        0250, 0252, 0253, 0254,
+    };
+    uint64_t x = rnd(r);
+    unsigned reg = x & 017;
+    unsigned addr = random_addr(r);
+    unsigned op;
+
+    x >>= 4;
+    if ((x & 3) == 0) {
+        // Длинный формат.
+        if (((x >> 2) & 0177) == 0)
+            op = (x & 01000) ? 0330 : 0320;         // стоп, выпр
+        else
+            op = long_op[(x >> 2) % (sizeof(long_op) / sizeof(long_op[0]))];
+        return reg << 20 | op << 12 | (addr & BITS(15));
+    }
+    x >>= 2;
+    if ((x & 037) == 0) {
+        // Экстракод э50...э77, кроме э75.
+        op = 050 + (x >> 5) % 030;
+        if (op == 075)
+            op = 074;
+    } else if ((x & 037) == 1) {
+        // Рег без модификации, по адресу регистра.
+        addr = reg_addr[(x >> 5) % (sizeof(reg_addr) / sizeof(reg_addr[0]))];
+        return 002 << 12 | addr;
+    } else {
+        // Короткий формат, 000...045 кроме рег.
+        op = (x >> 5) % 045;
+        if (op >= 002)
+            op++;
+    }
+    if (addr >= 070000)
+        return reg << 20 | BBIT(19) | op << 12 | (addr & 07777);
+    return reg << 20 | op << 12 | (addr & 07777);
+}
+
+//
+// Запись слова в память обоих механизмов.
+//
+static void put(struct ElMasterRam *a, struct ElMasterRam *b,
+                unsigned addr, ElMasterTag tag, ElMasterWord word)
+{
+    elMasterRamWrite(a, addr, tag, word << 16);
+    elMasterRamWrite(b, addr, tag, word << 16);
+}
+
+//
+// Случайная программа, данные и начальное состояние процессора.
+//
+static void generate(uint64_t *r, struct ElSvsProcessor *cpu,
+                     struct ElMasterRam *a, struct ElMasterRam *b)
+{
+    unsigned i;
+
+    elMasterRamClear(a);
+    elMasterRamClear(b);
+    for (i = 0; i < CODE_SIZE; i++)
+        put(a, b, CODE_BASE + i, 035,
+            (uint64_t) random_insn(r) << 24 | random_insn(r));
+    for (i = 0; i < VECTOR_SIZE; i++)
+        put(a, b, VECTOR_BASE + i, 035,
+            (uint64_t) random_insn(r) << 24 | random_insn(r));
+    for (i = 0; i < DATA_SIZE; i++)
+        put(a, b, DATA_BASE + i, 036, rnd(r) & BITS48);
+
+    cpu->core.ACC = rnd(r) & BITS48;
+    cpu->core.RMR = rnd(r) & BITS48;
+    cpu->core.RAU = rnd(r) & 077;
+    for (i = 1; i < 16; i++)
+        cpu->core.M[i] = rnd(r) & BITS(15);
+    if (rnd(r) & 1) {
+        // Прерывания передаются программе, без останова.
+        cpu->core.M[PSW] &= ~(PSW_INTR_HALT | PSW_CHECK_HALT);
+    }
+    cpu->core.PC = CODE_BASE;
+}
+
+//
+// Run one program under both engines.
+// Return false on divergence.
+//
+static bool run_case(struct worker *w, uint64_t number, bool trace)
+{
+    static _Thread_local struct ElMasterRam *ram_a, *ram_b;
+    uint64_t r = seed ^ (number * 0xd1b54a32d192ed03ULL);
+    char what[128];
+    unsigned block;
+    uint64_t icount;
+    bool ok = true;
+
+    if (! ram_a) {
+        ram_a = elMasterRamAllocate();
+        ram_b = elMasterRamAllocate();
+        if (! ram_a || ! ram_b) {
+            perror("svsfuzz");
+            exit(1);
+        }
+    }
+    struct ElSvsProcessor *a = ElSvsAllocate(0);
+    struct ElSvsProcessor *b = ElSvsAllocate(0);
+    generate(&r, a, ram_a, ram_b);
+    ElSvsCopyState(b, a);
+    if (! trace) {
+        a->log_output = devnull;
+        b->log_output = devnull;
+    }
+    icount = a->icount;
+    if (trace) {
+        unlink("fuzz-a.output");
+        unlink("fuzz-b.output");
+        ram = ram_a;
+        ElSvsSetTrace(a, "imr", "fuzz-a.output");
+        ram = ram_b;
+        ElSvsSetTrace(b, "imr", "fuzz-b.output");
+    }
+
+    for (block = 0; block < nblocks; block++) {
+        ram = ram_a;
+        ElSvsStatus status_a = engine_a->run(a, block_size);
+        ram = ram_b;
+        ElSvsStatus status_b = engine_b->run(b, block_size);
+
+        ElMasterRamAddress addr;
+        if (status_a != status_b) {
+            snprintf(what, sizeof(what), "status %d, expected %d", status_b, status_a);
+            ok = false;
+        } else if (! svs_engine_compare(a, b, what, sizeof(what))) {
+            ok = false;
+        } else if (! elMasterRamCompare(ram_a, ram_b, &addr)) {
+            snprintf(what, sizeof(what), "memory differs at %07o", addr);
+            ok = false;
+        }
+        if (! ok) {
+            printf("Case %llu, block %u, after %llu instructions: %s\n",
+                (unsigned long long) number, block,
+                (unsigned long long) a->icount, what);
+            printf("Reproduce with: svsfuzz -s %llu -r %llu -a %s -b %s\n",
+                (unsigned long long) seed, (unsigned long long) number,
+                engine_a->name, engine_b->name);
+            break;
+        }
+        if (status_a != ESS_OK) {
+            // Программа остановилась.
+            break;
+        }
+    }
+    w->instructions += a->icount - icount;
+    if (trace) {
+        ElSvsSetTrace(a, "", "");
+        ElSvsSetTrace(b, "", "");
+    }
+    ElSvsAotUnload(a);
+    ElSvsAotUnload(b);
+    free(a);
+    free(b);
+    w->cases++;
+    return ok;
+}
+
+static double elapsed()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t_start.tv_sec) + (now.tv_nsec - t_start.tv_nsec) * 1e-9;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+
+    while (! atomic_load(&failed) && elapsed() < duration) {
+        uint64_t number = atomic_fetch_add(&next_case, 1);
+
+        if (max_cases && number >= max_cases)
+            break;
+        if (! run_case(w, number, false))
+            atomic_store(&failed, true);
+    }
+    return NULL;
+}
+
+static void usage()
+{
+    const struct ElSvsEngine *e;
+
+    fprintf(stderr, "Usage: svsfuzz [options]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -a engine   reference engine, default %s\n", svs_engines[0].name);
+    fprintf(stderr, "  -b engine   engine under test, default %s\n", svs_engines[1].name);
+    fprintf(stderr, "  -j threads  number of threads, default number of cores\n");
+    fprintf(stderr, "  -t seconds  time limit, default %g\n", duration);
+    fprintf(stderr, "  -n cases    number of programs, default no limit\n");
+    fprintf(stderr, "  -k count    instructions between comparisons, default %llu\n",
+        (unsigned long long) block_size);
+    fprintf(stderr, "  -c count    comparisons per program, default %u\n", nblocks);
+    fprintf(stderr, "  -s seed     random seed, default from time\n");
+    fprintf(stderr, "  -r case     run one program, with trace to fuzz-a.output and fuzz-b.output\n");
+    fprintf(stderr, "Engines:\n");
+    for (e = svs_engines; e->name; e++)
+        fprintf(stderr, "  %-11s %s\n", e->name, e->description);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nthreads = (ncores > 0) ? ncores : 1;
+    const char *name_a = svs_engines[0].name;
+    const char *name_b = svs_engines[1].name;
+    int64_t replay = -1;
+    unsigned i;
+    int opt;
+
+    seed = time(NULL);
+    while ((opt = getopt(argc, argv, "a:b:j:t:n:k:c:s:r:")) != -1) {
+        switch (opt) {
+        case 'a': name_a = optarg; break;
+        case 'b': name_b = optarg; break;
+        case 'j': nthreads = atoi(optarg); break;
+        case 't': duration = atof(optarg); break;
+        case 'n': max_cases = strtoull(optarg, NULL, 0); break;
+        case 'k': block_size = strtoull(optarg, NULL, 0); break;
+        case 'c': nblocks = atoi(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        case 'r': replay = strtoll(optarg, NULL, 0); break;
+        default:  usage();
+        }
+    }
+    engine_a = svs_engine_find(name_a);
+    engine_b = svs_engine_find(name_b);
+    if (! engine_a || ! engine_b || nthreads == 0 || block_size == 0 || nblocks == 0)
+        usage();
+    devnull = fopen("/dev/null", "w");
+    if (! devnull) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    if (replay >= 0) {
+        // Повтор одной программы с трассой.
+        struct worker w = { 0 };
+
+        if (! run_case(&w, replay, true))
+            return 1;
+        printf("Case %lld: %llu instructions match\n",
+            (long long) replay, (unsigned long long) w.instructions);
+        return 0;
+    }
+
+    printf("Engines %s and %s, seed %llu, %u threads\n",
+        engine_a->name, engine_b->name, (unsigned long long) seed, nthreads);
+    fflush(stdout);
+
+    struct worker *worker = calloc(nthreads, sizeof(struct worker));
+    if (! worker) {
+        perror("svsfuzz");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&worker[i].thread, NULL, worker_main, &worker[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    uint64_t cases = 0, instructions = 0;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(worker[i].thread, NULL);
+        cases += worker[i].cases;
+        instructions += worker[i].instructions;
+    }
+    double t = elapsed();
+
+    printf("%llu programs, %llu instructions in %.3f sec, %.1f MIPS per engine\n",
+        (unsigned long long) cases, (unsigned long long) instructions, t,
+        instructions / t / 1e6);
+    return atomic_load(&failed) ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Convert memory image of SVS processor between text and binary form.
+ *
+ * Text form is read by svs_load(): .oct files or lines в/п/ч/с/к.
+ * Binary form is loaded by svs_load_image() with mmap, much faster.
+ * Direction of conversion is chosen by contents of the input file.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "el_master_api.h"
+#include "el_master_ram.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+//
+// Physical memory for the image: only pages in use are allocated.
+//
+static struct ElMasterRam *ram;
+
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return elMasterRamRead(ram, address, pTag, pWord);
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return elMasterRamWrite(ram, address, tag, word);
+}
+
+ElMasterStatus elMasterRamBlockWrite(
+    ElMasterRamAddress address,
+    unsigned count,
+    const ElMasterTag *pTags,
+    const ElMasterWord *pWords)
+{
+    return elMasterRamWriteBlock(ram, address, count, pTags, pWords);
+}
+
+int main(int argc, char *argv[])
+{
+    char magic[8];
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: svsimage input.oct output.img\n");
+        fprintf(stderr, "       svsimage input.img output.oct\n");
+        return 1;
+    }
+    FILE *input = fopen(argv[1], "r");
+    if (! input) {
+        perror(argv[1]);
+        return 1;
+    }
+    bool binary = fread(magic, sizeof(magic), 1, input) == 1 &&
+                  memcmp(magic, SVS_IMAGE_MAGIC, sizeof(magic)) == 0;
+    rewind(input);
+
+    ram = elMasterRamAllocate();
+    if (! ram) {
+        perror("svsimage");
+        return 1;
+    }
+    struct ElSvsProcessor *cpu = ElSvsAllocate(0);
+    if (binary) {
+        // Binary to text.
+        fclose(input);
+        if (! svs_load_image(cpu, argv[1]))
+            return 1;
+
+        FILE *output = fopen(argv[2], "w");
+        if (! output) {
+            perror(argv[2]);
+            return 1;
+        }
+        svs_dump(cpu, output, argv[1]);
+        if (fclose(output) != 0) {
+            perror(argv[2]);
+            return 1;
+        }
+    } else {
+        // Text to binary.
+        if (! svs_load(cpu, input)) {
+            fprintf(stderr, "%s: Bad input\n", argv[1]);
+            return 1;
+        }
+        fclose(input);
+        if (! svs_dump_image(cpu, argv[2]))
+            return 1;
+    }
+    return 0;
+}
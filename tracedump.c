@@ -0,0 +1,51 @@
+/*
+ * Convert binary trace of SVS processor into text.
+ *
+ * Binary trace is created by ElSvsSetTrace() with option 'b'.
+ * Output is the same as the text trace, produced without this option.
+ */
+#include <stdlib.h>
+#include "el_master_api.h"
+#include "el_svs_api.h"
+#include "el_svs_internal.h"
+
+//
+// No physical memory is needed for decoding.
+//
+ElMasterStatus elMasterRamWordRead(
+    ElMasterRamAddress address,
+    ElMasterTag *pTag,
+    ElMasterWord *pWord)
+{
+    return EMS_ERROR_INVALID_ADDRESS;
+}
+
+ElMasterStatus elMasterRamWordWrite(
+    ElMasterRamAddress address,
+    ElMasterTag tag,
+    ElMasterWord word)
+{
+    return EMS_ERROR_INVALID_ADDRESS;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *input = stdin;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: tracedump [trace.bin]\n");
+        return 1;
+    }
+    if (argc == 2) {
+        input = fopen(argv[1], "rb");
+        if (! input) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+    if (! svs_trace_decode(input, stdout)) {
+        fprintf(stderr, "%s: Bad trace format\n", argc == 2 ? argv[1] : "stdin");
+        return 1;
+    }
+    return 0;
+}
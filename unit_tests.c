@@ -6,8 +6,12 @@
 #define _DEFAULT_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <pthread.h>
 #include "cinytest/ciny.h"
 #include "el_master_api.h"
+#include "el_master_ram.h"
 #include "el_svs_api.h"
 #include "el_svs_internal.h"
 
@@ -1564,6 +1568,69 @@ static void alu_div(void *context)
     ct_assertequal(ElSvsGetRMR(cpu), 0u);
 }
 
+//
+// Test: subtraction of absolute values in ALU.
+// Absolute value of -1 must be aligned as a positive number.
+//
+static void alu_amx(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Disable normalization
+    ElSvsSetRAU(cpu, 3);
+
+    ElSvsSetAcc(cpu, 04160000000000000);                    // -1 * 2^3
+    svs_add(cpu, 06400000000000000, 1, 1);                  // minus |0 * 2^40|
+    ct_assertequal(ElSvsGetAcc(cpu), 06400000000000010u);   // 8 * 2^-40 * 2^40
+    ct_assertequal(ElSvsGetRMR(cpu), 0u);
+
+    ElSvsSetAcc(cpu, 04020000000000000);                    // -1 * 2^0
+    svs_add(cpu, 07100000000000000, 1, 1);                  // minus |0 * 2^50|
+    ct_assertequal(ElSvsGetAcc(cpu), 07100000000000000u);   // 0 * 2^50
+    ct_assertequal(ElSvsGetRMR(cpu), 00010000000000u);      // 2^-50 * 2^50
+}
+
+//
+// Test: stop by instruction count right after an internal interrupt.
+// The stop must come at the given count, and the run must go on
+// the same way after the stop, and after saving and restoring state.
+//
+static void step_interrupt(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Division by zero traps, the handler counts and returns.
+    ElSvsSetTrace(cpu, "", "");
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, дел 2001"));
+    store_insn(cpu, 0500, ElSvsAsm("слиа 1(1), пб 10"));
+    store_data(cpu, 02000, 04050000000000000ul);
+    store_data(cpu, 02001, 0);
+    ElSvsSetPC(cpu, 010);
+
+    // The second instruction traps: stop at the handler.
+    ct_assertequal((int)ElSvsStep(cpu, 2), ESS_OK);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 2u);
+    ct_assertequal(ElSvsGetPC(cpu), 0500u);
+    ct_assertequal(ElSvsGetM(cpu, 1), 0u);
+    ct_asserttrue(ElSvsSaveState(cpu, "state.output"));
+
+    // Go on by one instruction.
+    int i;
+    for (i = 0; i < 10; i++)
+        ct_assertequal((int)ElSvsStep(cpu, 1), ESS_OK);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 12u);
+    ct_assertequal(ElSvsGetM(cpu, 1), 3u);
+
+    // Same from the saved state, in one step.
+    struct ElSvsProcessor *cpu2 = ElSvsAllocate(1);
+    ct_asserttrue(ElSvsRestoreState(cpu2, "state.output"));
+    ct_assertequal((int)ElSvsStep(cpu2, 10), ESS_OK);
+    ct_assertequal(ElSvsGetInstructionCount(cpu2), 12u);
+    ct_assertequal(ElSvsGetM(cpu2, 1), 3u);
+    ct_assertequal(ElSvsGetPC(cpu2), ElSvsGetPC(cpu));
+    free(cpu2);
+}
+
 //
 // Test: A*X instruction (УМН).
 //
@@ -1653,6 +1720,1240 @@ static void divide(void *context)
     ct_assertequal(ElSvsGetM(cpu, 15), 02000u);
 }
 
+//
+// Test: performance counters.
+//
+static void stats(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Store the test code.
+    store_insn(cpu, 010, ElSvsAsm("мода 1, сч 2000"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2002, э50 7"));
+    store_insn(cpu, 0550, ElSvsAsm("стоп 12345(6), мода")); // Magic opcode: Pass
+    store_data(cpu, 02001, 01234);
+
+    // Run the code.
+    static ElSvsPairStats pairs;
+    memset(&pairs, 0, sizeof(pairs));
+    ElSvsSetPairStats(cpu, &pairs);
+    ElSvsSetPC(cpu, 010);
+    int status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_HALT);
+    ct_assertequal(ElSvsGetPC(cpu), 0550u);
+    ElSvsSetPairStats(cpu, NULL);
+
+    // Check counters.
+    ElSvsStats stats;
+    ElSvsGetStats(cpu, &stats);
+    ct_assertequal(stats.instructions[0][0], 0u);
+    ct_assertequal(stats.instructions[0][1], 0u);
+    ct_assertequal(stats.instructions[1][0], 2u);
+    ct_assertequal(stats.instructions[1][1], 2u);
+    ct_assertequal(stats.extracodes[050], 1u);
+    ct_assertequal(stats.loads, 1u);
+    ct_assertequal(stats.stores, 1u);
+    ct_assertequal(stats.fetches, 5u);
+    ct_assertequal(stats.modifiers, 1u);
+    ct_assertequal(stats.tlb_reloads, 0u);
+    ct_assertequal(pairs.pairs[SVS_PAIR_INDEX(0220)][010], 1u);  // мода, сч
+    ct_assertequal(pairs.pairs[000][050], 1u);                   // зп, э50
+    ct_assertequal(pairs.pairs[SVS_PAIR_INDEX(0330)][0220 & 077], 0u);
+
+    ElSvsResetStats(cpu);
+    ElSvsGetStats(cpu, &stats);
+    ct_assertequal(stats.fetches, 0u);
+}
+
+//
+// Test: extracodes implemented on the host side.
+//
+static void host_extracode(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Store the test code.
+    ElSvsSetHostExtracodes(cpu);
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, э50 70"));     // sqrt
+    store_insn(cpu, 011, ElSvsAsm("зп 2004, мода"));
+    store_insn(cpu, 012, ElSvsAsm("э50 5, мода"));          // to guest routine
+    store_insn(cpu, 0550, ElSvsAsm("стоп 12345(6), мода")); // Magic opcode: Pass
+    store_insn(cpu, 0551, ElSvsAsm("стоп 76543(2), мода")); // Magic opcode: Fail
+    store_data(cpu, 02000, ieee_to_svs(4.0));
+
+    // Run the code.
+    ElSvsSetPC(cpu, 010);
+    int status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_HALT);
+    ct_assertequal(ElSvsGetPC(cpu), 0550u);
+    ct_assertequal(ElSvsGetM(cpu, 14), 5u);
+    ct_assertequal(ElSvsGetM(cpu, ERET), 013u);
+
+    // Check result of host extracode.
+    ct_assertequal(memory[02004] >> 16, ieee_to_svs(2.0));
+}
+
+//
+// Run the test code for binary_trace with given trace mode.
+//
+static void run_traced(struct ElSvsProcessor *cpu, const char *mode, const char *filename)
+{
+    unlink(filename);
+    ElSvsSetTrace(cpu, mode, filename);
+    ElSvsSetPC(cpu, 010);
+    int status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_HALT);
+    ElSvsSetTrace(cpu, "", "");
+}
+
+//
+// Test: binary trace, decoded into text.
+//
+static void binary_trace(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Store the test code.
+    store_insn(cpu, 010, ElSvsAsm("уиа 2001(1), сч (1)"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2002, зпп 2003"));
+    store_insn(cpu, 012, ElSvsAsm("счп 2003, стоп 12345(6)"));
+    store_data(cpu, 02001, 01234);
+
+    // Run the same code twice: with text and binary trace.
+    run_traced(cpu, "imxrf", "text.output");
+    struct ElSvsProcessor *cpu2 = ElSvsAllocate(0);
+    run_traced(cpu2, "imxrfb", "binary.output");
+    free(cpu2);
+
+    // Decode binary trace.
+    FILE *input = fopen("binary.output", "r");
+    FILE *output = fopen("decoded.output", "w");
+    ct_asserttrue(input != NULL && output != NULL);
+    ct_asserttrue(svs_trace_decode(input, output));
+    fclose(input);
+    fclose(output);
+
+    // Compare.
+    FILE *text = fopen("text.output", "r");
+    FILE *decoded = fopen("decoded.output", "r");
+    char line1[256], line2[256];
+    int nlines = 0;
+    for (;;) {
+        char *p1 = fgets(line1, sizeof(line1), text);
+        char *p2 = fgets(line2, sizeof(line2), decoded);
+        if (! p1 || ! p2) {
+            ct_asserttrue(p1 == p2);
+            break;
+        }
+        ct_assertequalstrn(line1, line2, sizeof(line1));
+        nlines++;
+    }
+    fclose(text);
+    fclose(decoded);
+    ct_assertequal(nlines, 20);
+
+    // Binary trace is written out on return, without closing it.
+    struct ElSvsProcessor *cpu3 = ElSvsAllocate(0);
+    ElSvsSetTrace(cpu3, "ib", "flush.output");
+    ElSvsSetPC(cpu3, 010);
+    ct_assertequal((int)ElSvsSimulate(cpu3), ESS_HALT);
+    FILE *flushed = fopen("flush.output", "r");
+    ct_assertnotnull(flushed);
+    fseek(flushed, 0, SEEK_END);
+    ct_asserttrue(ftell(flushed) >= 7 * (long) sizeof(struct ElSvsTraceRecord));
+    fclose(flushed);
+    ElSvsSetTrace(cpu3, "", "");
+    free(cpu3);
+    unlink("flush.output");
+}
+
+//
+// Thread for async_trace test: run one processor.
+//
+static void *run_thread(void *arg)
+{
+    struct ElSvsProcessor *cpu = arg;
+
+    ElSvsSetPC(cpu, 010);
+    ElSvsSimulate(cpu);
+    return NULL;
+}
+
+//
+// Count lines with given prefix in a trace file.
+// When requested, check that instructions go in order: left, right, left, right...
+//
+static int count_lines(const char *filename, const char *prefix, bool check_order)
+{
+    FILE *input = fopen(filename, "r");
+    char line[256];
+    int nlines = 0;
+
+    ct_asserttrue(input != NULL);
+    while (fgets(line, sizeof(line), input)) {
+        if (strncmp(line, prefix, strlen(prefix)) != 0)
+            continue;
+        if (check_order && (line[19] == 'L' || line[19] == 'R'))
+            ct_assertequal(line[19], (nlines & 1) ? 'R' : 'L');
+        nlines++;
+    }
+    fclose(input);
+    return nlines;
+}
+
+//
+// Test: two processors trace into one file via background thread.
+//
+static void async_trace(void *context)
+{
+    struct ElSvsProcessor *cpu0 = context;
+    struct ElSvsProcessor *cpu1 = ElSvsAllocate(1);
+    pthread_t thread0, thread1;
+
+    // Store the test code: loop 1000 times.
+    store_insn(cpu0, 010, ElSvsAsm("уиа -1747(1), уиа (2)"));
+    store_insn(cpu0, 011, ElSvsAsm("слиа 1(2), цикл 11(1)"));
+    store_insn(cpu0, 012, ElSvsAsm("стоп 12345(6), мода"));
+
+    // Run both processors in parallel.
+    unlink("async.output");
+    ElSvsSetTrace(cpu0, "ia", "async.output");
+    ElSvsSetTrace(cpu1, "ia", "async.output");
+    pthread_create(&thread0, NULL, run_thread, cpu0);
+    pthread_create(&thread1, NULL, run_thread, cpu1);
+    pthread_join(thread0, NULL);
+    pthread_join(thread1, NULL);
+    ElSvsSetTrace(cpu0, "", "");
+    ElSvsSetTrace(cpu1, "", "");
+    free(cpu1);
+    ct_assertequal(ElSvsGetM(cpu0, 2), 01750u);
+
+    // Each processor: 3 + 2000 instructions and a halt message.
+    ct_assertequal(count_lines("async.output", "cpu0 ", true), 2004);
+    ct_assertequal(count_lines("async.output", "cpu1 ", true), 2004);
+}
+
+//
+// Test: trace filter by address, opcode and mode.
+//
+static void trace_filter(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    ElSvsTraceFilter filter = { 0 };
+
+    // Store the test code.
+    store_insn(cpu, 010, ElSvsAsm("уиа 1(1), уиа 2(2)"));
+    store_insn(cpu, 011, ElSvsAsm("уиа 3(3), сч 2000"));
+    store_insn(cpu, 012, ElSvsAsm("сч 2000, стоп 12345(6)"));
+
+    // Only address 11.
+    filter.nranges = 1;
+    filter.range[0].lo = 011;
+    filter.range[0].hi = 011;
+    ElSvsSetTraceFilter(cpu, &filter);
+    run_traced(cpu, "i", "filter.output");
+    ct_assertequal(count_lines("filter.output", "cpu0 00011 ", false), 2);
+    ct_assertequal(count_lines("filter.output", "cpu0 ", false), 2);
+
+    // Only instruction "сч", at any address.
+    filter.nranges = 0;
+    ElSvsTraceFilterOpcode(&filter, 010);
+    ElSvsSetTraceFilter(cpu, &filter);
+    run_traced(cpu, "i", "filter.output");
+    ct_assertequal(count_lines("filter.output", "cpu0 ", false), 2);
+
+    // Only user mode: nothing.
+    filter.modes = ELSVS_TRACE_USER;
+    ElSvsSetTraceFilter(cpu, &filter);
+    run_traced(cpu, "i", "filter.output");
+    ct_assertequal(count_lines("filter.output", "cpu0 ", false), 0);
+
+    // No filter: all instructions and the halt message.
+    ElSvsSetTraceFilter(cpu, NULL);
+    run_traced(cpu, "i", "filter.output");
+    ct_assertequal(count_lines("filter.output", "cpu0 ", false), 7);
+}
+
+//
+// Test: trace started by events.
+//
+static void trace_trigger(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    ElSvsTraceTrigger trigger = { 0 };
+
+    // Store the test code.
+    store_insn(cpu, 010, ElSvsAsm("уиа 1(1), уиа 2(2)"));
+    store_insn(cpu, 011, ElSvsAsm("уиа 3(3), зп 2000"));
+    store_insn(cpu, 012, ElSvsAsm("сч 2000, стоп 12345(6)"));
+
+    // Two instructions from address 11.
+    trigger.on_pc = 1;
+    trigger.pc = 011;
+    trigger.duration = 2;
+    ElSvsSetTraceTrigger(cpu, &trigger);
+    run_traced(cpu, "i", "trigger.output");
+    ct_assertequal(count_lines("trigger.output", "cpu0 00011 ", false), 2);
+    ct_assertequal(count_lines("trigger.output", "cpu0 ", false), 2);
+
+    // After three instructions, till the end.
+    memset(&trigger, 0, sizeof(trigger));
+    trigger.after = 3;
+    ElSvsSetTraceTrigger(cpu, &trigger);
+    run_traced(cpu, "i", "trigger.output");
+    ct_assertequal(count_lines("trigger.output", "cpu0 ", false), 4);
+
+    // One instruction after write to address 2000.
+    memset(&trigger, 0, sizeof(trigger));
+    trigger.on_write = 1;
+    trigger.write_addr = 02000;
+    trigger.duration = 1;
+    ElSvsSetTraceTrigger(cpu, &trigger);
+    run_traced(cpu, "i", "trigger.output");
+    ct_assertequal(count_lines("trigger.output", "cpu0 00012 0000012 L", false), 1);
+    ct_assertequal(count_lines("trigger.output", "cpu0 ", false), 1);
+
+    // Halt only.
+    memset(&trigger, 0, sizeof(trigger));
+    trigger.on_exception = 1;
+    trigger.exception = ESS_HALT;
+    ElSvsSetTraceTrigger(cpu, &trigger);
+    run_traced(cpu, "i", "trigger.output");
+    ct_assertequal(count_lines("trigger.output", "cpu0 --- ", false), 1);
+    ct_assertequal(count_lines("trigger.output", "cpu0 ", false), 1);
+
+    // Every other instruction, and the halt message.
+    memset(&trigger, 0, sizeof(trigger));
+    trigger.after = 1;
+    trigger.duration = 1;
+    trigger.repeat = 1;
+    ElSvsSetTraceTrigger(cpu, &trigger);
+    run_traced(cpu, "i", "trigger.output");
+    ct_assertequal(count_lines("trigger.output", "cpu0 ", false), 4);
+
+    // No trigger: all instructions and the halt message.
+    ElSvsSetTraceTrigger(cpu, NULL);
+    run_traced(cpu, "i", "trigger.output");
+    ct_assertequal(count_lines("trigger.output", "cpu0 ", false), 7);
+}
+
+//
+// Test: last instructions are dumped on abnormal stop.
+//
+static void flight_recorder(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Store the test code: a loop, then jump to data.
+    store_insn(cpu, 010, ElSvsAsm("уиа -77(1), сч 2000"));
+    store_insn(cpu, 011, ElSvsAsm("цикл 11(1), пб 2000"));
+    store_data(cpu, 02000, 01234);
+
+    // Halt on instruction check.
+    unlink("flight.output");
+    ElSvsSetTrace(cpu, "x", "flight.output");
+    ElSvsSetM(cpu, PSW, ElSvsGetM(cpu, PSW) | PSW_CHECK_HALT);
+    ElSvsSetPC(cpu, 010);
+    int status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_INSN_CHECK);
+    ElSvsSetTrace(cpu, "", "");
+
+    // Check the dump.
+    ct_assertequal(count_lines("flight.output", "cpu0 --- ", false), 1);
+    ct_assertequal(count_lines("flight.output", "cpu0 00011 0000011 R: ", false), 1);
+    ct_assertequal(count_lines("flight.output", "cpu0 000", false), SVS_FLIGHT_SIZE);
+    ct_assertequal(count_lines("flight.output", "cpu0       Write ACC = 0000 0000 0000 1234", false), SVS_FLIGHT_SIZE);
+}
+
+//
+// Test: breakpoints and watchpoints.
+//
+static void breakpoints(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Store the test code.
+    store_insn(cpu, 010, ElSvsAsm("уиа 1(1), сч 2000"));
+    store_insn(cpu, 011, ElSvsAsm("уиа 2(2), зп 2001"));
+    store_insn(cpu, 012, ElSvsAsm("уиа 3(3), стоп 12345(6)"));
+    store_data(cpu, 02000, 01234);
+    store_data(cpu, 02001, 0);
+
+    // Stop on instruction, on read and on write; then resume.
+    ElSvsSetBreakpoint(cpu, ELSVS_BREAK_EXEC, 011);
+    ElSvsSetBreakpoint(cpu, ELSVS_BREAK_READ, 02000);
+    ElSvsSetBreakpoint(cpu, ELSVS_BREAK_WRITE, 02001);
+    ElSvsSetPC(cpu, 010);
+
+    int status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_RWATCH);
+    ct_assertequal(ElSvsGetPC(cpu), 010u);
+    ct_assertequal(ElSvsGetM(cpu, 1), 1u);
+
+    status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_IBKPT);
+    ct_assertequal(ElSvsGetPC(cpu), 011u);
+    ct_assertequal(ElSvsGetAcc(cpu), 01234u);
+
+    status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_WWATCH);
+    ct_assertequal(ElSvsGetPC(cpu), 011u);
+    ct_assertequal(ElSvsGetM(cpu, 2), 2u);
+    ct_assertequal(memory[02001] >> 16, 0u);
+
+    status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_HALT);
+    ct_assertequal(memory[02001] >> 16, 01234u);
+    ct_assertequal(ElSvsGetM(cpu, 3), 3u);
+
+    // Without breakpoints.
+    ElSvsClearBreakpoint(cpu, ELSVS_BREAK_EXEC, 011);
+    ElSvsClearBreakpoint(cpu, ELSVS_BREAK_READ, 02000);
+    ElSvsClearBreakpoint(cpu, ELSVS_BREAK_WRITE, 02001);
+    ct_assertequal(cpu->brk_pages[ELSVS_BREAK_EXEC], 0u);
+    ElSvsSetPC(cpu, 010);
+    status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_HALT);
+}
+
+//
+// Test: save state at breakpoint, restore and run again.
+//
+static void save_restore(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Store the test code.
+    store_insn(cpu, 010, ElSvsAsm("уиа 5(1), сч 2000"));
+    store_insn(cpu, 011, ElSvsAsm("слиа 1(1), зп 2001"));
+    store_insn(cpu, 012, ElSvsAsm("слиа 1(1), зп 2002"));
+    store_insn(cpu, 013, ElSvsAsm("уиа 7(2), стоп 12345(6)"));
+    store_data(cpu, 02000, 01234);
+    store_data(cpu, 02001, 0);
+    store_data(cpu, 02002, 0);
+
+    // Stop in the middle and save.
+    ElSvsSetBreakpoint(cpu, ELSVS_BREAK_EXEC, 012);
+    ElSvsSetPC(cpu, 010);
+    int status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_IBKPT);
+    ElSvsClearBreakpoint(cpu, ELSVS_BREAK_EXEC, 012);
+    ct_asserttrue(ElSvsSaveState(cpu, "state.output"));
+    ct_asserttrue(ElSvsSaveMemory("memory.output"));
+
+    // Run to the end.
+    status = ElSvsSimulate(cpu);
+    ct_assertequal(status, ESS_HALT);
+    ct_assertequal(memory[02002] >> 16, 01234u);
+    ct_assertequal(ElSvsGetM(cpu, 1), 7u);
+
+    // Restore into another processor and run again.
+    struct ElSvsProcessor *cpu2 = ElSvsAllocate(1);
+    memory[02001] = 0;
+    memory[04000] = 1;
+    ct_asserttrue(ElSvsRestoreState(cpu2, "state.output"));
+    ct_asserttrue(ElSvsRestoreMemory("memory.output"));
+    ct_assertequal(memory[02001] >> 16, 01234u);
+    ct_assertequal(memory[02002], 0u);
+    ct_assertequal(memory[04000], 0u);
+    ct_assertequal(ElSvsGetPC(cpu2), 012u);
+    ct_assertequal(ElSvsGetM(cpu2, 1), 6u);
+
+    ElSvsSetTrace(cpu2, "imxr", log_filename);
+    status = ElSvsSimulate(cpu2);
+    ct_assertequal(status, ESS_HALT);
+    ct_assertequal(memory[02002] >> 16, 01234u);
+    ct_assertequal(ElSvsGetM(cpu2, 1), 7u);
+    ct_assertequal(ElSvsGetM(cpu2, 2), 7u);
+    ct_assertequal(ElSvsGetPC(cpu2), ElSvsGetPC(cpu));
+    ElSvsSetTrace(cpu2, "", "");
+    free(cpu2);
+}
+
+//
+// Test: child simulations with different pult settings.
+//
+static void fork_children(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    int pid[3], i, status;
+
+    // Store the test code: copy pult register 1 to memory.
+    store_insn(cpu, 010, ElSvsAsm("сч 1, зп 2000"));
+    store_insn(cpu, 011, ElSvsAsm("стоп 12345(6), мода"));
+    store_data(cpu, 02000, 0);
+    ElSvsSetTrace(cpu, "", "");
+
+    for (i = 0; i < 3; i++) {
+        pid[i] = ElSvsFork(cpu);
+        ct_asserttrue(pid[i] >= 0);
+        if (pid[i] == 0) {
+            // Child: run with own pult value, report result as exit code.
+            ElSvsSetPult(cpu, 1, 1 + i);
+            ElSvsSetPC(cpu, 010);
+            if (ElSvsSimulate(cpu) != ESS_HALT)
+                _exit(100);
+            _exit(memory[02000] >> 16);
+        }
+    }
+
+    // Children don't change memory of the parent.
+    for (i = 0; i < 3; i++) {
+        ct_assertequal(waitpid(pid[i], &status, 0), pid[i]);
+        ct_asserttrue(WIFEXITED(status));
+        ct_assertequal(WEXITSTATUS(status), 1 + i);
+    }
+    ct_assertequal(memory[02000], 0u);
+}
+
+//
+// Test: record, reverse step and replay with logged input.
+//
+static void reverse_step(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    // Store the test code: add pult register 1 to memory in a loop,
+    // four instructions per iteration.
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, слц 1"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2000, пб 10"));
+    store_data(cpu, 02000, 0);
+    ElSvsSetPult(cpu, 1, 1);
+    ElSvsSetPC(cpu, 010);
+    ElSvsSetTrace(cpu, "", "");
+
+    // Record: 100 iterations by 1, then 100 iterations by 2.
+    uint64_t start = ElSvsGetInstructionCount(cpu);
+    ct_asserttrue(ElSvsRecordStart(cpu, 100, 16));
+    ct_assertequal((int)ElSvsStep(cpu, 400), ESS_OK);
+    ct_assertequal(memory[02000] >> 16, 100u);
+    ElSvsSetPult(cpu, 1, 2);
+    ct_assertequal((int)ElSvsStep(cpu, 400), ESS_OK);
+    ct_assertequal(memory[02000] >> 16, 300u);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), start + 800);
+
+    // Back to the middle of second part.
+    ct_assertequal((int)ElSvsReverseStep(cpu, 200), ESS_OK);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), start + 600);
+    ct_assertequal(memory[02000] >> 16, 200u);
+    ct_assertequal(ElSvsGetPC(cpu), 010u);
+
+    // Back to the first part, in the middle of an iteration.
+    ct_assertequal((int)ElSvsReverseStep(cpu, 350), ESS_OK);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), start + 250);
+    ct_assertequal(memory[02000] >> 16, 62u);
+    ct_assertequal(ElSvsGetAcc(cpu), 63u);
+
+    // Replay: input from host is ignored, the logged one is used.
+    ElSvsSetPult(cpu, 1, 5);
+    ct_assertequal((int)ElSvsStep(cpu, 550), ESS_OK);
+    ct_assertequal(memory[02000] >> 16, 300u);
+
+    // End of record: input is accepted again.
+    ElSvsSetPult(cpu, 1, 5);
+    ct_assertequal((int)ElSvsStep(cpu, 4), ESS_OK);
+    ct_assertequal(memory[02000] >> 16, 305u);
+    ElSvsRecordStop(cpu);
+}
+
+//
+// Test: binary memory image and conversion to text and back.
+//
+static void memory_image(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    static ElMasterWord saved[1024*1024];
+    static ElMasterTag saved_tag[1024*1024];
+
+    memset(memory, 0, sizeof(memory));
+    memset(mem_tag, 0, sizeof(mem_tag));
+    store_insn(cpu, 010, ElSvsAsm("уиа 5(1), сч 2000"));
+    store_insn(cpu, 011, ElSvsAsm("стоп 12345(6), мода"));
+    store_data(cpu, 02000, 01234);
+    store_data(cpu, 02001, 05670);
+    store_data(cpu, 0377777, 07777);
+    ElSvsSetPult(cpu, 2, 0777);
+    ElSvsSetPC(cpu, 010);
+    memcpy(saved, memory, sizeof(memory));
+    memcpy(saved_tag, mem_tag, sizeof(mem_tag));
+
+    // Binary image.
+    ct_asserttrue(svs_dump_image(cpu, "image.output"));
+    struct ElSvsProcessor *cpu2 = ElSvsAllocate(1);
+    memset(memory, 0, sizeof(memory));
+    memset(mem_tag, 0, sizeof(mem_tag));
+    ct_asserttrue(svs_load_image(cpu2, "image.output"));
+    ct_assertequal(memcmp(memory, saved, sizeof(memory)), 0);
+    ct_assertequal(memcmp(mem_tag, saved_tag, sizeof(mem_tag)), 0);
+    ct_assertequal(ElSvsGetPC(cpu2), 010u);
+    ct_assertequal(cpu2->pult[2], 0777u);
+
+    // Run beyond memory, also with the address near 2^32.
+    static const uint32_t bad_run[][2] = { { 0377770, 020 }, { 0xfffffff0, 020 } };
+    ct_assertfalse(svs_memory_load_runs(bad_run[0], sizeof(bad_run[0]), 010));
+    ct_assertfalse(svs_memory_load_runs(bad_run[1], sizeof(bad_run[1]), 010));
+
+    // Text dump, loaded back.
+    FILE *output = fopen("dump.output", "w");
+    ct_assertnotnull(output);
+    svs_dump(cpu2, output, "image.output");
+    fclose(output);
+    free(cpu2);
+
+    cpu2 = ElSvsAllocate(1);
+    memset(memory, 0, sizeof(memory));
+    memset(mem_tag, 0, sizeof(mem_tag));
+    FILE *input = fopen("dump.output", "r");
+    ct_assertnotnull(input);
+    ct_asserttrue(svs_load(cpu2, input));
+    fclose(input);
+    ct_assertequal(memcmp(memory, saved, sizeof(memory)), 0);
+    ct_assertequal(memcmp(mem_tag, saved_tag, sizeof(mem_tag)), 0);
+    ct_assertequal(ElSvsGetPC(cpu2), 010u);
+    ct_assertequal(cpu2->pult[2], 0777u);
+    free(cpu2);
+}
+
+//
+// Test: sparse RAM backend.
+//
+static void sparse_ram(void *context)
+{
+    struct ElMasterRam *ram = elMasterRamAllocate();
+    ElMasterWord word = 1;
+    ElMasterTag tag = 1;
+
+    // Empty RAM reads as zero.
+    ct_assertnotnull(ram);
+    ct_assertequal(elMasterRamResidentPages(ram), 0u);
+    ct_assertequal((int)elMasterRamRead(ram, 012345, &tag, &word), EMS_OK);
+    ct_assertequal(word, 0u);
+    ct_assertequal(tag, 0u);
+
+    // Pages are committed on first non-zero write.
+    ct_assertequal((int)elMasterRamWrite(ram, 02000, 0, 0), EMS_OK);
+    ct_assertequal(elMasterRamResidentPages(ram), 0u);
+    ct_assertequal((int)elMasterRamWrite(ram, 02000, 036, 01234), EMS_OK);
+    ct_assertequal((int)elMasterRamWrite(ram, 02001, 035, 05670), EMS_OK);
+    ct_assertequal((int)elMasterRamWrite(ram, 03777777, 036, 1), EMS_OK);
+    ct_assertequal(elMasterRamResidentPages(ram), 2u);
+    ct_assertequal((int)elMasterRamRead(ram, 02001, &tag, &word), EMS_OK);
+    ct_assertequal(word, 05670u);
+    ct_assertequal(tag, 035u);
+    ct_assertequal((int)elMasterRamRead(ram, 02002, &tag, &word), EMS_OK);
+    ct_assertequal(word, 0u);
+    ct_assertequal(tag, 0u);
+
+    // Out of range.
+    ct_assertequal((int)elMasterRamRead(ram, 04000000, &tag, &word), EMS_ERROR_INVALID_ADDRESS);
+    ct_assertequal((int)elMasterRamWrite(ram, 04000000, 036, 1), EMS_ERROR_INVALID_ADDRESS);
+
+    // Block across a page boundary.
+    static const ElMasterWord words[3] = { 1, 2, 3 };
+    static const ElMasterTag tags[3] = { 034, 035, 036 };
+    ct_assertequal((int)elMasterRamWriteBlock(ram, 05777, 3, tags, words), EMS_OK);
+    ct_assertequal(elMasterRamResidentPages(ram), 4u);
+    elMasterRamRead(ram, 05777, &tag, &word);
+    ct_assertequal(word, 1u);
+    ct_assertequal(tag, 034u);
+    elMasterRamRead(ram, 06001, &tag, &word);
+    ct_assertequal(word, 3u);
+    ct_assertequal(tag, 036u);
+    ct_assertequal((int)elMasterRamWriteBlock(ram, 03777776, 3, tags, words),
+                   EMS_ERROR_INVALID_ADDRESS);
+    ct_assertequal((int)elMasterRamWriteBlock(ram, 0xfffffff0, 020, tags, words),
+                   EMS_ERROR_INVALID_ADDRESS);
+
+    // Released pages read as zero.
+    elMasterRamClear(ram);
+    ct_assertequal(elMasterRamResidentPages(ram), 0u);
+    ct_assertequal((int)elMasterRamRead(ram, 02000, &tag, &word), EMS_OK);
+    ct_assertequal(word, 0u);
+    elMasterRamFree(ram);
+}
+
+//
+// Test: overlays over a shared base image.
+//
+static void ram_overlay(void *context)
+{
+    struct ElMasterRam *ram = elMasterRamAllocate();
+    ElMasterWord word;
+    ElMasterTag tag;
+
+    // Make base image of two pages.
+    ct_assertnotnull(ram);
+    elMasterRamWrite(ram, 02000, 036, 01234);
+    elMasterRamWrite(ram, 04000, 035, 05670);
+    struct ElMasterRamBase *base = elMasterRamBaseCreate(ram);
+    ct_assertnotnull(base);
+    ct_assertequal(elMasterRamBasePages(base), 2u);
+    ct_assertequal(elMasterRamResidentPages(ram), 0u);
+    elMasterRamFree(ram);
+
+    // Two overlays share the base.
+    struct ElMasterRam *ram1 = elMasterRamAllocateOverlay(base);
+    struct ElMasterRam *ram2 = elMasterRamAllocateOverlay(base);
+    ct_assertnotnull(ram1);
+    ct_assertnotnull(ram2);
+    ct_assertnull(elMasterRamBaseCreate(ram1));
+    elMasterRamRead(ram1, 02000, &tag, &word);
+    ct_assertequal(word, 01234u);
+    ct_assertequal(tag, 036u);
+
+    // Write into one overlay copies the page.
+    elMasterRamWrite(ram1, 02001, 036, 7);
+    ct_assertequal(elMasterRamResidentPages(ram1), 1u);
+    ct_assertequal(elMasterRamResidentPages(ram2), 0u);
+    elMasterRamRead(ram1, 02000, &tag, &word);
+    ct_assertequal(word, 01234u);
+    elMasterRamRead(ram1, 02001, &tag, &word);
+    ct_assertequal(word, 7u);
+    elMasterRamRead(ram2, 02001, &tag, &word);
+    ct_assertequal(word, 0u);
+
+    // Clear returns the overlay to the base.
+    elMasterRamClear(ram1);
+    ct_assertequal(elMasterRamResidentPages(ram1), 0u);
+    elMasterRamRead(ram1, 02001, &tag, &word);
+    ct_assertequal(word, 0u);
+    elMasterRamRead(ram1, 04000, &tag, &word);
+    ct_assertequal(word, 05670u);
+    elMasterRamFree(ram1);
+    elMasterRamFree(ram2);
+
+    // Base image mapped from file.
+    ct_asserttrue(elMasterRamBaseSave(base, "ram.output"));
+    elMasterRamBaseFree(base);
+    base = elMasterRamBaseMap("ram.output");
+    ct_assertnotnull(base);
+    ct_assertequal(elMasterRamBasePages(base), 2u);
+    ram1 = elMasterRamAllocateOverlay(base);
+    elMasterRamRead(ram1, 04000, &tag, &word);
+    ct_assertequal(word, 05670u);
+    ct_assertequal(tag, 035u);
+    elMasterRamWrite(ram1, 04000, 036, 1);
+    elMasterRamRead(ram1, 04000, &tag, &word);
+    ct_assertequal(word, 1u);
+    ct_assertequal(elMasterRamResidentPages(ram1), 1u);
+    elMasterRamFree(ram1);
+    elMasterRamBaseFree(base);
+}
+
+//
+// Test: lockstep comparison with a reference trace.
+//
+static void lockstep(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    ElSvsLockstepResult result;
+
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, слц 1"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2000, пб 10"));
+    store_data(cpu, 02000, 0);
+    ElSvsSetPult(cpu, 1, 1);
+    ElSvsSetPC(cpu, 010);
+    ct_asserttrue(ElSvsSaveState(cpu, "state.output"));
+
+    // Reference trace.
+    unlink("lockstep.output");
+    ElSvsSetTrace(cpu, "imr", "lockstep.output");
+    ct_assertequal((int)ElSvsStep(cpu, 40), ESS_OK);
+    ElSvsSetTrace(cpu, "", "");
+
+    // Same run matches.
+    ct_asserttrue(ElSvsRestoreState(cpu, "state.output"));
+    store_data(cpu, 02000, 0);
+    FILE *trace = fopen("lockstep.output", "r");
+    ct_assertnotnull(trace);
+    ct_asserttrue(ElSvsLockstep(cpu, trace, &result));
+    ct_assertequal(result.instructions, 40u);
+    ct_assertequal(result.line, 0u);
+    ct_assertequal(memory[02000] >> 16, 10u);
+
+    // Different data: stop at the first write of accumulator.
+    ct_asserttrue(ElSvsRestoreState(cpu, "state.output"));
+    store_data(cpu, 02000, 5);
+    rewind(trace);
+    ct_assertfalse(ElSvsLockstep(cpu, trace, &result));
+    ct_assertequal(result.instructions, 1u);
+    ct_assertnotequal(result.line, 0u);
+    ct_assertnotnull(strstr(result.message, "ACC"));
+    fclose(trace);
+}
+
+//
+// Test: fused pairs stop between the halves, and see a word
+// rewritten by its own left instruction.
+//
+static void fused(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    const struct ElSvsEngine *e = svs_engine_find("fused");
+
+    ct_assertnotnull(e);
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, зп 2001"));
+    store_insn(cpu, 011, ElSvsAsm("зп 11, цикл 11(2)"));
+    store_insn(cpu, 012, ElSvsAsm("стоп 12345(6), мода"));
+    store_data(cpu, 02000, 0);
+    ElSvsSetPult(cpu, 1, 3);
+    ElSvsSetPC(cpu, 010);
+    ElSvsSetTrace(cpu, "", "");
+
+    // Останов по счётчику после левой команды.
+    ct_assertequal((int)e->run(cpu, 1), ESS_OK);
+    ct_assertequal(ElSvsGetPC(cpu), 010u);
+    ct_asserttrue(cpu->core.RUU & RUU_RIGHT_INSTR);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 1u);
+    ct_assertequal((int)e->run(cpu, 1), ESS_OK);
+    ct_assertequal(ElSvsGetPC(cpu), 011u);
+
+    // Левая команда заменяет цикл на уиа.
+    ElSvsSetAcc(cpu, ElSvsAsm("зп 11, уиа 5(3)"));
+    cpu->core.M[3] = 0;
+    ct_assertequal((int)e->run(cpu, 1000), ESS_HALT);
+    ct_assertequal(ElSvsGetPC(cpu), 012u);
+    ct_assertequal(cpu->core.M[3], 5u);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 5u);
+}
+
+//
+// Test: the word of instructions is fetched again for the right half
+// after the left one stores into memory or changes the mapping or the
+// modes, and fused pairs give the same result as the reference.
+//
+static void fused_refetch(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    static const struct {
+        const char *src;
+        bool refetch;
+    } left[] = {
+        { "сч 2000, уиа 1(3)",   false },
+        { "зп 2000, уиа 1(3)",   true },   // запись в память
+        { "рег 20, уиа 1(3)",    true },   // приписка пользователя
+        { "уиа 2003, уиа 1(3)",  false },  // M[PSW] без смены режимов
+        { "уиа 2002, уиа 1(3)",  true },   // включение приписки
+        { "слиа 2002, уиа 1(3)", true },
+    };
+    const struct ElSvsEngine *e;
+    unsigned i;
+
+    ElSvsSetTrace(cpu, "", "");
+    store_insn(cpu, 011, ElSvsAsm("стоп 12345(6), мода"));
+    ElSvsSetPC(cpu, 010);
+    ct_asserttrue(ElSvsSaveState(cpu, "state.output"));
+
+    for (i = 0; i < sizeof(left) / sizeof(left[0]); i++) {
+        store_insn(cpu, 010, ElSvsAsm(left[i].src));
+
+        // Признак после левой команды.
+        ct_asserttrue(ElSvsRestoreState(cpu, "state.output"));
+        ElSvsSetTrace(cpu, "", "");
+        cpu->refetch = false;
+        ct_assertequal((int)ElSvsStep(cpu, 1), ESS_OK);
+        ct_assertequal(cpu->refetch, left[i].refetch);
+
+        for (e = svs_engines; e->name; e++) {
+            if (strcmp(e->name, "aot") == 0)
+                continue;
+            ct_asserttrue(ElSvsRestoreState(cpu, "state.output"));
+            ElSvsSetTrace(cpu, "", "");
+            cpu->core.M[3] = 0;
+            ct_assertequal((int)e->run(cpu, 1000), ESS_HALT);
+            ct_assertequal(ElSvsGetPC(cpu), 011u);
+            ct_assertequal(cpu->core.M[3], 1u);
+            ct_assertequal(ElSvsGetInstructionCount(cpu), 3u);
+            ct_assertequal(cpu->stats.fetches, 3u);
+        }
+    }
+}
+
+//
+// Test: translated code gives the same result as the interpreter,
+// also when stopped inside a block and when a word of a block is modified.
+//
+static void aot(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    unsigned entry = 010, i;
+
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, уиа -7(2)"));
+    store_insn(cpu, 011, ElSvsAsm("слц 2001, слц 2003"));
+    store_insn(cpu, 012, ElSvsAsm("цикл 11(2), пв 20(3)"));
+    store_insn(cpu, 013, ElSvsAsm("сч 2004, зп 14"));
+    store_insn(cpu, 014, ElSvsAsm("стоп 12345(6), мода"));
+    store_insn(cpu, 020, ElSvsAsm("зп 2002, пб (3)"));
+    store_data(cpu, 02000, 0);
+    store_data(cpu, 02001, 1);
+    store_data(cpu, 02003, 2);
+    store_data(cpu, 02004, ElSvsAsm("стоп 54321(6), мода"));
+    ElSvsSetPult(cpu, 1, 3);
+    ElSvsSetPC(cpu, 010);
+    ct_asserttrue(ElSvsSaveState(cpu, "state.output"));
+    ElSvsSetTrace(cpu, "", "");
+
+    FILE *source = fopen("aot.output", "w");
+    ct_assertnotnull(source);
+    ct_asserttrue(svs_aot_translate(source, "test", &entry, 1, false) >= 3);
+    fclose(source);
+    ct_asserttrue(svs_aot_compile("aot.output", "./aot-so.output"));
+
+    // Интерпретатор.
+    ct_assertequal((int)ElSvsStep(cpu, 1000), ESS_HALT);
+    uint64_t acc = ElSvsGetAcc(cpu), count = ElSvsGetInstructionCount(cpu);
+    uint64_t fetches = cpu->stats.fetches;
+    unsigned aex = cpu->Aex;
+    ct_assertequal(acc, ElSvsAsm("стоп 54321(6), мода"));
+    ct_assertequal(memory[02002] >> 16, 8u * 3);
+
+    // Оттранслированный код, подряд и по одной команде.
+    ct_asserttrue(ElSvsAotLoad(cpu, "./aot-so.output"));
+    ct_assertnotnull(cpu->aot->block[010]);
+    ct_assertnotnull(cpu->aot->block[011]);
+    ct_assertnotnull(cpu->aot->block[013]);
+    for (i = 0; i < 2; i++) {
+        store_insn(cpu, 014, ElSvsAsm("стоп 12345(6), мода"));
+        store_data(cpu, 02002, 0);
+        ct_asserttrue(ElSvsRestoreState(cpu, "state.output"));
+        ElSvsSetTrace(cpu, "", "");
+        ElSvsResetStats(cpu);
+        if (i == 0) {
+            ct_assertequal((int)ElSvsStep(cpu, 1000), ESS_HALT);
+        } else {
+            while (ElSvsStep(cpu, 1) == ESS_OK)
+                continue;
+        }
+        ct_assertequal(ElSvsGetAcc(cpu), acc);
+        ct_assertequal(ElSvsGetInstructionCount(cpu), count);
+        ct_assertequal(cpu->stats.fetches, fetches);
+        ct_assertequal(cpu->Aex, aex);
+        ct_assertequal(ElSvsGetPC(cpu), 014u);
+        ct_assertequal(memory[02002] >> 16, 8u * 3);
+    }
+
+    // Общий код остаётся у второго процессора после выгрузки первым.
+    struct ElSvsProcessor *cpu2 = ElSvsAllocate(0);
+    ct_assertnotnull(cpu2);
+    ElSvsAotShare(cpu2, cpu);
+    ct_asserttrue(cpu2->aot == cpu->aot);
+    ElSvsAotUnload(cpu);
+    ct_assertnull(cpu->aot);
+    ct_assertnotnull(cpu2->aot->block[010]);
+    ElSvsAotUnload(cpu2);
+    ct_assertnull(cpu2->aot);
+    free(cpu2);
+}
+
+//
+// Test: translated block at the interrupt vector.  The first word
+// after an interrupt runs by the interpreter, so that a trap in its
+// right half is an ordinary interrupt, not a double one.
+//
+static void aot_interrupt(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    unsigned entry = 0500;
+
+    ElSvsSetTrace(cpu, "", "");
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, дел 2001"));
+    store_insn(cpu, 0500, ElSvsAsm("слиа 1(1), дел 2001"));
+    store_data(cpu, 02000, 04050000000000000ul);
+    store_data(cpu, 02001, 0);
+    ElSvsSetPC(cpu, 010);
+    ct_asserttrue(ElSvsSaveState(cpu, "state.output"));
+
+    FILE *source = fopen("aot.output", "w");
+    ct_assertnotnull(source);
+    ct_asserttrue(svs_aot_translate(source, "test", &entry, 1, false) >= 1);
+    fclose(source);
+    ct_asserttrue(svs_aot_compile("aot.output", "./aot-so.output"));
+
+    // Интерпретатор: каждое деление снова входит в прерывание.
+    ct_assertequal((int)ElSvsStep(cpu, 20), ESS_OK);
+    ct_assertequal(ElSvsGetPC(cpu), 0500u);
+    ct_assertequal(ElSvsGetM(cpu, 1), 9u);
+
+    // Оттранслированный код.
+    ct_asserttrue(ElSvsRestoreState(cpu, "state.output"));
+    ElSvsSetTrace(cpu, "", "");
+    ct_asserttrue(ElSvsAotLoad(cpu, "./aot-so.output"));
+    ct_assertnotnull(cpu->aot->block[0500]);
+    ct_assertequal((int)ElSvsStep(cpu, 20), ESS_OK);
+    ct_assertequal(ElSvsGetPC(cpu), 0500u);
+    ct_assertequal(ElSvsGetM(cpu, 1), 9u);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 20u);
+    ElSvsAotUnload(cpu);
+}
+
+//
+// Test: all execution engines give the same result.
+//
+static void engines(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    const struct ElSvsEngine *e;
+    uint64_t acc = 0, data = 0;
+
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, слц 1"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2000, цикл 10(2)"));
+    store_insn(cpu, 012, ElSvsAsm("стоп 12345(6), мода"));
+    ElSvsSetPult(cpu, 1, 3);
+    ElSvsSetPC(cpu, 010);
+    cpu->core.M[2] = 077760;
+    ct_asserttrue(ElSvsSaveState(cpu, "state.output"));
+    ElSvsSetTrace(cpu, "", "");
+
+    for (e = svs_engines; e->name; e++) {
+        ct_asserttrue(ElSvsRestoreState(cpu, "state.output"));
+        store_data(cpu, 02000, 0);
+        ct_assertequal((int)e->run(cpu, 1000), ESS_HALT);
+        ct_assertequal(ElSvsGetPC(cpu), 012u);
+        if (e == svs_engines) {
+            acc = ElSvsGetAcc(cpu);
+            data = memory[02000];
+            continue;
+        }
+        ct_assertequal(ElSvsGetAcc(cpu), acc);
+        ct_assertequal(memory[02000], data);
+    }
+    ct_assertequal(acc, 3u * 17);
+    ct_assertnotnull(cpu->aot);
+    ElSvsAotUnload(cpu);
+    ct_assertnull(svs_engine_find("none"));
+
+    // Comparison of RAM instances.
+    struct ElMasterRam *a = elMasterRamAllocate();
+    struct ElMasterRam *b = elMasterRamAllocate();
+    ElMasterRamAddress addr = 0;
+    ct_asserttrue(elMasterRamCompare(a, b, &addr));
+    elMasterRamWrite(a, 012345, 036, 1);
+    elMasterRamWrite(b, 012345, 036, 1);
+    elMasterRamWrite(b, 02000, 0, 0);
+    ct_asserttrue(elMasterRamCompare(a, b, &addr));
+    elMasterRamWrite(b, 012346, 035, 1);
+    ct_assertfalse(elMasterRamCompare(a, b, &addr));
+    ct_assertequal(addr, 012346u);
+    elMasterRamWrite(b, 012346, 0, 0);
+    ct_asserttrue(elMasterRamCompare(a, b, &addr));
+    elMasterRamFree(a);
+    elMasterRamFree(b);
+}
+
+//
+// Test: modifiers 036 and 037 of the supervisor.  There are no such
+// registers, but the addresses are valid for уи, уим, счи and уии:
+// writes must not reach the page tables next to the modifiers.
+//
+static void modifier_range(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    ElSvsSetTrace(cpu, "", "");
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, уи 36"));
+    store_insn(cpu, 011, ElSvsAsm("уиа 2000(1), уии 37(1)"));
+    store_insn(cpu, 012, ElSvsAsm("сч, счи 36"));
+    store_insn(cpu, 013, ElSvsAsm("стоп 12345(6), мода"));
+    store_data(cpu, 02000, 01234);
+
+    ElSvsSetPC(cpu, 010);
+    ct_assertequal((int)ElSvsSimulate(cpu), ESS_HALT);
+    ct_assertequal(ElSvsGetPC(cpu), 013u);
+    ct_assertequal(ElSvsGetAcc(cpu), 01234u);
+    ct_assertequal(cpu->core.RP[0], 0u);
+    ct_assertequal(cpu->UTLB[0], 0u);
+    ct_assertequal(cpu->UTLB[1], 0u);
+}
+
+//
+// Test: рег on an unknown register is reported to the trace.
+//
+static void unknown_register(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    store_insn(cpu, 010, ElSvsAsm("рег 77, рег 76"));
+    store_insn(cpu, 011, ElSvsAsm("стоп 12345(6), мода"));
+    unlink("register.output");
+    ElSvsSetTrace(cpu, "x", "register.output");
+    ElSvsSetPC(cpu, 010);
+    ct_assertequal((int)ElSvsSimulate(cpu), ESS_HALT);
+    ElSvsSetTrace(cpu, "", "");
+    ct_assertequal(count_lines("register.output", "cpu0 --- 00010л: РЕГ 77 ", false), 1);
+    ct_assertequal(count_lines("register.output", "cpu0 --- 00010п: РЕГ 76 ", false), 1);
+}
+
+//
+// Test: reset of processor and RAM between fuzzing inputs.
+//
+static void fast_reset(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    ElMasterWord word;
+    ElMasterTag tag;
+
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, слц 1"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2000, пб 10"));
+    ElSvsSetPult(cpu, 1, 1);
+    ElSvsSetPC(cpu, 010);
+    ElSvsSetTrace(cpu, "", "");
+    struct ElSvsProcessor *pristine = ElSvsAllocate(0);
+    ct_assertnotnull(pristine);
+    ElSvsCopyState(pristine, cpu);
+
+    // Copy restores registers, counter and interrupt state.
+    ct_assertequal((int)ElSvsStep(cpu, 22), ESS_OK);
+    ct_assertnotequal(ElSvsGetPC(cpu), 010u);
+    ElSvsCopyState(cpu, pristine);
+    ct_assertequal(ElSvsGetPC(cpu), 010u);
+    ct_assertequal(ElSvsGetAcc(cpu), 0u);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 0u);
+    ct_assertequal(cpu->iintr, 0);
+    free(pristine);
+
+    // Clear of overlay releases only written pages, repeatedly.
+    struct ElMasterRam *ram = elMasterRamAllocate();
+    ct_assertnotnull(ram);
+    elMasterRamWrite(ram, 02000, 036, 1);
+    struct ElMasterRamBase *base = elMasterRamBaseCreate(ram);
+    elMasterRamFree(ram);
+    ram = elMasterRamAllocateOverlay(base);
+    ct_assertnotnull(ram);
+    int i;
+    for (i = 0; i < 3; i++) {
+        elMasterRamWrite(ram, 02000, 036, 5);
+        elMasterRamWrite(ram, 070000 + i, 035, 7);
+        ct_assertequal(elMasterRamResidentPages(ram), 2u);
+        elMasterRamClear(ram);
+        ct_assertequal(elMasterRamResidentPages(ram), 0u);
+        elMasterRamRead(ram, 02000, &tag, &word);
+        ct_assertequal(word, 1u);
+        elMasterRamRead(ram, 070000 + i, &tag, &word);
+        ct_assertequal(word, 0u);
+    }
+    elMasterRamFree(ram);
+    elMasterRamBaseFree(base);
+}
+
+//
+// Host extracode with a different result on every call,
+// so that the shadow run diverges.
+//
+static ElSvsStatus count_calls(struct ElSvsProcessor *cpu, unsigned addr)
+{
+    static unsigned count;
+
+    cpu->core.ACC = ++count;
+    return ESS_OK;
+}
+
+//
+// Test: shadow execution by the reference interpreter.
+//
+static void shadow(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    ElSvsShadowStats stats;
+    char line[256];
+
+    store_insn(cpu, 010, ElSvsAsm("сч 2000, слц 1"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2000, пб 10"));
+    store_data(cpu, 02000, 0);
+    store_data(cpu, 02001, 0);
+    ElSvsSetPult(cpu, 1, 1);
+    ElSvsSetPC(cpu, 010);
+    unlink("shadow.output");
+    ElSvsSetTrace(cpu, "x", "shadow.output");
+    ct_assertfalse(ElSvsShadowStart(cpu, "none", 100, 10, NULL));
+    ct_assertfalse(ElSvsShadowStart(cpu, "stepwise", 10, 100, NULL));
+
+    // Same engine: no divergence, results are kept.
+    ct_asserttrue(ElSvsShadowStart(cpu, "stepwise", 100, 10, "shadow.output"));
+    ct_assertequal((int)ElSvsShadowStep(cpu, 1000), ESS_OK);
+    ElSvsShadowGetStats(cpu, &stats);
+    ct_assertequal(stats.segments, 10u);
+    ct_assertequal(stats.instructions, 100u);
+    ct_assertequal(stats.divergences, 0u);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 1000u);
+    ct_assertequal(memory[02000] >> 16, 250u);
+
+    // Side effect of host extracode: divergence with a snapshot,
+    // and the run continues from the reference result.
+    ElSvsSetExtracode(cpu, 064, count_calls);
+    store_insn(cpu, 012, ElSvsAsm("э64, мода"));
+    store_insn(cpu, 013, ElSvsAsm("зп 2001, пб 12"));
+    ElSvsSetPC(cpu, 012);
+    ct_assertequal((int)ElSvsShadowStep(cpu, 2), ESS_OK);
+    ElSvsShadowGetStats(cpu, &stats);
+    ct_assertequal(stats.divergences, 1u);
+    ct_assertequal(ElSvsGetAcc(cpu), 2u);
+    ct_assertequal(memory[02001] >> 16, 2u);
+    ElSvsShadowStop(cpu);
+    ElSvsSetTrace(cpu, "", "");
+
+    FILE *log = fopen("shadow.output", "r");
+    ct_assertnotnull(log);
+    ct_assertnotnull(fgets(line, sizeof(line), log));
+    fclose(log);
+    ct_assertnotnull(strstr(line, "Shadow divergence"));
+    ct_assertnotnull(strstr(line, "ACC"));
+    ct_assertnotnull(strstr(line, "shadow.output-1000"));
+
+    // Snapshot holds the start of the segment.
+    memory[02001] = 0;
+    ct_asserttrue(ElSvsRestoreMemory("shadow.output-1000.mem"));
+    ct_asserttrue(ElSvsRestoreState(cpu, "shadow.output-1000.state"));
+    ct_assertequal(ElSvsGetPC(cpu), 012u);
+    ct_assertequal(ElSvsGetInstructionCount(cpu), 1000u);
+    ct_assertequal(memory[02000] >> 16, 250u);
+    ct_assertequal(memory[02001] >> 16, 0u);
+    unlink("shadow.output-1000.mem");
+    unlink("shadow.output-1000.state");
+}
+
+//
+// Test: memory access follows the mode set by уиа to M0,
+// with mapping of supervisor pages enabled and disabled again.
+//
+static void mmu_modes(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+
+    store_insn(cpu, 010, ElSvsAsm("уиа (0), сч 2000"));
+    store_insn(cpu, 011, ElSvsAsm("зп 2001, уиа 1(0)"));
+    store_insn(cpu, 012, ElSvsAsm("слц 2000, мода"));
+    store_insn(cpu, 013, ElSvsAsm("стоп 12345(6), мода"));
+    store_data(cpu, 02000, 1);
+    store_data(cpu, 012000, 7);
+
+    // Лист 1 супервизора в физическом листе 5.
+    cpu->core.RPS[0] = 5 << 12 | 2 << 24 | 3ull << 36;
+    ElSvsSetPC(cpu, 010);
+    ElSvsSetTrace(cpu, "", "");
+
+    ct_assertequal((int)ElSvsSimulate(cpu), ESS_HALT);
+    ct_assertequal(ElSvsGetPC(cpu), 013u);
+    ct_assertequal(ElSvsGetAcc(cpu), 8u);
+    ct_assertequal(memory[012001] >> 16, 7u);
+    ct_assertequal(memory[02001] >> 16, 0u);
+    ct_asserttrue(cpu->core.M[PSW] & PSW_MMAP_DISABLE);
+}
+
+//
+// Test: per-instruction state starts on a cache line of its own,
+// and the rarely used state does not share lines with it.
+//
+static void hot_state(void *context)
+{
+    struct ElSvsProcessor *cpu = context;
+    uintptr_t base = (uintptr_t) cpu;
+
+    ct_assertequal(base % SVS_CACHE_LINE, 0u);
+    ct_assertequal((uintptr_t) &cpu->prev % SVS_CACHE_LINE, 0u);
+    ct_asserttrue((uintptr_t) &cpu->core.M[SVS_NREGS] - base <= 5 * SVS_CACHE_LINE);
+    ct_assertequal(sizeof(struct ElSvsProcessor) % SVS_CACHE_LINE, 0u);
+}
+
 //
 // Run all tests.
 //
@@ -1689,8 +2990,36 @@ int main(int argc, char *argv[])
         ct_maketest(avx),
         ct_maketest(alu_mul),
         ct_maketest(alu_div),
+        ct_maketest(alu_amx),
+        ct_maketest(step_interrupt),
         ct_maketest(multiply),
         ct_maketest(divide),
+        ct_maketest(stats),
+        ct_maketest(host_extracode),
+        ct_maketest(binary_trace),
+        ct_maketest(async_trace),
+        ct_maketest(trace_filter),
+        ct_maketest(trace_trigger),
+        ct_maketest(flight_recorder),
+        ct_maketest(breakpoints),
+        ct_maketest(save_restore),
+        ct_maketest(fork_children),
+        ct_maketest(reverse_step),
+        ct_maketest(memory_image),
+        ct_maketest(sparse_ram),
+        ct_maketest(ram_overlay),
+        ct_maketest(lockstep),
+        ct_maketest(engines),
+        ct_maketest(fused),
+        ct_maketest(fused_refetch),
+        ct_maketest(aot),
+        ct_maketest(aot_interrupt),
+        ct_maketest(modifier_range),
+        ct_maketest(unknown_register),
+        ct_maketest(fast_reset),
+        ct_maketest(shadow),
+        ct_maketest(mmu_modes),
+        ct_maketest(hot_state),
     };
     const struct ct_testsuite suite = ct_makesuite_setup_teardown(tests, setup, teardown);
 